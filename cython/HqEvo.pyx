@@ -47,18 +47,42 @@ cdef extern from "../src/rates.h":
 	cdef cppclass rates_2to2 :
 		rates_2to2(Xsection_2to2 * Xprocess_, int degeneracy_, double eta_2_, string name_, bool refresh)
 		double interpR(double * arg)
+		void interpR(size_t n, const double * E1, const double * Temp, const double * dt, double * R)
 		void sample_initial(double * arg, vector[ vector[double] ] & IS)
 
 	cdef cppclass rates_2to3 :
 		rates_2to3(Xsection_2to3 * Xprocess_, int degeneracy_, double eta_2_, string name_, bool refresh)
 		double interpR(double * arg)
+		void interpR(size_t n, const double * E1, const double * Temp, const double * dt, double * R)
 		void sample_initial(double * arg, vector[ vector[double] ] & IS)
 
 	cdef cppclass rates_3to2 :
 		rates_3to2(f_3to2 * Xprocess_, int degeneracy_, double eta_2_, double eta_k_, string name_, bool refresh)
 		double interpR(double * arg)
+		void interpR(size_t n, const double * E1, const double * Temp, const double * dt, double * R)
 		void sample_initial(double * arg, vector[ vector[double] ] & IS)
 
+	cdef cppclass channel_rates :
+		size_t size()
+		double interpR(double E1, double Temp, double dt23, double dt32, double * R, double * P)
+
+cdef extern from "../src/table_set.h":
+	cdef cppclass table_set :
+		table_set(double M, size_t Nf, string folder, bool elastic, bool inelastic, bool detailed_balance, bool refresh)
+		Xsection_2to2 * x_Qq_Qq
+		Xsection_2to2 * x_Qg_Qg
+		Xsection_2to3 * x_Qq_Qqg
+		Xsection_2to3 * x_Qg_Qgg
+		f_3to2 * x_Qqg_Qq
+		f_3to2 * x_Qgg_Qg
+		rates_2to2 * r_Qq_Qq
+		rates_2to2 * r_Qg_Qg
+		rates_2to3 * r_Qq_Qqg
+		rates_2to3 * r_Qg_Qgg
+		rates_3to2 * r_Qqg_Qq
+		rates_3to2 * r_Qgg_Qg
+		channel_rates * channels
+
 
 #------------ Heavy quark Langevin transport evolution class -------------
 cdef class HqLGV:
@@ -80,6 +104,7 @@ cdef class HqLGV:
 #-------------Heavy quark linear Boltzmann evolution class------------------------
 cdef class HqLBT(object):
 	cdef bool elastic, inelastic, detailed_balance #2->2, 2->3, 3->2
+	cdef table_set * tables
 	cdef Xsection_2to2 * x_Qq_Qq
 	cdef Xsection_2to2 * x_Qg_Qg
 	cdef Xsection_2to3 * x_Qq_Qqg
@@ -111,36 +136,39 @@ cdef class HqLBT(object):
 		if not os.path.exists(table_folder):
 			os.makedirs(table_folder)
 
+		# all enabled channels are built concurrently, each rate table
+		# only waits for its own cross-section table
+		self.tables = new table_set(self.mass, self.Nf, table_folder,
+						self.elastic, self.inelastic, self.detailed_balance, refresh_table)
 		if self.elastic:
-			self.x_Qq_Qq = new Xsection_2to2(&dX_Qq2Qq_dPS, self.mass, "%s/XQq2Qq.hdf5"%table_folder, refresh_table)
-			self.x_Qg_Qg = new Xsection_2to2(&dX_Qg2Qg_dPS, self.mass, "%s/XQg2Qg.hdf5"%table_folder, refresh_table)
-			self.r_Qq_Qq = new rates_2to2(self.x_Qq_Qq, 12*self.Nf, 0., "%s/RQq2Qq.hdf5"%table_folder, refresh_table)
-			self.r_Qg_Qg = new rates_2to2(self.x_Qg_Qg, 16, 0., "%s/RQg2Qg.hdf5"%table_folder, refresh_table)
+			self.x_Qq_Qq = self.tables.x_Qq_Qq
+			self.x_Qg_Qg = self.tables.x_Qg_Qg
+			self.r_Qq_Qq = self.tables.r_Qq_Qq
+			self.r_Qg_Qg = self.tables.r_Qg_Qg
 			self.Nchannels += 2
 
 		if self.inelastic:
-			self.x_Qq_Qqg = new Xsection_2to3(&M2_Qq2Qqg, self.mass, "%s/XQq2Qqg.hdf5"%table_folder, refresh_table)
-			self.x_Qg_Qgg = new Xsection_2to3(&M2_Qg2Qgg, self.mass, "%s/XQg2Qgg.hdf5"%table_folder, refresh_table)
-			self.r_Qq_Qqg = new rates_2to3(self.x_Qq_Qqg, 12*self.Nf, 0., "%s/RQq2Qqg.hdf5"%table_folder, refresh_table)
-			self.r_Qg_Qgg = new rates_2to3(self.x_Qg_Qgg, 16/2, 0., "%s/RQg2Qgg.hdf5"%table_folder, refresh_table)
+			self.x_Qq_Qqg = self.tables.x_Qq_Qqg
+			self.x_Qg_Qgg = self.tables.x_Qg_Qgg
+			self.r_Qq_Qqg = self.tables.r_Qq_Qqg
+			self.r_Qg_Qgg = self.tables.r_Qg_Qgg
 			self.Nchannels += 2
 
 		if self.detailed_balance:
-			self.x_Qqg_Qq = new f_3to2(&Ker_Qqg2Qq, self.mass, "%s/XQqg2Qq.hdf5"%table_folder, refresh_table)
-			self.x_Qgg_Qg = new f_3to2(&Ker_Qgg2Qg, self.mass, "%s/XQgg2Qg.hdf5"%table_folder, refresh_table)
-			self.r_Qqg_Qq = new rates_3to2(self.x_Qqg_Qq, 12*self.Nf*16, 0., 0., "%s/RQqg2Qq.hdf5"%table_folder, refresh_table)
-			self.r_Qgg_Qg = new rates_3to2(self.x_Qgg_Qg, 16*16/2, 0., 0., "%s/RQgg2Qg.hdf5"%table_folder, refresh_table)
+			self.x_Qqg_Qq = self.tables.x_Qqg_Qq
+			self.x_Qgg_Qg = self.tables.x_Qgg_Qg
+			self.r_Qqg_Qq = self.tables.r_Qqg_Qq
+			self.r_Qgg_Qg = self.tables.r_Qgg_Qg
 			self.Nchannels += 2
 
 		print "# Number of Channels", self.Nchannels
 
 	cpdef (double, double) sample_channel(self, double E1, double T, double dt23, double dt32):
-		cdef double r, psum = 0.0, dt, Pmax = 0.1, Ptot, R1, R2
+		cdef double r, psum = 0.0, dt, Pmax = 0.1, Ptot
 		cdef int i=0
 		cdef int channel_index = -1
+		cdef double R[6]
 		cdef double p[6]
-		cdef double * arg = <double*>malloc(3*sizeof(double))
-		arg[0] = E1; arg[1] = T;
 		# channel < 0 : freestream
 		# 0:	Qq->Qq
 		# 1: 	Qg->Qg
@@ -148,25 +176,8 @@ cdef class HqLBT(object):
 		# 3: 	Qg->Qgg
 		# 4:	Qqg->Qq
 		# 5: 	Qgg->Qg
-		if self.elastic:
-			arg[2] = 0.
-			psum += self.r_Qq_Qq.interpR(arg)
-			p[i] = psum; i += 1
-			psum += self.r_Qg_Qg.interpR(arg)
-			p[i] = psum; i += 1
-		if self.inelastic:
-			arg[2] = dt23
-			psum += self.r_Qq_Qqg.interpR(arg)
-			p[i] = psum; i += 1
-			psum += self.r_Qg_Qgg.interpR(arg)
-			p[i] = psum; i += 1
-		if self.detailed_balance:
-			arg[2] = dt32
-			psum += self.r_Qqg_Qq.interpR(arg)
-			p[i] = psum; i += 1
-			psum += self.r_Qgg_Qg.interpR(arg)
-			p[i] = psum; i += 1
-		free(arg)
+		# the cumulative rates of all enabled channels from one lookup per kind
+		psum = self.tables.channels.interpR(E1, T, dt23, dt32, R, p)
 		# determine an evolution time, which is always less than 0.1 [Gev-1]
 		# when psum is much greater than 0.25 GeV, the step decreases accordingly
 		# to reach a consistent level of solution precision
@@ -241,3 +252,25 @@ cdef class HqLBT(object):
 			result = self.r_Qg_Qg.interpR(arg)
 		free(arg)
 		return result
+
+	# interpR of one channel for a whole ensemble at once: E1, T and dt hold
+	# one value per particle, dt is dt23 for 2->3, dt32 for 3->2 and not read
+	# by 2->2 channels; the rates are written into R
+	cpdef rate_batch(self, int channel, double[::1] E1, double[::1] T, double[::1] dt, double[::1] R):
+		cdef Py_ssize_t n = E1.shape[0]
+		if T.shape[0] != n or dt.shape[0] != n or R.shape[0] != n:
+			raise ValueError("E1, T, dt and R need one value per particle")
+		if n == 0:
+			return
+		if channel == 0:
+			self.r_Qq_Qq.interpR(n, &E1[0], &T[0], &dt[0], &R[0])
+		elif channel == 1:
+			self.r_Qg_Qg.interpR(n, &E1[0], &T[0], &dt[0], &R[0])
+		elif channel == 2:
+			self.r_Qq_Qqg.interpR(n, &E1[0], &T[0], &dt[0], &R[0])
+		elif channel == 3:
+			self.r_Qg_Qgg.interpR(n, &E1[0], &T[0], &dt[0], &R[0])
+		elif channel == 4:
+			self.r_Qqg_Qq.interpR(n, &E1[0], &T[0], &dt[0], &R[0])
+		elif channel == 5:
+			self.r_Qgg_Qg.interpR(n, &E1[0], &T[0], &dt[0], &R[0])
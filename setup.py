@@ -19,7 +19,13 @@ fileLBT = [	'cython/HqEvo.pyx',
 			'src/Xsection.cpp',
 			'src/sample_methods.cpp',
 			'src/rates.cpp',
-			'src/Langevin.cpp']
+			'src/Langevin.cpp',
+			'src/scheduler.cpp',
+			'src/tabulation.cpp',
+			'src/table_set.cpp',
+			'src/integration.cpp',
+			'src/adaptive_grid.cpp',
+			'src/table_spec.cpp']
 modules = [
         Extension('HqEvo', 
         		 sources=fileLBT, 
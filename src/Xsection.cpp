@@ -1,8 +1,9 @@
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 #include <cmath>
-#include <thread>
 #include <vector>
+#include <stdexcept>
 #include <string>
 
 #include <gsl/gsl_math.h>
@@ -10,12 +11,14 @@
 #include <gsl/gsl_monte.h>
 #include <gsl/gsl_monte_vegas.h>
 
-#include <boost/filesystem.hpp>
 
 
 #include "utility.h"
+#include "integration.h"
+#include "table_spec.h"
 #include "matrix_elements.h"
 #include "Xsection.h"
+#include "tabulation.h"
 #include "H5Cpp.h"
 
 extern Debye_mass * t_channel_mD2;
@@ -73,47 +76,37 @@ Xsection::Xsection(double (*dXdPS_)(double *, size_t, void *), double M1_, std::
 
 //============Derived 2->2 Xsection class===================================
 Xsection_2to2::Xsection_2to2(double (*dXdPS_)(double *, size_t, void *), double M1_, std::string name_, bool refresh)
-:	Xsection(dXdPS_, M1_, name_, refresh), rd(), gen(rd()), dist_phi3(0.0, 2.0*M_PI),
-	Nsqrts(200), NT(32),
-	sqrtsL(M1_*1.01), sqrtsH(M1_*30.),
+:	Xsection(dXdPS_, M1_, name_, refresh), rd(), gen(rd()), dist_phi3(0.0, 2.0*M_PI), dist_cdf(0.0, 1.0),
+	Nsqrts(table_specs().points("Xsection_2to2.N_sqrt", 200)), NT(table_specs().points("Xsection_2to2.N_T", 32)),
+	Nt_cdf(table_specs().points("Xsection_2to2.N_t_cdf", 33, 0)),
+	sqrtsL(table_specs().value("Xsection_2to2.sqrts_low", M1_*1.01)), sqrtsH(table_specs().value("Xsection_2to2.sqrts_high", M1_*30.)),
 	dsqrts((sqrtsH-sqrtsL)/(Nsqrts-1.)),
-	TL(0.12), TH(0.8), dT((TH-TL)/(NT-1.)), Xtab(boost::extents[Nsqrts][NT])
+	TL(table_specs().value("Xsection_2to2.T_low", 0.12)), TH(table_specs().value("Xsection_2to2.T_high", 0.8)),
+	dT((TH-TL)/(NT-1.)), Xtab({sqrtsL, TL}, {sqrtsH, TH}, {Nsqrts, NT}, 1+Nt_cdf)
 {
-	bool fileexist = boost::filesystem::exists(name_);
-	if ( (!fileexist) || ( fileexist && refresh) ){
-		std::cout << "# Populating table with new calculation" << std::endl;
-		std::vector<std::thread> threads;
-		size_t Ncores = std::min(size_t(std::thread::hardware_concurrency()), NT);
-		size_t call_per_core = size_t(NT*1./Ncores);
-		size_t call_for_last_core = NT - call_per_core*(Ncores-1);
-		auto code = [this](size_t NTstart_, size_t dNT_) { this->tabulate(NTstart_, dNT_); };
-		for (size_t i=0; i< Ncores ; i++){
-			size_t Nstart = i*call_per_core;
-			size_t dN = (i==Ncores-1)? call_for_last_core : call_per_core;
-			threads.push_back( std::thread(code, Nstart, dN) );
-		}
-		for (std::thread& t : threads)	t.join();
-		save_to_file(name_, "Xsection-tab");
-	}
-	else{
-		std::cout << "# loading existing table" << std::endl;
-		read_from_file(name_, "Xsection-tab");
-	}
+	// the CDF needs both ends of v, 0 disables it
+	if (Nt_cdf == 1) throw std::invalid_argument(name_ + ": N_t_cdf must be 0 or at least 2");
+	load_or_tabulate(name_, "Xsection-tab", refresh);
 	std::cout << std::endl;
 }
 
 void Xsection_2to2::save_to_file(std::string filename, std::string datasetname){
-	const size_t rank = 2;
+	const size_t rank = 3;
 
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
 	H5::H5File file(filename.c_str(), H5F_ACC_TRUNC);
-	hsize_t dims[rank] = {Nsqrts, NT};
-	H5::DSetCreatPropList proplist{};
-	proplist.setChunk(rank, dims);
-
-	H5::DataSpace dataspace(rank, dims);
-	auto datatype(H5::PredType::NATIVE_DOUBLE);
-	H5::DataSet dataset = file.createDataSet(datasetname.c_str(), datatype, dataspace, proplist);
-	dataset.write(Xtab.data(), datatype);
+	H5::DataSet dataset;
+	if (Xgrid.empty()){
+		hsize_t dims[rank] = {1+Nt_cdf, Nsqrts, NT};
+		H5::DSetCreatPropList proplist{};
+		proplist.setChunk(rank, dims);
+
+		H5::DataSpace dataspace(rank, dims);
+		auto datatype(H5::PredType::NATIVE_DOUBLE);
+		dataset = file.createDataSet(datasetname.c_str(), datatype, dataspace, proplist);
+		dataset.write(Xtab.data(), datatype);
+	}
+	else dataset = Xgrid.save(file, datasetname);
 
 	// Attributes
 	hdf5_add_scalar_attr(dataset, "sqrts_low", sqrtsL);
@@ -123,12 +116,14 @@ void Xsection_2to2::save_to_file(std::string filename, std::string datasetname){
 	hdf5_add_scalar_attr(dataset, "T_low", TL);
 	hdf5_add_scalar_attr(dataset, "T_high", TH);
 	hdf5_add_scalar_attr(dataset, "N_T", NT);
+	if (Xgrid.empty()) hdf5_add_scalar_attr(dataset, "N_t_cdf", Nt_cdf);
 	file.close();
 }
 
 void Xsection_2to2::read_from_file(std::string filename, std::string datasetname){
-	const size_t rank = 2;
+	const size_t rank = 3;
 
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
 	H5::H5File file(filename.c_str(), H5F_ACC_RDONLY);
 	H5::DataSet dataset = file.openDataSet(datasetname.c_str());
 	hdf5_read_scalar_attr(dataset, "sqrts_low", sqrtsL);
@@ -140,11 +135,26 @@ void Xsection_2to2::read_from_file(std::string filename, std::string datasetname
 	hdf5_read_scalar_attr(dataset, "T_high", TH);
 	hdf5_read_scalar_attr(dataset, "N_T", NT);
 	dT = (TH-TL)/(NT-1.);
+	{
+		// the moments belong to the previous table
+		std::lock_guard<std::mutex> lock_moments(m_moments);
+		moments.clear();
+	}
 
-	Xtab.resize(boost::extents[Nsqrts][NT]);
+	if (adaptive_grid::is_adaptive(file, datasetname)){
+		Xgrid = adaptive_grid({sqrtsL, TL}, {sqrtsH, TH}, {Nsqrts, NT});
+		Xgrid.read(file, datasetname);
+		return;
+	}
+	Xgrid = adaptive_grid();
+	// tables without a t distribution have no N_t_cdf and only sigma
+	Nt_cdf = 0;
+	if (dataset.attrExists("N_t_cdf")) hdf5_read_scalar_attr(dataset, "N_t_cdf", Nt_cdf);
+	Xtab.reset({sqrtsL, TL}, {sqrtsH, TH}, {Nsqrts, NT}, 1+Nt_cdf);
 	hsize_t dims_mem[rank];
-  	dims_mem[0] = Nsqrts;
-  	dims_mem[1] = NT;
+	dims_mem[0] = 1+Nt_cdf;
+  	dims_mem[1] = Nsqrts;
+  	dims_mem[2] = NT;
 	H5::DataSpace mem_space(rank, dims_mem);
 
 	H5::DataSpace data_space = dataset.getSpace();
@@ -152,37 +162,33 @@ void Xsection_2to2::read_from_file(std::string filename, std::string datasetname
 	file.close();
 }
 
-void Xsection_2to2::tabulate(size_t T_start, size_t dnT){
-	double arg[2];
-	for (size_t i=0; i<Nsqrts; ++i) {
-		arg[0] = std::pow(sqrtsL + i*dsqrts, 2);
-		for (size_t j=T_start; j<(T_start+dnT); j++) {
-			arg[1] = TL + j*dT;
-			Xtab[i][j] = calculate(arg)/approx_X22(arg, M1);
-		}
-	}
+void Xsection_2to2::describe_inputs(table_inputs & inputs){
+	inputs.add("M", M1);
+	inputs.add("N_t_cdf", Nt_cdf);
+	inputs.add_axis("sqrts", sqrtsL, sqrtsH, Nsqrts);
+	inputs.add_axis("T", TL, TH, NT);
 }
 
-double Xsection_2to2::interpX(double * arg){
-	double sqrts = std::sqrt(arg[0]), Temp = arg[1];
-	if (Temp < TL) Temp = TL;
-	if (Temp >= TH) Temp = TH-dT;
-	if (sqrts < sqrtsL) sqrts = sqrtsL;
-	if (sqrts >= sqrtsH) sqrts = sqrtsH-dsqrts;
-	if (std::pow(arg[0]-M1*M1,2)/arg[0] < t_channel_mD2->get_mD2(Temp) )
-		return 0.;
-	double xT, rT, xsqrts, rsqrts;
-	size_t iT, isqrts;
-	xT = (Temp-TL)/dT;	iT = floor(xT); rT = xT - iT;
-	xsqrts = (sqrts - sqrtsL)/dsqrts; isqrts = floor(xsqrts); rsqrts = xsqrts - isqrts;
-	return approx_X22(arg, M1)*interpolate2d(&Xtab, isqrts, iT, rsqrts, rT);
+double Xsection_2to2::tabulate(size_t cell){
+	size_t i = cell/NT, j = cell%NT;
+	double arg[2];
+	arg[0] = std::pow(sqrtsL + i*dsqrts, 2);
+	arg[1] = TL + j*dT;
+	return calculate(arg)/approx_X22(arg, M1);
 }
 
+void Xsection_2to2::tabulate_cell(size_t cell, double * result){
+	size_t i = cell/NT, j = cell%NT;
+	double arg[2];
+	arg[0] = std::pow(sqrtsL + i*dsqrts, 2);
+	arg[1] = TL + j*dT;
+	std::vector<double> F(Nt_cdf);
+	double total = t_cumulative(arg[0], arg[1], F.data());
+	result[0] = total/approx_X22(arg, M1);
+	for (size_t k=0; k<Nt_cdf; k++) result[1+k] = (total > 0.) ? F[k]/total : double(k)/(Nt_cdf-1.);
+}
 
-double Xsection_2to2::calculate(double * arg){
-	double s = arg[0], Temp = arg[1];
-	double result, error, tmin;
-	gsl_integration_workspace *w = gsl_integration_workspace_alloc(1000);
+double Xsection_2to2::t_cumulative(double s, double Temp, double * F){
 	Mygsl_integration_params * params = new Mygsl_integration_params;
 	params->f = dXdPS;
 	params->params = new double[3];
@@ -190,16 +196,134 @@ double Xsection_2to2::calculate(double * arg){
 	params->params[1] = Temp;
 	params->params[2] = M1;
 
-    gsl_function F;
-	F.function = gsl_1dfunc_wrapper;
-	F.params = params;
-	tmin = -std::pow(s-M1*M1, 2)/s;
-	gsl_integration_qag(&F, tmin, 0.0, 0, 1e-4, 1000, 6, w, &result, &error);
-        delete [] params->params;
+    gsl_function G;
+	G.function = gsl_1dfunc_wrapper;
+	G.params = params;
+	double tmin = -std::pow(s-M1*M1, 2)/s, error;
+	double mD2 = t_channel_mD2->get_mD2(Temp), L = std::log(1. - tmin/mD2);
+	// one short quadrature per interval of v, from t = 0 down to tmin
+	double t_last = 0., total = 0.;
+	if (Nt_cdf > 0) F[0] = 0.;
+	for (size_t k=1; k<Nt_cdf; k++){
+		double t = (k+1 == Nt_cdf) ? tmin : -mD2*std::expm1(L*k/(Nt_cdf-1.));
+		total += qag_integrate(&G, t, t_last, 0, table_specs().epsrel(1e-4), 1000, GSL_INTEG_GAUSS15, &error);
+		F[k] = total;
+		t_last = t;
+	}
+	if (Nt_cdf == 0) total = qag_integrate(&G, tmin, 0.0, 0, table_specs().epsrel(1e-4), 1000, 6, &error);
+	delete [] params->params;
 	delete params;
-	gsl_integration_workspace_free(w);
+	return total;
+}
 
-    return result;
+bool Xsection_2to2::tabulate_adaptive(std::string filename, std::string datasetname){
+	// base grid 8 times coarser than the uniform one, refined where needed
+	Nsqrts = std::max<size_t>(2, (Nsqrts-1)/8 + 1); dsqrts = (sqrtsH-sqrtsL)/(Nsqrts-1.);
+	NT = std::max<size_t>(2, (NT-1)/8 + 1); dT = (TH-TL)/(NT-1.);
+	Xgrid = adaptive_grid({sqrtsL, TL}, {sqrtsH, TH}, {Nsqrts, NT}, table_options().refine_max_level);
+	Xgrid.build(filename, [this](double * x){
+			double arg[2] = {x[0]*x[0], x[1]};
+			return calculate(arg)/approx_X22(arg, M1);
+		}, table_options().refine_tolerance);
+	save_to_file(filename, datasetname);
+	return true;
+}
+
+double Xsection_2to2::interpX(double * arg){
+	double sqrts = std::sqrt(arg[0]), Temp = arg[1];
+	if (!Xgrid.empty()){
+		if (std::pow(arg[0]-M1*M1,2)/arg[0] < t_channel_mD2->get_mD2(std::max(Temp, TL)) )
+			return 0.;
+		double x[2] = {sqrts, Temp};
+		return approx_X22(arg, M1)*Xgrid.interpolate(x);
+	}
+	if (std::pow(arg[0]-M1*M1,2)/arg[0] < t_channel_mD2->get_mD2(std::min(std::max(Temp, TL), TH)) )
+		return 0.;
+	double x[2] = {sqrts, Temp};
+	grid_point<2> p;
+	Xtab.locate(x, p);
+	require_cells({p.index[0], p.index[1]});
+	return approx_X22(arg, M1)*Xtab.interpolate(p);
+}
+
+std::shared_ptr<const sigma_moment_table> Xsection_2to2::moment_table(double Temp, double s_max){
+	{
+		std::lock_guard<std::mutex> lock(m_moments);
+		auto found = moments.find(Temp);
+		if (found != moments.end() && found->second->s_max >= s_max) return found->second;
+		// grow geometrically, rebuilding for every larger s would not pay off
+		if (found != moments.end()) s_max = std::max(s_max, 2.*found->second->s_max);
+	}
+	std::shared_ptr<sigma_moment_table> table(new sigma_moment_table);
+	table->s_max = s_max;
+	// threshold of interpX, (s-M^2)^2/s = mD^2, at its clamped temperature
+	double M2 = M1*M1;
+	double Tc = Xgrid.empty() ? std::min(std::max(Temp, TL), TH) : std::max(Temp, TL);
+	double mD2 = t_channel_mD2->get_mD2(Tc);
+	double s_th = M2 + 0.5*mD2 + std::sqrt(mD2*M2 + 0.25*mD2*mD2);
+	// every node of the interpolation grid, a refined grid at its finest
+	// spacing; sigma varies fast close to the threshold, the cubic Hermite
+	// interpolation needs a few nodes per grid step there
+	const double Nsub = 4.;
+	double step = (Xgrid.empty() ? dsqrts : dsqrts/double(size_t(1) << Xgrid.get_max_level()))/Nsub;
+	table->sqrts.push_back(std::sqrt(s_th));
+	for (double k = std::floor((table->sqrts[0]-sqrtsL)/step) + 1.; table->sqrts.back()*table->sqrts.back() < s_max; k++)
+		table->sqrts.push_back(sqrtsL + k*step);
+
+	// dB/dsqrts
+	auto dB = [&](double sqrts){
+		double arg[2] = {sqrts*sqrts, Temp};
+		return (arg[0]-M2)*interpX(arg)*2.*sqrts;
+	};
+	const double x5[5] = {0., -0.5384693101056831, 0.5384693101056831, -0.9061798459386640, 0.9061798459386640},
+				 w5[5] = {0.5688888888888889, 0.4786286704993665, 0.4786286704993665, 0.2369268850561891, 0.2369268850561891};
+	const double inside = 1e-9;
+	size_t Nnodes = table->sqrts.size();
+	table->B.assign(Nnodes, 0.);
+	table->dleft.resize(Nnodes-1);
+	table->dright.resize(Nnodes-1);
+	for (size_t i=0; i+1<Nnodes; i++){
+		double a = table->sqrts[i], b = table->sqrts[i+1], center = 0.5*(a+b), half = 0.5*(b-a);
+		double sum = 0.;
+		for (size_t k=0; k<5; k++) sum += w5[k]*dB(center + half*x5[k]);
+		table->B[i+1] = table->B[i] + half*sum;
+		table->dleft[i] = dB(a + inside*(b-a));
+		table->dright[i] = dB(b - inside*(b-a));
+	}
+	std::lock_guard<std::mutex> lock(m_moments);
+	auto entry = moments.insert(std::make_pair(Temp, std::shared_ptr<const sigma_moment_table>(table)));
+	if (entry.second){
+		moment_order.push_back(Temp);
+		if (moment_order.size() > max_moment_tables){
+			moments.erase(moment_order.front());
+			moment_order.pop_front();
+		}
+	}
+	else if (entry.first->second->s_max < table->s_max) entry.first->second = table;
+	return entry.first->second;
+}
+
+double Xsection_2to2::integrate_moment(double * arg){
+	double s1 = arg[0], s2 = arg[1], Temp = arg[2];
+	std::shared_ptr<const sigma_moment_table> table = moment_table(Temp, std::max(s1, s2));
+	auto B = [&table](double s){
+		const std::vector<double> & q = table->sqrts;
+		double sqrts = std::sqrt(s);
+		if (sqrts <= q.front()) return 0.;
+		size_t i = size_t(std::upper_bound(q.begin(), q.end(), sqrts) - q.begin()) - 1;
+		if (i+1 >= q.size()) return table->B.back();
+		double w = q[i+1]-q[i], t = (sqrts-q[i])/w;
+		double h00 = (1.+2.*t)*(1.-t)*(1.-t), h10 = t*(1.-t)*(1.-t),
+			   h01 = t*t*(3.-2.*t), h11 = t*t*(t-1.);
+		return h00*table->B[i] + h10*w*table->dleft[i] + h01*table->B[i+1] + h11*w*table->dright[i];
+	};
+	return B(s2) - B(s1);
+}
+
+double Xsection_2to2::calculate(double * arg){
+	// the endpoint of the cumulative distribution in t
+	std::vector<double> F(Nt_cdf);
+	return t_cumulative(arg[0], arg[1], F.data());
 }
 
 void Xsection_2to2::sample_dXdPS(double * arg, std::vector< std::vector<double> > & FS){
@@ -211,7 +335,28 @@ void Xsection_2to2::sample_dXdPS(double * arg, std::vector< std::vector<double>
 	double pQ = (s-M2)/2./sqrts;
 	double EQ = sqrts - pQ;
 	double tmin = -std::pow(s-M2, 2)/s;
-	double t = sampler1d.sample(dXdPS, tmin, 0., p);
+	double t;
+	if (Xgrid.empty() && Nt_cdf > 1){
+		// the CDF of the surrounding cells in v, inverted linearly
+		double x[2] = {sqrts, Temp};
+		grid_point<2> cell;
+		Xtab.locate(x, cell);
+		require_cells({cell.index[0], cell.index[1]});
+		double u = dist_cdf(gen), F_low = 0., F_high = 1.;
+		size_t k = 1;
+		for (; k+1<Nt_cdf; k++){
+			F_high = Xtab.interpolate(cell, 1+k);
+			if (u < F_high) break;
+			F_low = F_high;
+			F_high = 1.;
+		}
+		// between two nodes, t follows the screened Coulomb shape 1/(mD^2-t)^2
+		double f = (F_high > F_low) ? (u-F_low)/(F_high-F_low) : 0.5;
+		double mD2 = t_channel_mD2->get_mD2(Temp), L = std::log(1. - tmin/mD2);
+		double w_low = std::exp(-L*(k-1.)/(Nt_cdf-1.)), w_high = std::exp(-L*k/(Nt_cdf-1.));
+		t = mD2*(1. - 1./((1.-f)*w_low + f*w_high));
+	}
+	else t = sampler1d.sample(dXdPS, tmin, 0., p);
 	double costheta3 = 1. + t/pQ/pQ/2.;
 	double sintheta3 = std::sqrt(1. - costheta3*costheta3);
 	double phi3 = dist_phi3(gen);
@@ -227,40 +372,34 @@ void Xsection_2to2::sample_dXdPS(double * arg, std::vector< std::vector<double>
 }
 
 //============Derived 2->3 Xsection class===================================
-Xsection_2to3::Xsection_2to3(double (*dXdPS_)(double *, size_t, void *), double M1_, std::string name_, bool refresh)
+Xsection_2to3::Xsection_2to3(double (*dXdPS_)(double *, size_t, void *), double M1_, std::string name_, bool refresh,
+							 void (*dXdPS_dt_)(double *, size_t, void *, double *),
+							 fused_cells * fused_, size_t fused_channel_,
+							 void (*dXdPS_channels_dt_)(double *, size_t, void *, double *))
 :	Xsection(dXdPS_, M1_, name_, refresh), rd(), gen(rd()), dist_phi4(0.0, 2.0*M_PI),
-	Nsqrts(50), NT(16), Ndt(10),
-	sqrtsL(M1_*1.01), sqrtsH(M1_*30.), dsqrts((sqrtsH-sqrtsL)/(Nsqrts-1.)),
-	TL(0.12), TH(0.8), dT((TH-TL)/(NT-1.)),
-	dtL(0.1), dtH(5.0), ddt((dtH-dtL)/(Ndt-1.)), Xtab(boost::extents[Nsqrts][NT][Ndt])
+	Nsqrts(table_specs().points("Xsection_2to3.N_sqrt_half", 50)), NT(table_specs().points("Xsection_2to3.N_T", 16)),
+	Ndt(table_specs().points("Xsection_2to3.N_dt", 10)),
+	sqrtsL(table_specs().value("Xsection_2to3.sqrts_low", M1_*1.01)), sqrtsH(table_specs().value("Xsection_2to3.sqrts_high", M1_*30.)),
+	dsqrts((sqrtsH-sqrtsL)/(Nsqrts-1.)),
+	TL(table_specs().value("Xsection_2to3.T_low", 0.12)), TH(table_specs().value("Xsection_2to3.T_high", 0.8)),
+	dT((TH-TL)/(NT-1.)),
+	dtL(table_specs().value("Xsection_2to3.dt_low", 0.1)), dtH(table_specs().value("Xsection_2to3.dt_high", 5.0)),
+	ddt((dtH-dtL)/(Ndt-1.)), Xtab({sqrtsL, TL, dtL}, {sqrtsH, TH, dtH}, {Nsqrts, NT, Ndt}),
+	integrator(make_integrator(table_specs().choice("Xsection_2to3.integrator", "vegas"))),
+	dXdPS_dt(dXdPS_dt_), fused(dXdPS_dt_ && dXdPS_channels_dt_ ? fused_ : NULL),
+	fused_channel(fused_channel_), dXdPS_channels_dt(dXdPS_channels_dt_)
 {
 
-	bool fileexist = boost::filesystem::exists(name_);
-	if ( (!fileexist) || ( fileexist && refresh) ){
-		std::cout << "# Populating table with new calculation" << std::endl;
-		std::vector<std::thread> threads;
-		size_t Ncores = std::min(size_t(std::thread::hardware_concurrency()), NT);
-		size_t call_per_core = size_t(NT*1./Ncores);
-		size_t call_for_last_core = NT - call_per_core*(Ncores-1);
-		auto code = [this](size_t NTstart_, size_t dNT_) { this->tabulate(NTstart_, dNT_); };
-		for (size_t i=0; i< Ncores ; i++){
-			size_t Nstart = i*call_per_core;
-			size_t dN = (i==Ncores-1)? call_for_last_core : call_per_core;
-			threads.push_back( std::thread(code, Nstart, dN) );
-		}
-		for (std::thread& t : threads)	t.join();
-		save_to_file(name_, "Xsection-tab");
-	}
-	else{
-		std::cout << "# loading existing table" << std::endl;
-		read_from_file(name_, "Xsection-tab");
-	}
+	load_or_tabulate(name_, "Xsection-tab", refresh);
+	// lazy cells are computed one by one, never for the other channels
+	if (fused) fused->leave(fused_channel);
 	std::cout << std::endl;
 }
 
 void Xsection_2to3::save_to_file(std::string filename, std::string datasetname){
 	const size_t rank = 3;
 
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
 	H5::H5File file(filename.c_str(), H5F_ACC_TRUNC);
 	hsize_t dims[rank] = {Nsqrts, NT, Ndt};
 	H5::DSetCreatPropList proplist{};
@@ -289,6 +428,7 @@ void Xsection_2to3::save_to_file(std::string filename, std::string datasetname){
 void Xsection_2to3::read_from_file(std::string filename, std::string datasetname){
 	const size_t rank = 3;
 
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
 	H5::H5File file(filename.c_str(), H5F_ACC_RDONLY);
 	H5::DataSet dataset = file.openDataSet(datasetname.c_str());
 
@@ -307,7 +447,7 @@ void Xsection_2to3::read_from_file(std::string filename, std::string datasetname
 	hdf5_read_scalar_attr(dataset, "N_dt", Ndt);
 	ddt = (dtH-dtL)/(Ndt-1.);
 
-	Xtab.resize(boost::extents[Nsqrts][NT][Ndt]);
+	Xtab.reset({sqrtsL, TL, dtL}, {sqrtsH, TH, dtH}, {Nsqrts, NT, Ndt});
 	hsize_t dims_mem[rank];
   	dims_mem[0] = Nsqrts;
   	dims_mem[1] = NT;
@@ -319,45 +459,77 @@ void Xsection_2to3::read_from_file(std::string filename, std::string datasetname
 	file.close();
 }
 
-void Xsection_2to3::tabulate(size_t T_start, size_t dnT){
-	double * arg = new double[3]; // s, T, dt
-	for (size_t i=0; i<Nsqrts; i++) {
-		arg[0] = std::pow(sqrtsL + i*dsqrts, 2);
-		for (size_t j=T_start; j<(T_start+dnT); j++) {
-			arg[1] = TL + j*dT;
-			for (size_t k=0; k<Ndt; k++) {
-				arg[2] = dtL + k*ddt;
-				Xtab[i][j][k] = calculate(arg)/approx_X23(arg, M1);
-			}
+void Xsection_2to3::describe_inputs(table_inputs & inputs){
+	inputs.add("M", M1);
+	inputs.add("integrator", integrator->get_name());
+	if (dXdPS_dt) inputs.add("dt_integration", "shared");
+	inputs.add_axis("sqrts", sqrtsL, sqrtsH, Nsqrts);
+	inputs.add_axis("T", TL, TH, NT);
+	inputs.add_axis("dt", dtL, dtH, Ndt);
+}
+
+double Xsection_2to3::tabulate(size_t cell){
+	size_t i = cell/(NT*Ndt), j = (cell/Ndt)%NT, k = cell%Ndt;
+	double arg[3]; // s, T, dt
+	arg[0] = std::pow(sqrtsL + i*dsqrts, 2);
+	arg[1] = TL + j*dT;
+	arg[2] = dtL + k*ddt;
+	return calculate(arg)/approx_X23(arg, M1);
+}
+
+void Xsection_2to3::tabulate_group(size_t first, double * result){
+	size_t i = first/(NT*Ndt), j = (first/Ndt)%NT;
+	double s = std::pow(sqrtsL + i*dsqrts, 2), Temp = TL + j*dT;
+	if (fused){
+		// the same cell of a fused channel has the same coordinates
+		std::vector<double> key = {M1, s, Temp, dtL, dtH, double(Ndt)};
+		if (fused->get(key, fused_channel, Ndt, result, [this, s, Temp](double * all){
+				integrate_dt(dXdPS_channels_dt, fused->size(), s, Temp, all);
+			})) return;
+	}
+	integrate_dt(dXdPS_dt, 1, s, Temp, result);
+}
+
+void Xsection_2to3::integrate_dt(void (*f)(double *, size_t, void *, double *), size_t Nchannels,
+								 double s, double Temp, double * result){
+	std::vector<double> params(4+Ndt);
+	params[0] = s; params[1] = Temp; params[2] = M1; params[3] = Ndt;
+	for (size_t k=0; k<Ndt; k++) params[4+k] = dtL + k*ddt;
+
+	vector_monte_function G = {f, 4, Nchannels*Ndt, params.data()};
+	double xl[4], xu[4];
+	integration_limits(s, xl, xu);
+	integration_goal goal = {table_specs().calls(4000), table_specs().epsrel(5e-3), table_specs().calls(1000000), 1.,
+							 table_options().cell_time_limit};
+	std::vector<integration_result> results(Nchannels*Ndt);
+	integrator->integrate(&G, xl, xu, goal, results.data());
+	for (size_t c=0; c<Nchannels; c++){
+		for (size_t k=0; k<Ndt; k++){
+			double arg[3] = {s, Temp, params[4+k]};
+			result[c*Ndt+k] = results[c*Ndt+k].value*2./c256pi4/(s-M1*M1)/approx_X23(arg, M1);
 		}
 	}
-	delete [] arg;
+}
+
+void Xsection_2to3::integration_limits(double s, double * xl, double * xu){
+	// k, p4, phi4k, cos4
+	double sqrts = std::sqrt(s), M2 = M1*M1;
+	xl[0] = -15.; xu[0] = std::log((sqrts-M1)/(sqrts+M1));
+	xl[1] = -std::log(1.-M2/s); xu[1] = 15.;
+	xl[2] = -10.0; xu[2] = 0.;
+	xl[3] = -M_PI; xu[3] = M_PI;
 }
 
 double Xsection_2to3::interpX(double * arg){
-	double sqrts = std::sqrt(arg[0]), Temp = arg[1], dt = arg[2];
-	if (sqrts < sqrtsL) sqrts = sqrtsL;
-	if (sqrts >= sqrtsH) sqrts = sqrtsH-dsqrts;
-	if (Temp < TL) Temp = TL;
-	if (Temp >= TH) Temp = TH-dT;
-	if (dt < dtL) dt = dtL;
-	if (dt >= dtH) dt = dtH-ddt;
-	double xsqrts, rsqrts,
-		   xT, rT,
-		   xdt, rdt;
-	size_t isqrts, iT, idt;
-	xsqrts = (sqrts-sqrtsL)/dsqrts;	isqrts = floor(xsqrts); rsqrts = xsqrts - isqrts;
-	xT = (Temp-TL)/dT;	iT = floor(xT); rT = xT - iT;
-	xdt = (dt-dtL)/ddt;	idt = floor(xdt); rdt = xdt - idt;
-	return approx_X23(arg, M1)*interpolate3d(&Xtab, isqrts, iT, idt, rsqrts, rT, rdt);
+	double x[3] = {std::sqrt(arg[0]), arg[1], arg[2]};
+	grid_point<3> p;
+	Xtab.locate(x, p);
+	require_cells({p.index[0], p.index[1], p.index[2]});
+	return approx_X23(arg, M1)*Xtab.interpolate(p);
 }
 
 double Xsection_2to3::calculate(double * arg){
 	double s = arg[0], Temp = arg[1], dt = arg[2];
-	double result, error;
-
-	const gsl_rng_type * Tr = gsl_rng_default;
-	gsl_rng * r = gsl_rng_alloc(Tr);
 
 	double * params = new double[4];
 	params[0] = s; params[1] = Temp; params[2] = M1; params[3] = dt;
@@ -368,20 +540,15 @@ double Xsection_2to3::calculate(double * arg){
 	G.params = params;
 
 	// limits of the integration
-	double sqrts = std::sqrt(s), M2 = M1*M1;
+	double M2 = M1*M1;
 	double xl[4], xu[4];
-	xl[0] = -15.; xu[0] = std::log((sqrts-M1)/(sqrts+M1));
-	xl[1] = -std::log(1.-M2/s); xu[1] = 15.;
-	xl[2] = -10.0; xu[2] = 0.;
-	xl[3] = -M_PI; xu[3] = M_PI;
+	integration_limits(s, xl, xu);
 
-	// Actuall integration, require the Xi-square to be close to 1,  (0.5, 1.5)
-	gsl_monte_vegas_state * sv = gsl_monte_vegas_alloc(4);
-	do{
-		gsl_monte_vegas_integrate(&G, xl, xu, 4, 4000, r, sv, &result, &error);
-	}while(std::abs(gsl_monte_vegas_chisq(sv)-1.0)>1.);
-	gsl_monte_vegas_free(sv);
-	gsl_rng_free(r);
+	// Actuall integration, vegas requires the Xi-square to be close to 1,  (0., 2.),
+	// and the relative error to meet the goal
+	integration_goal goal = {table_specs().calls(4000), table_specs().epsrel(5e-3), table_specs().calls(1000000), 1.,
+							 table_options().cell_time_limit};
+	double result = integrator->integrate(&G, xl, xu, goal).value;
 	delete [] params;
 	return result*2./c256pi4/(s-M2);
 }
@@ -469,40 +636,27 @@ void Xsection_2to3::sample_dXdPS(double * arg, std::vector< std::vector<double>
 
 f_3to2::f_3to2(double (*dXdPS_)(double *, size_t, void *), double M1_, std::string name_, bool refresh)
 :	Xsection(dXdPS_, M1_, name_, refresh), rd(), gen(rd()), dist_phi4(0.0, 2.0*M_PI),
-	Nsqrts(40), NT(8), Na1(10), Na2(10),
-	sqrtsL(M1_*1.01), sqrtsH(M1_*30.), dsqrts((sqrtsH-sqrtsL)/(Nsqrts-1.)),
-	TL(0.12), TH(0.8), dT((TH-TL)/(NT-1.)),
-	a1L(0.501), a1H(0.999), da1((a1H-a1L)/(Na1-1.)),
-	a2L(-0.999), a2H(0.999), da2((a2H-a2L)/(Na2-1.)),
-	Xtab(boost::extents[Nsqrts][NT][Na1][Na2])
+	Nsqrts(table_specs().points("f_3to2.N_sqrt_half", 40)), NT(table_specs().points("f_3to2.N_T", 8)),
+	Na1(table_specs().points("f_3to2.N_a1", 10)), Na2(table_specs().points("f_3to2.N_a2", 10)),
+	sqrtsL(table_specs().value("f_3to2.sqrts_low", M1_*1.01)), sqrtsH(table_specs().value("f_3to2.sqrts_high", M1_*30.)),
+	dsqrts((sqrtsH-sqrtsL)/(Nsqrts-1.)),
+	TL(table_specs().value("f_3to2.T_low", 0.12)), TH(table_specs().value("f_3to2.T_high", 0.8)),
+	dT((TH-TL)/(NT-1.)),
+	a1L(table_specs().value("f_3to2.a1_low", 0.501)), a1H(table_specs().value("f_3to2.a1_high", 0.999)),
+	da1((a1H-a1L)/(Na1-1.)),
+	a2L(table_specs().value("f_3to2.a2_low", -0.999)), a2H(table_specs().value("f_3to2.a2_high", 0.999)),
+	da2((a2H-a2L)/(Na2-1.)),
+	Xtab({sqrtsL, TL, a1L, a2L}, {sqrtsH, TH, a1H, a2H}, {Nsqrts, NT, Na1, Na2})
 {
 
-	bool fileexist = boost::filesystem::exists(name_);
-	if ( (!fileexist) || ( fileexist && refresh) ){
-		std::cout << "# Populating table with new calculation" << std::endl;
-		std::vector<std::thread> threads;
-		size_t Ncores = std::min(size_t(std::thread::hardware_concurrency()), NT);
-		size_t call_per_core = size_t(NT*1./Ncores);
-		size_t call_for_last_core = NT - call_per_core*(Ncores-1);
-		auto code = [this](size_t NTstart_, size_t dNT_) { this->tabulate(NTstart_, dNT_); };
-		for (size_t i=0; i< Ncores ; i++){
-			size_t Nstart = i*call_per_core;
-			size_t dN = (i==Ncores-1)? call_for_last_core : call_per_core;
-			threads.push_back( std::thread(code, Nstart, dN) );
-		}
-		for (std::thread& t : threads)	t.join();
-		save_to_file(name_, "Xsection-tab");
-	}
-	else{
-		std::cout << "# loading existing table" << std::endl;
-		read_from_file(name_, "Xsection-tab");
-	}
+	load_or_tabulate(name_, "Xsection-tab", refresh);
 	std::cout << std::endl;
 }
 
 void f_3to2::save_to_file(std::string filename, std::string datasetname){
 	const size_t rank = 4;
 
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
 	H5::H5File file(filename.c_str(), H5F_ACC_TRUNC);
 	hsize_t dims[rank] = {Nsqrts, NT, Na1, Na2};
 	H5::DSetCreatPropList proplist{};
@@ -535,6 +689,7 @@ void f_3to2::save_to_file(std::string filename, std::string datasetname){
 void f_3to2::read_from_file(std::string filename, std::string datasetname){
 	const size_t rank = 4;
 
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
 	H5::H5File file(filename.c_str(), H5F_ACC_RDONLY);
 	H5::DataSet dataset = file.openDataSet(datasetname.c_str());
 
@@ -556,9 +711,9 @@ void f_3to2::read_from_file(std::string filename, std::string datasetname){
 	hdf5_read_scalar_attr(dataset, "a2_low", a2L);
 	hdf5_read_scalar_attr(dataset, "a2_high", a2H);
 	hdf5_read_scalar_attr(dataset, "N_a2", Na2);
-	da1 = (a1H-a1L)/(Na1-1.);
+	da2 = (a2H-a2L)/(Na2-1.);
 
-	Xtab.resize(boost::extents[Nsqrts][NT][Na1][Na2]);
+	Xtab.reset({sqrtsL, TL, a1L, a2L}, {sqrtsH, TH, a1H, a2H}, {Nsqrts, NT, Na1, Na2});
 	hsize_t dims_mem[rank];
   	dims_mem[0] = Nsqrts;
   	dims_mem[1] = NT;
@@ -571,18 +726,23 @@ void f_3to2::read_from_file(std::string filename, std::string datasetname){
 	file.close();
 }
 
-void f_3to2::tabulate(size_t T_start, size_t dnT){
-	double * arg = new double[4];
-	for (size_t i=0; i<Nsqrts; i++) { arg[0] = std::pow(sqrtsL + i*dsqrts, 2);
-		for (size_t j=0; j<NT; j++) { arg[1] = TL + j*dT;
-			for (size_t k=0; k<Na1; k++) { arg[2] = a1L + k*da1;
-				for (size_t t=0; t<Na2; t++) { arg[3] = a2L + t*da2;
-					Xtab[i][j][k][t] = calculate(arg)/approx_X32(arg, M1);
-				}
-			}
-		}
-	}
-	delete [] arg;
+void f_3to2::describe_inputs(table_inputs & inputs){
+	inputs.add("M", M1);
+	inputs.add_axis("sqrts", sqrtsL, sqrtsH, Nsqrts);
+	inputs.add_axis("T", TL, TH, NT);
+	inputs.add_axis("a1", a1L, a1H, Na1);
+	inputs.add_axis("a2", a2L, a2H, Na2);
+}
+
+double f_3to2::tabulate(size_t cell){
+	size_t i = cell/(NT*Na1*Na2), j = (cell/(Na1*Na2))%NT,
+		   k = (cell/Na2)%Na1, t = cell%Na2;
+	double arg[4]; // s, T, a1, a2
+	arg[0] = std::pow(sqrtsL + i*dsqrts, 2);
+	arg[1] = TL + j*dT;
+	arg[2] = a1L + k*da1;
+	arg[3] = a2L + t*da2;
+	return calculate(arg)/approx_X32(arg, M1);
 }
 
 double f_3to2::interpX(double * arg){
@@ -597,17 +757,11 @@ double f_3to2::interpX(double * arg){
 	if (a2 < a2L) a2 = a2L;
 	if (a2 >= a2H) a2 = a2H-da2;
 
-	double xT, rT,
-		   xsqrts, rsqrts,
-		   xa1, ra1,
-		   xa2, ra2;
-	size_t isqrts, iT, ia1, ia2;
-	xsqrts = (sqrts-sqrtsL)/dsqrts;	isqrts = floor(xsqrts); rsqrts = xsqrts - isqrts;
-	xT = (Temp-TL)/dT;	iT = floor(xT); rT = xT - iT;
-	xa1 = (a1-a1L)/da1;	ia1 = floor(xa1); ra1 = xa1 - ia1;
-	xa2 = (a2-a2L)/da2;	ia2 = floor(xa2); ra2 = xa2 - ia2;
-
-	double raw_result = interpolate4d(&Xtab, isqrts, iT, ia1, ia2, rsqrts, rT, ra1, ra2)*approx_X32(arg, M1);
+	double x[4] = {sqrts, Temp, a1, a2};
+	grid_point<4> p;
+	Xtab.locate(x, p);
+	require_cells({p.index[0], p.index[1], p.index[2], p.index[3]});
+	double raw_result = Xtab.interpolate(p)*approx_X32(arg, M1);
 
 	double xk = 0.5*(a1*a2 + a1 - a2);
 	double x2 = 0.5*(-a1*a2 + a1 + a2);
@@ -649,13 +803,11 @@ double df_dcostheta42(double costheta42, void * params_){
 
 	double result, error;
 	double phi42min = 0., phi42max = M_PI;
-	gsl_integration_workspace *w = gsl_integration_workspace_alloc(500);
 
     gsl_function F;
 	F.function = df_dcostheta42_dphi42;
 	F.params = params;
-	gsl_integration_qag(&F, phi42min, phi42max, 0, 1e-3, 500, 3, w, &result, &error);
-	gsl_integration_workspace_free(w);
+	result = qag_integrate(&F, phi42min, phi42max, 0, table_specs().epsrel(1e-3), 500, 3, &error);
 	return 2.*result;
 }
 
@@ -684,7 +836,6 @@ double f_3to2::calculate(double * arg){
 	// Integration for (1)p4 and (2)phi4
 	double result, error;
 	double costheta42min = -1., costheta42max = 1.;
-	gsl_integration_workspace *w = gsl_integration_workspace_alloc(200);
 	Mygsl_integration_params * params_df = new Mygsl_integration_params;
 	params_df->f = dXdPS;
 	params_df->params = new double[11];
@@ -703,9 +854,8 @@ double f_3to2::calculate(double * arg){
 	gsl_function F;
 	F.function = df_dcostheta42;
 	F.params = params_df;
-	gsl_integration_qag(&F, costheta42min, costheta42max, 0, 1e-2, 200, 3, w, &result, &error);
+	result = qag_integrate(&F, costheta42min, costheta42max, 0, table_specs().epsrel(1e-2), 200, 3, &error);
 
-	gsl_integration_workspace_free(w);
 	delete [] params_df->params;
 	delete params_df;
 	return result;
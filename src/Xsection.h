@@ -5,8 +5,15 @@
 #include <vector>
 #include <string>
 #include <random>
-#include <boost/multi_array.hpp>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
 #include "sample_methods.h"
+#include "grid_table.h"
+#include "tabulation.h"
+#include "adaptive_grid.h"
+#include "integration.h"
 
 
 /* all the differential Xsection function are declared by type "double f(double * arg, size_t n_dims, void * params)"
@@ -27,15 +34,16 @@ struct Mygsl_integration_params{
 // This is the base class for 2->2 and 2->3 cross-sections.
 // It takes care of the tabulating details and the tabulating routines, also the interpolation process
 // The actually total Xsection calcuate function and final state sample function are virtual functions, because 2->2 and 2->3 uses quite different techniques to do these jobs.
-class Xsection{
+class Xsection : public tabulated_table{
 protected:
-	virtual void tabulate(size_t T_start, size_t dnT) = 0;
-	virtual void save_to_file(std::string filename, std::string datasetname) = 0;
-	virtual void read_from_file(std::string filename, std::string datasetname) = 0;
+	// compute a single cell, given by its flat index into the table
+	virtual double tabulate(size_t cell) = 0;
+	void tabulate_cell(size_t cell, double * result) {*result = tabulate(cell);};
 	double (*dXdPS)(double * PS, size_t n_dims, void * params);
 	double M1;
 public:
 	Xsection(double (*dXdPS_)(double *, size_t, void *), double M1_, std::string name_, bool refresh);
+	virtual ~Xsection(){};
 	double get_M1(void) {return M1;};
 	// arg = [s, T] fot X22, arg = [s, T, dt] for X23, arg = [s, T, s1k, s2k] for f32
 	virtual double interpX(double * arg) = 0; 
@@ -44,22 +52,65 @@ public:
 };
 
 //============Derived 2->2 Xsection class============================================
+// B(sqrts) = int_{s_th}^{s} (s'-M^2) sigma(s', T) ds' of the interpolated cross
+// section at one temperature, from its threshold s_th on. The nodes include
+// s_th and every node of the sqrts grid, so the integrand is smooth between
+// two nodes; B is exact at the nodes (Gauss-Legendre) and cubic Hermite in
+// between, dleft/dright being dB/dsqrts just inside either end of a node interval.
+struct sigma_moment_table{
+	double s_max;
+	std::vector<double> sqrts, B, dleft, dright;
+};
+
+// Besides sigma/approx_X22, every (sqrts, T) cell of the uniform table holds
+// the normalized cumulative distribution of t, F(v_k) at Nt_cdf points
+// v_k = k/(Nt_cdf-1) of v = ln(1 - t/mD^2)/ln(1 - tmin/mD^2), which spreads
+// the t-channel peak evenly. calculate() reads the cross section off the
+// unnormalized endpoint, and sample_dXdPS() inverts the CDF interpolated
+// between the cells; an adaptive table, or one without a CDF (Nt_cdf = 0),
+// samples t by rejection instead.
 class Xsection_2to2 : public Xsection{
 private:
 	rejection_1d sampler1d;
 	std::random_device rd;
     std::mt19937 gen;
-    std::uniform_real_distribution<double> dist_phi3;
-	void tabulate(size_t T_start, size_t dnT);
+    std::uniform_real_distribution<double> dist_phi3, dist_cdf;
+	double tabulate(size_t cell);
+	void tabulate_cell(size_t cell, double * result);
 	void save_to_file(std::string filename, std::string datasetname);
 	void read_from_file(std::string filename, std::string datasetname);
-	size_t Nsqrts, NT;
+	size_t Nsqrts, NT, Nt_cdf;
 	double sqrtsL, sqrtsH, dsqrts,
 		   TL, TH, dT;
-	boost::multi_array<double, 2> Xtab;
+	// [0] sigma/approx_X22, [1+k] F(v_k)
+	grid_table<2> Xtab;
+	// the cumulative cross section in t at the v_k, returns the total
+	double t_cumulative(double s, double Temp, double * F);
+	std::vector<size_t> table_shape(void) {return {Nsqrts, NT};};
+	size_t table_components(void) {return 1 + Nt_cdf;};
+	double * table_data(void) {return Xtab.data();};
+	std::vector<table_axis> table_axes(void){
+		return {{"sqrts", 0, "sqrts_low", "sqrts_high", "N_sqrt"}, {"T", 1, "T_low", "T_high", "N_T"}};
+	};
+	void describe_inputs(table_inputs & inputs);
+	// (sqrts, T) grid used instead of Xtab when built with a refine tolerance
+	adaptive_grid Xgrid;
+	bool tabulate_adaptive(std::string filename, std::string datasetname);
+	// moment tables by temperature, built on demand and rebuilt when a larger
+	// s is asked for; the oldest temperature is dropped beyond
+	// max_moment_tables, e.g. for the continuous T of a transport run
+	static const size_t max_moment_tables = 64;
+	std::map<double, std::shared_ptr<const sigma_moment_table> > moments;
+	std::deque<double> moment_order;
+	std::mutex m_moments;
+	std::shared_ptr<const sigma_moment_table> moment_table(double Temp, double s_max);
 public:
     Xsection_2to2(double (*dXdPS_)(double *, size_t, void *), double M1_, std::string name_, bool refresh);
+    ~Xsection_2to2(){persist_lazy_cells();};
 	double interpX(double * arg);
+	// int_{s1}^{s2} (s-M^2) sigma(s, T) ds for arg = [s1, s2, T], two lookups
+	// of the moment table of T
+	double integrate_moment(double * arg);
     double calculate(double * arg);
 	void sample_dXdPS(double * arg, std::vector< std::vector<double> > & FS);
 };
@@ -71,16 +122,42 @@ private:
 	std::random_device rd;
     std::mt19937 gen;
     std::uniform_real_distribution<double> dist_phi4;
-	void tabulate(size_t T_start, size_t dnT);
+	double tabulate(size_t cell);
 	void save_to_file(std::string filename, std::string datasetname);
 	void read_from_file(std::string filename, std::string datasetname);
 	size_t Nsqrts, NT, Ndt;
 	double sqrtsL, sqrtsH, dsqrts,
 				 TL, TH, dT,
 				 dtL, dtH, ddt;
-	boost::multi_array<double, 3> Xtab;
+	grid_table<3> Xtab;
+	std::unique_ptr<multi_integrator> integrator;
+	// dXdPS for all dt of the grid at once, the dt axis is then filled by a
+	// single integration per (sqrts, T)
+	void (*dXdPS_dt)(double *, size_t, void *, double *);
+	// channels built together with this one, see fused_cells; NULL if none
+	fused_cells * fused;
+	size_t fused_channel;
+	// dXdPS_dt of all fused channels, Ndt values per channel
+	void (*dXdPS_channels_dt)(double *, size_t, void *, double *);
+	size_t table_group(void) {return dXdPS_dt ? Ndt : 1;};
+	void tabulate_group(size_t first, double * result);
+	// the dt axis of an (s, T) cell for Nchannels channels of f
+	void integrate_dt(void (*f)(double *, size_t, void *, double *), size_t Nchannels,
+					  double s, double Temp, double * result);
+	void integration_limits(double s, double * xl, double * xu);
+	std::vector<size_t> table_shape(void) {return {Nsqrts, NT, Ndt};};
+	double * table_data(void) {return Xtab.data();};
+	std::vector<table_axis> table_axes(void){
+		return {{"sqrts", 0, "sqrts_low", "sqrts_high", "N_sqrt_half"}, {"T", 1, "T_low", "T_high", "N_T"},
+				{"dt", 2, "dt_low", "dt_high", "N_dt"}};
+	};
+	void describe_inputs(table_inputs & inputs);
 public:
-    Xsection_2to3(double (*dXdPS_)(double *, size_t, void *), double M1_, std::string name_, bool refresh);
+    Xsection_2to3(double (*dXdPS_)(double *, size_t, void *), double M1_, std::string name_, bool refresh,
+				  void (*dXdPS_dt_)(double *, size_t, void *, double *) = NULL,
+				  fused_cells * fused_ = NULL, size_t fused_channel_ = 0,
+				  void (*dXdPS_channels_dt_)(double *, size_t, void *, double *) = NULL);
+    ~Xsection_2to3(){persist_lazy_cells();};
 	double interpX(double * arg);
     double calculate(double * arg);
 	void sample_dXdPS(double * arg, std::vector< std::vector<double> > & FS);
@@ -94,7 +171,7 @@ private:
 	std::random_device rd;
     std::mt19937 gen;
     std::uniform_real_distribution<double> dist_phi4;
-	void tabulate(size_t T_start, size_t dnT);
+	double tabulate(size_t cell);
 	void save_to_file(std::string filename, std::string datasetname);
 	void read_from_file(std::string filename, std::string datasetname);
 	size_t Nsqrts, NT, Na1, Na2;
@@ -102,10 +179,18 @@ private:
 				 TL, TH, dT,
 				 a1L, a1H, da1,
 				 a2L, a2H, da2;
-	boost::multi_array<double, 4> Xtab;
+	grid_table<4> Xtab;
+	std::vector<size_t> table_shape(void) {return {Nsqrts, NT, Na1, Na2};};
+	double * table_data(void) {return Xtab.data();};
+	std::vector<table_axis> table_axes(void){
+		return {{"sqrts", 0, "sqrts_low", "sqrts_high", "N_sqrt_half"}, {"T", 1, "T_low", "T_high", "N_T"},
+				{"a1", 2, "a1_low", "a1_high", "N_a1"}, {"a2", 3, "a2_low", "a2_high", "N_a2"}};
+	};
+	void describe_inputs(table_inputs & inputs);
 
 public:
     f_3to2(double (*dXdPS_)(double *, size_t, void *), double M1_, std::string name_, bool refresh);
+    ~f_3to2(){persist_lazy_cells();};
 	double interpX(double * arg);
     double calculate(double * arg);
 	void sample_dXdPS(double * arg, std::vector< std::vector<double> > & FS);
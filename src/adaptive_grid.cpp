@@ -0,0 +1,259 @@
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "adaptive_grid.h"
+#include "tabulation.h"
+#include "utility.h"
+
+namespace {
+	template <typename T>
+	void read_1d(H5::H5File & file, std::string name, const H5::PredType & type, std::vector<T> & data){
+		H5::DataSet dataset = file.openDataSet(name);
+		data.resize(size_t(dataset.getSpace().getSimpleExtentNpoints()));
+		dataset.read(data.data(), type);
+	}
+}
+
+adaptive_grid::adaptive_grid(void)
+:	D(0), max_level(0)
+{
+}
+
+adaptive_grid::adaptive_grid(std::vector<double> low_, std::vector<double> high_,
+							 std::vector<size_t> Nbase_, size_t max_level_)
+:	D(low_.size()), max_level(max_level_), low(low_), high(high_), Nbase(Nbase_)
+{
+	if (D == 0 || D > max_dims || high.size() != D || Nbase.size() != D)
+		throw std::invalid_argument("adaptive_grid: inconsistent dimensions");
+	for (size_t d=0; d<D; d++){
+		if (Nbase[d] < 2) throw std::invalid_argument("adaptive_grid: need at least 2 base points per axis");
+		step.push_back((high[d]-low[d])/(Nbase[d]-1.));
+	}
+}
+
+size_t adaptive_grid::Nroots(void) const{
+	size_t N = 1;
+	for (size_t d=0; d<D; d++) N *= Nbase[d]-1;
+	return N;
+}
+
+void adaptive_grid::build(std::string name, std::function<double(double *)> f, double tolerance){
+	const size_t Ncorners = size_t(1) << D;
+	size_t Nsub = 1; // points of the 3^D sub-lattice of a cell
+	for (size_t d=0; d<D; d++) Nsub *= 3;
+
+	// points live on the lattice of the finest level, a base cell is
+	// 2^max_level lattice units wide
+	const uint64_t unit = uint64_t(1) << max_level;
+	std::vector<uint64_t> extent(D);
+	for (size_t d=0; d<D; d++) extent[d] = (Nbase[d]-1)*unit + 1;
+	auto key_of = [&](const uint64_t * k){
+		uint64_t key = 0;
+		for (size_t d=0; d<D; d++) key = key*extent[d] + k[d];
+		return key;
+	};
+
+	std::unordered_map<uint64_t, uint32_t> index_of;
+	std::vector<double> all_values;
+	// evaluate every point of the list that has not been computed yet. The
+	// base grid is passed with its shape, and the driver fills its failed
+	// points from their neighbours; the points of a refinement are a list,
+	// whose failed points are returned instead
+	auto evaluate = [&](const std::vector<uint64_t> & points, const std::vector<size_t> & shape)
+		-> std::vector<size_t> {
+		std::vector<uint64_t> todo;
+		for (size_t i=0; i<points.size(); i+=D){
+			uint64_t key = key_of(&points[i]);
+			if (index_of.count(key)) continue;
+			index_of[key] = all_values.size() + todo.size()/D;
+			todo.insert(todo.end(), &points[i], &points[i]+D);
+		}
+		size_t Ntodo = todo.size()/D;
+		if (Ntodo == 0) return {};
+		std::vector<double> buffer(Ntodo);
+		bool grid = !shape.empty();
+		tabulation_driver driver(name, grid ? shape : std::vector<size_t>{Ntodo});
+		if (!grid) driver.keep_failed();
+		driver.run(buffer.data(), [&](size_t n, double * value){
+			double x[max_dims];
+			for (size_t d=0; d<D; d++)
+				x[d] = std::min(high[d], low[d] + double(todo[n*D+d])/unit*step[d]);
+			*value = f(x);
+		});
+		std::vector<size_t> failed;
+		for (auto&& n : driver.failed()) failed.push_back(all_values.size() + n);
+		all_values.insert(all_values.end(), buffer.begin(), buffer.end());
+		return failed;
+	};
+
+	// lattice origin of every cell, only needed while refining
+	std::vector<uint64_t> origin;
+	children.clear();
+	corners.clear();
+	auto add_cell = [&](const uint64_t * o, size_t l){
+		origin.insert(origin.end(), o, o+D);
+		children.push_back(-1);
+		uint64_t size = unit >> l, k[max_dims];
+		for (size_t b=0; b<Ncorners; b++){
+			for (size_t d=0; d<D; d++) k[d] = o[d] + ((b>>d)&1)*size;
+			corners.push_back(index_of.at(key_of(k)));
+		}
+	};
+
+	// base grid and one root cell per base cell, both row-major
+	{
+		size_t Npts = 1;
+		for (size_t d=0; d<D; d++) Npts *= Nbase[d];
+		std::vector<uint64_t> points(Npts*D);
+		for (size_t n=0; n<Npts; n++){
+			size_t r = n;
+			for (size_t d=D; d-- > 0; ){ points[n*D+d] = (r%Nbase[d])*unit; r /= Nbase[d]; }
+		}
+		evaluate(points, Nbase);
+		for (size_t n=0; n<Nroots(); n++){
+			uint64_t o[max_dims];
+			size_t r = n;
+			for (size_t d=D; d-- > 0; ){ o[d] = (r%(Nbase[d]-1))*unit; r /= Nbase[d]-1; }
+			add_cell(o, 0);
+		}
+	}
+
+	std::vector<size_t> active;
+	for (size_t c=0; c<Nroots(); c++) active.push_back(c);
+	for (size_t l=0; l<max_level && !active.empty(); l++){
+		uint64_t half = unit >> (l+1);
+		// offsets j in {0,1,2}^D of the sub-lattice, in units of half a cell
+		auto sub_point = [&](size_t c, size_t s, uint64_t * k, double * r){
+			for (size_t d=0; d<D; d++){
+				size_t j = s%3; s /= 3;
+				k[d] = origin[c*D+d] + j*half;
+				r[d] = 0.5*j;
+			}
+		};
+		std::vector<uint64_t> points;
+		for (auto&& c : active){
+			uint64_t k[max_dims];
+			double r[max_dims];
+			for (size_t s=0; s<Nsub; s++){
+				sub_point(c, s, k, r);
+				points.insert(points.end(), k, k+D);
+			}
+		}
+		// a failed point takes the value the cell interpolates there
+		std::vector<bool> unfilled(all_values.size() + points.size()/D, false);
+		std::vector<size_t> failed = evaluate(points, {});
+		for (auto&& i : failed) unfilled[i] = true;
+		if (!failed.empty())
+			std::cout << "# " << name << ": " << failed.size()
+					  << " failed points interpolated from their cells" << std::endl;
+
+		std::vector<size_t> next;
+		size_t Nsplit = 0;
+		for (auto&& c : active){
+			double error = 0.;
+			uint64_t k[max_dims];
+			double r[max_dims];
+			for (size_t s=0; s<Nsub; s++){
+				sub_point(c, s, k, r);
+				size_t i = index_of.at(key_of(k));
+				double approx = 0.;
+				for (size_t b=0; b<Ncorners; b++){
+					double w = 1.;
+					for (size_t d=0; d<D; d++) w *= ((b>>d)&1) ? r[d] : 1.-r[d];
+					approx += w*all_values[corners[c*Ncorners+b]];
+				}
+				if (unfilled[i]){
+					all_values[i] = approx;
+					unfilled[i] = false;
+				}
+				double exact = all_values[i], diff = std::abs(exact-approx);
+				error = std::max(error, (exact != 0.) ? diff/std::abs(exact) : diff);
+			}
+			if (error <= tolerance) continue;
+			children[c] = int64_t(children.size());
+			for (size_t b=0; b<Ncorners; b++){
+				uint64_t o[max_dims];
+				for (size_t d=0; d<D; d++) o[d] = origin[c*D+d] + ((b>>d)&1)*half;
+				next.push_back(children.size());
+				add_cell(o, l+1);
+			}
+			Nsplit++;
+		}
+		std::cout << "# " << name << ": level " << l+1 << ", " << Nsplit << " of "
+				  << active.size() << " cells refined" << std::endl;
+		active = next;
+	}
+
+	// keep only the values that are corners of some cell
+	std::vector<int64_t> renumber(all_values.size(), -1);
+	values.clear();
+	for (auto&& i : corners){
+		if (renumber[i] < 0){
+			renumber[i] = int64_t(values.size());
+			values.push_back(all_values[i]);
+		}
+		i = renumber[i];
+	}
+	std::cout << "# " << name << ": " << values.size() << " points in " << Ncells()
+			  << " cells, " << all_values.size() << " evaluations" << std::endl;
+}
+
+double adaptive_grid::interpolate(const double * x) const{
+	const size_t Ncorners = size_t(1) << D;
+	double r[max_dims];
+	size_t cell = 0;
+	for (size_t d=0; d<D; d++){
+		double xd = (x[d]-low[d])/step[d];
+		xd = std::max(0., std::min(xd, Nbase[d]-1.));
+		size_t i = std::min(size_t(xd), Nbase[d]-2);
+		r[d] = xd - i;
+		cell = cell*(Nbase[d]-1) + i;
+	}
+	while (children[cell] >= 0){
+		size_t b = 0;
+		for (size_t d=0; d<D; d++){
+			if (r[d] >= 0.5){ b |= size_t(1) << d; r[d] = 2.*r[d]-1.; }
+			else r[d] = 2.*r[d];
+		}
+		cell = size_t(children[cell]) + b;
+	}
+	double result = 0.;
+	for (size_t b=0; b<Ncorners; b++){
+		double w = 1.;
+		for (size_t d=0; d<D; d++) w *= ((b>>d)&1) ? r[d] : 1.-r[d];
+		result += w*values[corners[cell*Ncorners+b]];
+	}
+	return result;
+}
+
+H5::DataSet adaptive_grid::save(H5::H5File & file, std::string datasetname) const{
+	hsize_t Nc[1] = {children.size()}, Nk[1] = {corners.size()}, Nv[1] = {values.size()};
+	H5::DataSet dchildren = file.createDataSet(datasetname + "-children",
+								H5::PredType::NATIVE_INT64, H5::DataSpace(1, Nc));
+	dchildren.write(children.data(), H5::PredType::NATIVE_INT64);
+	H5::DataSet dcorners = file.createDataSet(datasetname + "-corners",
+								H5::PredType::NATIVE_UINT32, H5::DataSpace(1, Nk));
+	dcorners.write(corners.data(), H5::PredType::NATIVE_UINT32);
+	H5::DataSet dataset = file.createDataSet(datasetname,
+								H5::PredType::NATIVE_DOUBLE, H5::DataSpace(1, Nv));
+	dataset.write(values.data(), H5::PredType::NATIVE_DOUBLE);
+	hdf5_add_scalar_attr(dataset, "refine_max_level", max_level);
+	return dataset;
+}
+
+void adaptive_grid::read(H5::H5File & file, std::string datasetname){
+	read_1d(file, datasetname + "-children", H5::PredType::NATIVE_INT64, children);
+	read_1d(file, datasetname + "-corners", H5::PredType::NATIVE_UINT32, corners);
+	read_1d(file, datasetname, H5::PredType::NATIVE_DOUBLE, values);
+	hdf5_read_scalar_attr(file.openDataSet(datasetname), "refine_max_level", max_level);
+	if (children.size() < Nroots() || corners.size() != (children.size() << D))
+		throw std::runtime_error(datasetname + ": adaptive grid does not match its base grid");
+}
+
+bool adaptive_grid::is_adaptive(H5::H5File & file, std::string datasetname){
+	std::string forest = datasetname + "-children";
+	return H5Lexists(file.getId(), forest.c_str(), H5P_DEFAULT) > 0;
+}
@@ -0,0 +1,54 @@
+#ifndef ADAPTIVE_GRID_H
+#define ADAPTIVE_GRID_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "H5Cpp.h"
+
+//=============hierarchical adaptive grid======================================
+// A D-dimensional table on the box [low, high] that starts from a coarse
+// uniform base grid of Nbase points per axis and bisects a cell (into 2^D
+// children) only where multilinear interpolation of its corners misses fresh
+// evaluations at the cell's edge, face and body midpoints by more than the
+// relative tolerance, down to max_level bisections.
+// The cells form a forest with one tree per base cell: children[c] is the index
+// of the first of the 2^D children of cell c (-1 for a leaf); child b covers the
+// upper half along axis d if bit d of b is set. corners[c*2^D + b] points into
+// values in the same bit order. A lookup descends from its base cell to the
+// leaf and interpolates its corners, O(max_level) per call.
+class adaptive_grid{
+private:
+	size_t D, max_level;
+	std::vector<double> low, high, step;
+	std::vector<size_t> Nbase;
+	std::vector<int64_t> children;
+	std::vector<uint32_t> corners;
+	std::vector<double> values;
+	size_t Nroots(void) const;
+public:
+	static const size_t max_dims = 8;
+	adaptive_grid(void);
+	adaptive_grid(std::vector<double> low_, std::vector<double> high_,
+				  std::vector<size_t> Nbase_, size_t max_level_ = 0);
+	bool empty(void) const {return values.empty();};
+	size_t Npoints(void) const {return values.size();};
+	size_t Ncells(void) const {return children.size();};
+	size_t get_Nbase(size_t d) const {return Nbase[d];};
+	size_t get_max_level(void) const {return max_level;};
+	// refine until every leaf is within tolerance, f is evaluated in parallel
+	// through the tabulation driver. Failed base points are filled from their
+	// base grid neighbours, failed refinement points take the value their
+	// cell interpolates there.
+	void build(std::string name, std::function<double(double *)> f, double tolerance);
+	double interpolate(const double * x) const;
+	// values are stored as datasetname, the forest as "<datasetname>-children"
+	// and "<datasetname>-corners"; the caller adds its axis attributes
+	H5::DataSet save(H5::H5File & file, std::string datasetname) const;
+	void read(H5::H5File & file, std::string datasetname);
+	static bool is_adaptive(H5::H5File & file, std::string datasetname);
+};
+
+#endif
@@ -0,0 +1,374 @@
+#ifndef GRID_TABLE_H
+#define GRID_TABLE_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <array>
+#include <string>
+#include <vector>
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#define GRID_TABLE_SIMD
+#endif
+
+//=============grid axes======================================================
+// The N points x_i of one axis of a table, from low to high:
+//   uniform      low + i*(high-low)/(N-1)
+//   logarithmic  low*(high/low)^(i/(N-1)), for low > 0
+//   power        low + (high-low)*(i/(N-1))^exponent, exponent > 1 puts more
+//                points at low x
+//   piecewise    consecutive uniform segments with points of their own, the
+//                boundary of two segments being the last point of the first
+//                and the first point of the second, as in the qhat tables
+// locate() finds the interval i of x and its fraction r in constant time by
+// inverting the spacing; a piecewise axis compares x with the starts of its
+// few segments. Values are interpolated linearly in the inverted coordinate,
+// e.g. in log(x) on a logarithmic axis. Outside of [low, high] x is clamped
+// to the nearest end.
+class grid_axis{
+public:
+	enum spacing {uniform = 0, logarithmic = 1, power = 2, piecewise = 3};
+private:
+	struct segment{
+		double start, step, inverse_step;
+		size_t first, N;
+	};
+	spacing kind;
+	double low_, high_, exponent_;
+	size_t N;
+	// uniform: step, logarithmic: log(high/low)/(N-1), power: high-low
+	double step, inverse_step;
+	std::vector<segment> segments;
+public:
+	grid_axis(void) : kind(uniform), low_(0.), high_(0.), exponent_(1.), N(0), step(0.), inverse_step(0.) {};
+	grid_axis(double low, double high, size_t N_, spacing kind_ = uniform, double exponent = 1.)
+	:	kind(kind_), low_(low), high_(high), exponent_(exponent), N(N_){
+		if (kind == logarithmic) step = std::log(high/low)/(N-1.);
+		else if (kind == power) step = high-low;
+		else step = (high-low)/(N-1.);
+		inverse_step = 1./step;
+	};
+	// segment s from bounds[s] to bounds[s+1] with points[s] points
+	grid_axis(const std::vector<double> & bounds, const std::vector<size_t> & points)
+	:	kind(piecewise), low_(bounds.front()), high_(bounds.back()), exponent_(1.), N(0), step(0.), inverse_step(0.){
+		for (size_t s=0; s+1<bounds.size(); s++){
+			double h = (bounds[s+1]-bounds[s])/(points[s]-1.);
+			segment g = {bounds[s], h, 1./h, N, points[s]};
+			segments.push_back(g);
+			N += points[s];
+		}
+	};
+	spacing get_spacing(void) const {return kind;};
+	double low(void) const {return low_;};
+	double high(void) const {return high_;};
+	double exponent(void) const {return exponent_;};
+	size_t size(void) const {return N;};
+	// "uniform", "log" or "power:<exponent>", as in the table specs
+	std::string name(void) const {
+		if (kind == logarithmic) return "log";
+		if (kind == power) return "power:" + std::to_string(exponent_);
+		if (kind == piecewise) return "piecewise";
+		return "uniform";
+	};
+	bool operator==(const grid_axis & other) const {
+		if (kind != other.kind || low_ != other.low_ || high_ != other.high_ || N != other.N
+			|| exponent_ != other.exponent_ || segments.size() != other.segments.size()) return false;
+		for (size_t s=0; s<segments.size(); s++)
+			if (segments[s].start != other.segments[s].start || segments[s].N != other.segments[s].N) return false;
+		return true;
+	};
+	double node(size_t i) const {
+		switch (kind){
+		case logarithmic: return (i+1 == N) ? high_ : low_*std::exp(i*step);
+		case power: return low_ + step*std::pow(i/(N-1.), exponent_);
+		case piecewise: {
+			size_t s = 0;
+			while (s+1 < segments.size() && i >= segments[s+1].first) s++;
+			return segments[s].start + (i-segments[s].first)*segments[s].step;
+		}
+		default: return low_ + i*step;
+		}
+	};
+	void locate(double x, size_t & i, double & r) const {
+		double u, last;
+		size_t first = 0, Nsegment = N;
+		switch (kind){
+		case logarithmic: u = std::log(x/low_)*inverse_step; break;
+		case power: u = (x-low_)*inverse_step; u = (u > 0.) ? std::pow(u, 1./exponent_)*(N-1.) : 0.; break;
+		case piecewise: {
+			size_t s = 0;
+			while (s+1 < segments.size() && x >= segments[s+1].start) s++;
+			u = (x-segments[s].start)*segments[s].inverse_step;
+			first = segments[s].first; Nsegment = segments[s].N;
+			break;
+		}
+		default: u = (x-low_)*inverse_step;
+		}
+		last = Nsegment-1.;
+		// written so that NaN ends up at the lower edge
+		u = (u > 0.) ? u : 0.;
+		u = (u < last) ? u : last;
+		size_t j = static_cast<size_t>(u);
+		j = (j+2 > Nsegment) ? Nsegment-2 : j;
+		i = first + j;
+		r = u - j;
+	};
+};
+
+//=============tables on grids================================================
+// grid_table<N> holds a table on an N-dimensional grid, the product of N
+// grid_axis, point i of axis d at axis(d).node(i). Ncomponents values per point are
+// stored in one contiguous, cache line aligned block in the layout of the
+// tabulation driver: component c of the point with flat (row-major) index n
+// lives at data()[c*size() + n], so data() is what table_data() returns and
+// what is read from and written to HDF5. An interleaved table instead keeps
+// the components of a point next to each other, at data()[n*Ncomponents + c],
+// for lookups that want all of them at once (interpolate_all()).
+// Strides are computed once. locate() turns a point into its lower grid
+// corner and the fractions along every axis, clamped into the grid (outside
+// of it the table is continued by its boundary values), and interpolate()
+// sums the 2^N corners of a located point by a loop unrolled at compile time.
+// A point located once can be interpolated for every component, e.g. all the
+// t distribution of a 2->2 cell.
+// The batch interpolate() handles many points given as one array per axis.
+// Built for AVX-512 or AVX2 with FMA (-march=native) it locates 8 or 4 points
+// of a grid with uniform axes at once, gathers their corners and blends them
+// with fused multiply-adds; the results agree with the scalar interpolate()
+// to rounding. Other grids and builds, and the remainder of a batch, go point
+// by point.
+template <size_t N>
+struct grid_point{
+	size_t index[N];	// lower corner, index[d] <= shape[d]-2
+	double r[N];		// fractions in [0, 1] from the lower corner
+	size_t offset;		// position of the lower corner in data()
+};
+
+namespace grid_detail{
+	// the corners of the axes D, D+1, ..., N-1 from p on, one axis at a time
+	template <size_t D, size_t N>
+	struct multilinear{
+		static double sum(const double * p, const size_t * stride, const double * r){
+			return (1.-r[D])*multilinear<D+1, N>::sum(p, stride, r)
+				   + r[D]*multilinear<D+1, N>::sum(p + stride[D], stride, r);
+		}
+	};
+	template <size_t N>
+	struct multilinear<N, N>{
+		static double sum(const double * p, const size_t *, const double *) {return *p;}
+	};
+
+	// all Ncomponents components, component c at p + c*step, added to out with weight w
+	template <size_t D, size_t N>
+	struct multilinear_all{
+		static void sum(const double * p, const size_t * stride, const double * r, double w,
+						size_t Ncomponents, size_t step, double * out){
+			multilinear_all<D+1, N>::sum(p, stride, r, w*(1.-r[D]), Ncomponents, step, out);
+			multilinear_all<D+1, N>::sum(p + stride[D], stride, r, w*r[D], Ncomponents, step, out);
+		}
+	};
+	template <size_t N>
+	struct multilinear_all<N, N>{
+		static void sum(const double * p, const size_t *, const double *, double w,
+						size_t Ncomponents, size_t step, double * out){
+			for (size_t c=0; c<Ncomponents; c++) out[c] += w*p[c*step];
+		}
+	};
+
+#ifdef GRID_TABLE_SIMD
+	// the few vector operations of the batch interpolation; some versions of
+	// GCC warn about the undefined lanes they start from inside their own
+	// intrinsics, the gathers therefore start from zero. Without optimization
+	// the AVX-512 intrinsics are macros whose mask casts trip -Wsign-conversion.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#endif
+#if defined(__AVX512F__)
+	struct simd{
+		typedef __m512d real;
+		typedef __m256i index;
+		static const size_t width = 8;
+		static real load(const double * p) {return _mm512_loadu_pd(p);}
+		static void store(double * p, real a) {_mm512_storeu_pd(p, a);}
+		static real set1(double a) {return _mm512_set1_pd(a);}
+		static real sub(real a, real b) {return _mm512_sub_pd(a, b);}
+		static real mul(real a, real b) {return _mm512_mul_pd(a, b);}
+		static real fmadd(real a, real b, real c) {return _mm512_fmadd_pd(a, b, c);}
+		// the second operand if either is NaN
+		static real max(real a, real b) {return _mm512_max_pd(a, b);}
+		static real min(real a, real b) {return _mm512_min_pd(a, b);}
+		static real floor(real a) {return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);}
+		static index to_index(real a) {return _mm512_cvttpd_epi32(a);}
+		static real gather(const double * p, index i){
+			return _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xFF, i, p, sizeof(double));
+		}
+	};
+#else
+	struct simd{
+		typedef __m256d real;
+		typedef __m128i index;
+		static const size_t width = 4;
+		static real load(const double * p) {return _mm256_loadu_pd(p);}
+		static void store(double * p, real a) {_mm256_storeu_pd(p, a);}
+		static real set1(double a) {return _mm256_set1_pd(a);}
+		static real sub(real a, real b) {return _mm256_sub_pd(a, b);}
+		static real mul(real a, real b) {return _mm256_mul_pd(a, b);}
+		static real fmadd(real a, real b, real c) {return _mm256_fmadd_pd(a, b, c);}
+		// the second operand if either is NaN
+		static real max(real a, real b) {return _mm256_max_pd(a, b);}
+		static real min(real a, real b) {return _mm256_min_pd(a, b);}
+		static real floor(real a) {return _mm256_floor_pd(a);}
+		static index to_index(real a) {return _mm256_cvttpd_epi32(a);}
+		static real gather(const double * p, index i){
+			real all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+			return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), p, i, all, sizeof(double));
+		}
+	};
+#endif
+
+	// multilinear for simd::width points, whose lower corners are at p + offset
+	template <size_t D, size_t N>
+	struct multilinear_simd{
+		static simd::real sum(const double * p, simd::index offset, const size_t * stride, const simd::real * r){
+			simd::real a = multilinear_simd<D+1, N>::sum(p, offset, stride, r),
+					   b = multilinear_simd<D+1, N>::sum(p + stride[D], offset, stride, r);
+			return simd::fmadd(r[D], simd::sub(b, a), a);
+		}
+	};
+	template <size_t N>
+	struct multilinear_simd<N, N>{
+		static simd::real sum(const double * p, simd::index offset, const size_t *, const simd::real *){
+			return simd::gather(p, offset);
+		}
+	};
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+}
+
+template <size_t N>
+class grid_table{
+private:
+	static const size_t alignment = 64;
+	std::array<grid_axis, N> axes;
+	// strides in data(), including the components of an interleaved table
+	std::array<size_t, N> shape_, stride;
+	// of the batch interpolation, if all axes are uniform
+	bool uniform;
+	std::array<double, N> low_, inverse_step;
+	// distance of two points and of two components in data()
+	size_t Npoints, Ncomponents, point_step, component_step;
+	std::vector<double> storage;
+	double * values;
+public:
+	grid_table(void) : uniform(true), Npoints(0), Ncomponents(0), point_step(0), component_step(0), values(NULL) {};
+	// uniform axes
+	grid_table(const std::array<double, N> & low, const std::array<double, N> & high,
+			   const std::array<size_t, N> & shape, size_t Ncomponents_ = 1, bool interleaved = false)
+	: values(NULL){
+		reset(low, high, shape, Ncomponents_, interleaved);
+	};
+	explicit grid_table(const std::array<grid_axis, N> & axes_, size_t Ncomponents_ = 1, bool interleaved = false)
+	: values(NULL){
+		reset(axes_, Ncomponents_, interleaved);
+	};
+	grid_table(const grid_table &) = delete;
+	grid_table & operator=(const grid_table &) = delete;
+	// a new grid, all values zero
+	void reset(const std::array<grid_axis, N> & axes_, size_t Ncomponents_ = 1, bool interleaved = false){
+		axes = axes_;
+		Ncomponents = Ncomponents_;
+		point_step = interleaved ? Ncomponents : 1;
+		uniform = true;
+		Npoints = 1;
+		for (size_t d=N; d-->0;){
+			shape_[d] = axes[d].size();
+			stride[d] = Npoints*point_step;
+			Npoints *= shape_[d];
+			uniform = uniform && axes[d].get_spacing() == grid_axis::uniform;
+			low_[d] = axes[d].low();
+			inverse_step[d] = 1./((axes[d].high()-axes[d].low())/(shape_[d]-1.));
+		}
+		component_step = interleaved ? 1 : Npoints;
+		size_t Nvalues = Npoints*Ncomponents, extra = alignment/sizeof(double);
+		storage.assign(Nvalues + extra, 0.);
+		uintptr_t address = reinterpret_cast<uintptr_t>(storage.data());
+		values = storage.data() + ((alignment - address%alignment)%alignment)/sizeof(double);
+	};
+	void reset(const std::array<double, N> & low, const std::array<double, N> & high,
+			   const std::array<size_t, N> & shape, size_t Ncomponents_ = 1, bool interleaved = false){
+		std::array<grid_axis, N> uniform_axes;
+		for (size_t d=0; d<N; d++) uniform_axes[d] = grid_axis(low[d], high[d], shape[d]);
+		reset(uniform_axes, Ncomponents_, interleaved);
+	};
+	double * data(void) {return values;};
+	const double * data(void) const {return values;};
+	// grid points per component
+	size_t size(void) const {return Npoints;};
+	size_t components(void) const {return Ncomponents;};
+	size_t shape(size_t d) const {return shape_[d];};
+	const grid_axis & axis(size_t d) const {return axes[d];};
+	double node(size_t d, size_t i) const {return axes[d].node(i);};
+	void locate(const double * x, grid_point<N> & p) const {
+		p.offset = 0;
+		for (size_t d=0; d<N; d++){
+			axes[d].locate(x[d], p.index[d], p.r[d]);
+			p.offset += p.index[d]*stride[d];
+		}
+	};
+	bool same_grid(const grid_table & other) const {return axes == other.axes;};
+	// component c of flat point n
+	double & value(size_t n, size_t c = 0) {return values[n*point_step + c*component_step];};
+	double value(size_t n, size_t c = 0) const {return values[n*point_step + c*component_step];};
+	double interpolate(const grid_point<N> & p, size_t component = 0) const {
+		return grid_detail::multilinear<0, N>::sum(values + component*component_step + p.offset,
+												   stride.data(), p.r);
+	};
+	// all components at p into out, best on an interleaved table
+	void interpolate_all(const grid_point<N> & p, double * out) const {
+		for (size_t c=0; c<Ncomponents; c++) out[c] = 0.;
+		grid_detail::multilinear_all<0, N>::sum(values + p.offset, stride.data(), p.r, 1.,
+												Ncomponents, component_step, out);
+	};
+	double interpolate(const double * x, size_t component = 0) const {
+		grid_point<N> p;
+		locate(x, p);
+		return interpolate(p, component);
+	};
+	// the values at n points into result, coordinate d of point k is x[d][k]
+	void interpolate(const double * const * x, size_t n, double * result, size_t component = 0) const {
+		size_t k = 0;
+#ifdef GRID_TABLE_SIMD
+		typedef grid_detail::simd simd;
+		// the gathers take 32 bit indices
+		if (uniform && Npoints*Ncomponents < (size_t(1) << 31)){
+			const double * p = values + component*component_step;
+			simd::real zero = simd::set1(0.), r[N];
+			for (; k+simd::width <= n; k += simd::width){
+				simd::real offset = zero;
+				for (size_t d=0; d<N; d++){
+					// as grid_axis::locate() of a uniform axis
+					simd::real u = simd::mul(simd::sub(simd::load(x[d]+k), simd::set1(low_[d])),
+											 simd::set1(inverse_step[d]));
+					u = simd::min(simd::max(u, zero), simd::set1(shape_[d]-1.));
+					simd::real i = simd::min(simd::floor(u), simd::set1(shape_[d]-2.));
+					r[d] = simd::sub(u, i);
+					offset = simd::fmadd(i, simd::set1(static_cast<double>(stride[d])), offset);
+				}
+				simd::store(result+k, grid_detail::multilinear_simd<0, N>::sum(p, simd::to_index(offset),
+																			   stride.data(), r));
+			}
+		}
+#endif
+		for (; k<n; k++){
+			double xk[N];
+			for (size_t d=0; d<N; d++) xk[d] = x[d][k];
+			result[k] = interpolate(xk, component);
+		}
+	};
+};
+
+#endif
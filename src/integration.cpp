@@ -0,0 +1,656 @@
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_monte_vegas.h>
+#include <gsl/gsl_qrng.h>
+#include <gsl/gsl_rng.h>
+
+#include "integration.h"
+#include "scheduler.h"
+
+namespace {
+	gsl_error_handler_t * const gsl_default_handler = gsl_set_error_handler_off();
+	thread_local integration_status status_of_thread = {0, 0, GSL_SUCCESS, 0., 0};
+
+	void record_accuracy(double value, double error, size_t Niterations){
+		if (value != 0.) status_of_thread.relerr = std::max(status_of_thread.relerr, error/std::abs(value));
+		status_of_thread.Niterations += Niterations;
+	}
+
+	// GSL objects of one kind, reused by the integrations of a thread.
+	// An integrand may start an integration of its own, e.g. the inner
+	// integral of a nested qag or a lazily computed table cell, so the objects
+	// form a stack by nesting depth and every depth keeps its own.
+	template <typename T, void (*destroy)(T *)>
+	class scratch_stack{
+	private:
+		std::vector<T *> objects;
+		size_t depth;
+	public:
+		scratch_stack(void) : depth(0) {}
+		~scratch_stack(){ for (auto&& o : objects) destroy(o); }
+		// the object of the next depth, replaced by make() if it does not fit
+		template <typename Fits, typename Make>
+		T * push(Fits fits, Make make){
+			if (depth == objects.size()) objects.push_back(make());
+			else if (!fits(objects[depth])){
+				destroy(objects[depth]);
+				objects[depth] = make();
+			}
+			return objects[depth++];
+		}
+		void pop(void){ depth--; }
+	};
+
+	// holds an object of a scratch_stack for the lifetime of one integration
+	template <typename T, void (*destroy)(T *)>
+	class scratch_lease{
+	private:
+		scratch_stack<T, destroy> & stack;
+		T * object;
+	public:
+		template <typename Fits, typename Make>
+		scratch_lease(scratch_stack<T, destroy> & stack_, Fits fits, Make make)
+		:	stack(stack_), object(stack_.push(fits, make))
+		{}
+		scratch_lease(const scratch_lease &) = delete;
+		scratch_lease & operator=(const scratch_lease &) = delete;
+		~scratch_lease(){ stack.pop(); }
+		T * get(void) const {return object;};
+	};
+
+	typedef scratch_lease<gsl_integration_workspace, gsl_integration_workspace_free> workspace_lease;
+	typedef scratch_lease<gsl_rng, gsl_rng_free> rng_lease;
+	typedef scratch_lease<gsl_qrng, gsl_qrng_free> qrng_lease;
+
+	// everything an integration of the calling thread allocates once and
+	// reuses: qag workspaces, random and quasi random number generators, and
+	// the Vegas grids adapted by the thread, by integrator and dimension;
+	// a cold grid is reset before its next use
+	struct integration_context{
+		scratch_stack<gsl_integration_workspace, gsl_integration_workspace_free> workspaces;
+		scratch_stack<gsl_rng, gsl_rng_free> rngs;
+		scratch_stack<gsl_qrng, gsl_qrng_free> qrngs;
+		struct gsl_grid{ gsl_monte_vegas_state * state; bool warm; };
+		struct edge_grid{ std::vector<double> edges; bool warm; };
+		std::map<std::pair<size_t, size_t>, gsl_grid> gsl;
+		std::map<std::pair<size_t, size_t>, edge_grid> edges;
+		~integration_context(){
+			for (auto&& g : gsl) gsl_monte_vegas_free(g.second.state);
+		}
+	};
+	thread_local integration_context context_of_thread;
+}
+
+integration_status & current_integration(void){
+	return status_of_thread;
+}
+
+void check_integration(int status){
+	if (status == GSL_SUCCESS) return;
+	status_of_thread.Nfailures++;
+	status_of_thread.last_error = status;
+}
+
+double qag_integrate(gsl_function * F, double a, double b,
+					 double epsabs, double epsrel, size_t limit, int key,
+					 double * error){
+	size_t level = status_of_thread.level;
+	limit <<= 2*level;
+	if (level >= 2) epsrel *= std::pow(10., level-1.);
+	double result, abserr;
+	workspace_lease w(context_of_thread.workspaces,
+		[limit](gsl_integration_workspace * old){return old->limit >= limit;},
+		[limit](){return gsl_integration_workspace_alloc(limit);});
+	check_integration(gsl_integration_qag(F, a, b, epsabs, epsrel, limit, key, w.get(), &result, &abserr));
+	record_accuracy(result, abserr, w.get()->size);
+	if (error) *error = abserr;
+	return result;
+}
+
+//=============multi-dimensional integrators===================================
+namespace {
+	std::atomic<size_t> Nintegrators(0);
+}
+
+void forget_warm_start(void){
+	for (auto&& g : context_of_thread.gsl) g.second.warm = false;
+	for (auto&& g : context_of_thread.edges) g.second.warm = false;
+}
+
+multi_integrator::multi_integrator(std::string name_)
+:	name(name_), id(Nintegrators++), Nintegrals(0), Nevals(0), sum_relerr(0.)
+{
+}
+
+multi_integrator::~multi_integrator(){
+	if (Nintegrals == 0) return;
+	std::cout << "# " << name << " integrator: " << Nintegrals << " integrals, "
+			  << Nevals/Nintegrals << " evaluations and a relative error of "
+			  << sum_relerr/Nintegrals << " on average" << std::endl;
+}
+
+void multi_integrator::record(const integration_result & result){
+	record_accuracy(result.value, result.error, result.Niterations);
+	std::lock_guard<std::mutex> lock(m);
+	Nintegrals++;
+	Nevals += result.Nevals;
+	if (result.value != 0.) sum_relerr += result.error/std::abs(result.value);
+}
+
+integration_result multi_integrator::integrate(gsl_monte_function * f, const double * xl, const double * xu,
+											   const integration_goal & goal){
+	integration_result result = run(f, xl, xu, goal);
+	record(result);
+	return result;
+}
+
+void multi_integrator::integrate(vector_monte_function * f, const double * xl, const double * xu,
+								 const integration_goal & goal, integration_result * results){
+	run_vector(f, xl, xu, goal, results);
+	// the components share their evaluations, the least accurate one counts
+	integration_result worst = results[0];
+	for (size_t k=1; k<f->Ncomponents; k++){
+		if (results[k].error*std::abs(worst.value) > worst.error*std::abs(results[k].value))
+			worst = results[k];
+	}
+	record(worst);
+}
+
+namespace {
+	void scalar_component(double * x, size_t dim, void * params, double * values){
+		gsl_monte_function * f = static_cast<gsl_monte_function *>(params);
+		values[0] = f->f(x, dim, f->params);
+	}
+
+	bool goal_met(const integration_result * results, size_t Ncomponents, double epsrel){
+		for (size_t k=0; k<Ncomponents; k++)
+			if (results[k].error > epsrel*std::abs(results[k].value)) return false;
+		return true;
+	}
+
+	// the evaluation and wall time budgets of one integration
+	class integration_budget{
+	private:
+		size_t max_evals;
+		double max_seconds;
+		std::chrono::steady_clock::time_point start;
+	public:
+		integration_budget(const integration_goal & goal)
+		:	max_evals(goal.max_evals << 2*status_of_thread.level),
+			max_seconds(goal.max_seconds*std::pow(4., status_of_thread.level)),
+			start(std::chrono::steady_clock::now())
+		{}
+		// whether Nevals evaluations in total stay within the budget,
+		// the integration fails if not
+		bool allows(size_t Nevals) const{
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			if (Nevals <= max_evals && (max_seconds <= 0. || elapsed.count() < max_seconds)) return true;
+			check_integration(GSL_EMAXITER);
+			return false;
+		}
+	};
+}
+
+integration_result multi_integrator::run(gsl_monte_function * f, const double * xl, const double * xu,
+										 const integration_goal & goal){
+	vector_monte_function F = {&scalar_component, f->dim, 1, f};
+	integration_result result;
+	run_vector(&F, xl, xu, goal, &result);
+	return result;
+}
+
+integration_result vegas_integrator::run(gsl_monte_function * f, const double * xl, const double * xu,
+										 const integration_goal & goal){
+	size_t dim = f->dim, calls = goal.calls << 2*status_of_thread.level;
+	integration_budget budget(goal);
+	// from stage 1 on GSL keeps the box of the grid it started with, so the
+	// integrand is mapped onto the unit box, whose grid fits any cell
+	double volume = 1.;
+	for (size_t d=0; d<dim; d++) volume *= xu[d]-xl[d];
+	std::vector<double> x(dim), lower(dim, 0.), upper(dim, 1.);
+	auto unit_box = [&](double * u){
+		for (size_t d=0; d<dim; d++) x[d] = xl[d] + (xu[d]-xl[d])*u[d];
+		return volume*f->f(x.data(), dim, f->params);
+	};
+	gsl_monte_function F = make_monte_function(unit_box, dim);
+	auto found = context_of_thread.gsl.find(std::make_pair(get_id(), dim));
+	if (found == context_of_thread.gsl.end()){
+		integration_context::gsl_grid fresh = {gsl_monte_vegas_alloc(dim), false};
+		found = context_of_thread.gsl.insert(std::make_pair(std::make_pair(get_id(), dim), fresh)).first;
+	}
+	gsl_monte_vegas_state * sv = found->second.state;
+	// stage 1 keeps the grid and only discards the previous results,
+	// a retry starts from a uniform grid
+	gsl_monte_vegas_params params;
+	gsl_monte_vegas_params_get(sv, &params);
+	params.stage = (found->second.warm && status_of_thread.level == 0) ? 1 : 0;
+	// reseeded for every integration, which keeps the tables reproducible
+	rng_lease r(context_of_thread.rngs,
+		[](gsl_rng * old){return old->type == gsl_rng_default;},
+		[](){return gsl_rng_alloc(gsl_rng_default);});
+	gsl_rng_set(r.get(), gsl_rng_default_seed);
+	integration_result result = {0., 0., 0, 0};
+	while (true){
+		gsl_monte_vegas_params_set(sv, &params);
+		check_integration(gsl_monte_vegas_integrate(&F, lower.data(), upper.data(), dim, calls, r.get(), sv,
+													&result.value, &result.error));
+		result.Nevals += calls*params.iterations;
+		result.Niterations += params.iterations;
+		params.stage = 1;
+		if (std::abs(gsl_monte_vegas_chisq(sv)-1.0) <= goal.max_chisq_deviation
+			&& goal_met(&result, 1, goal.epsrel)) break;
+		// the next pass doubles the calls
+		calls *= 2;
+		if (!budget.allows(result.Nevals + calls*params.iterations)) break;
+	}
+	found->second.warm = true;
+	return result;
+}
+
+namespace {
+	// the sums of one chunk of the evaluations of a Vegas iteration, and the
+	// bin edges it samples from, a copy of the grid of the integration
+	struct vegas_chunk{
+		std::vector<double> edges, sum, sum2, d2;
+		double ref, ref2;
+	};
+
+	// exchanges the integration status of the thread with another one for
+	// the lifetime of the object
+	class status_swap{
+	private:
+		integration_status & other;
+	public:
+		status_swap(integration_status & other_) : other(other_) {std::swap(status_of_thread, other);};
+		~status_swap(){std::swap(status_of_thread, other);};
+	};
+
+	// task(c) for every chunk c < Nchunks. Outside of the thread pool the
+	// chunks are spread over the pool, inside a pool task, e.g. a cell of a
+	// table build that keeps the pool busy already, they run one after the
+	// other. While it waits the calling thread only runs chunks of its own,
+	// a cell of another table run in between would change the warm start
+	// grid and the integration status of the thread. Integrator failures in
+	// the chunks count for the calling thread.
+	void run_chunks(size_t Nchunks, std::function<void(size_t)> task){
+		thread_pool & pool = thread_pool::instance();
+		if (Nchunks < 2 || pool.size() < 2 || pool.worker_index() < pool.size()){
+			for (size_t c=0; c<Nchunks; c++) task(c);
+			return;
+		}
+		integration_status start = {status_of_thread.level, 0, GSL_SUCCESS, 0., 0};
+		std::vector<integration_status> chunk_status(Nchunks, start);
+		pool.parallel_for(Nchunks, [&](size_t c){
+			status_swap swap(chunk_status[c]);
+			task(c);
+		}, false);
+		for (auto&& chunk : chunk_status){
+			status_of_thread.Nfailures += chunk.Nfailures;
+			if (chunk.Nfailures > 0) status_of_thread.last_error = chunk.last_error;
+			status_of_thread.relerr = std::max(status_of_thread.relerr, chunk.relerr);
+			status_of_thread.Niterations += chunk.Niterations;
+		}
+	}
+}
+
+void vegas_integrator::run_vector(vector_monte_function * f, const double * xl, const double * xu,
+								  const integration_goal & goal, integration_result * results){
+	// importance sampling as in G.P. Lepage, J. Comput. Phys. 27, 192 (1978),
+	// with GSL's defaults: 50 bins per axis, damping 1.5, 5 iterations a pass
+	const size_t Nbins = 50, Niterations = 5;
+	const double alpha = 1.5;
+	// the evaluations of an iteration are split into at most max_chunks
+	// chunks of at least min_chunk_calls, independent of the number of threads
+	const size_t min_chunk_calls = 256, max_chunks = 64;
+	size_t dim = f->dim, K = f->Ncomponents;
+	size_t calls = std::max(goal.calls << 2*status_of_thread.level, Niterations*2)/Niterations;
+	integration_budget budget(goal);
+	double volume = 1.;
+	for (size_t d=0; d<dim; d++) volume *= xu[d]-xl[d];
+	// bin edges of every axis in [0, 1], uniform or from the previous cell
+	integration_context::edge_grid & grid = context_of_thread.edges[std::make_pair(get_id(), dim)];
+	std::vector<double> & edges = grid.edges;
+	if (!grid.warm || status_of_thread.level > 0 || edges.size() != dim*(Nbins+1)){
+		edges.resize(dim*(Nbins+1));
+		for (size_t d=0; d<dim; d++)
+			for (size_t b=0; b<=Nbins; b++) edges[d*(Nbins+1)+b] = double(b)/Nbins;
+	}
+	grid.warm = true;
+
+	std::vector<double> sum(K), sum2(K), weight_sum(K), weighted_sum(K), d2(dim*Nbins);
+	// components with an iteration without spread, e.g. a vanishing integrand,
+	// take the mean of that iteration as exact
+	std::vector<bool> exact(K);
+	size_t Nevals = 0, Npasses = 0, Nsteps = 0;
+	while (true){
+		std::fill(weight_sum.begin(), weight_sum.end(), 0.);
+		std::fill(weighted_sum.begin(), weighted_sum.end(), 0.);
+		std::fill(exact.begin(), exact.end(), false);
+		// chi^2 of the summed components
+		double ref_weights = 0., ref_weighted = 0., ref_weighted2 = 0.;
+		size_t Nchunks = std::max(size_t(1), std::min(calls/min_chunk_calls, max_chunks));
+		std::vector<vegas_chunk> chunks(Nchunks);
+		for (size_t it=0; it<Niterations; it++, Nsteps++){
+			for (auto&& chunk : chunks) chunk.edges = edges;
+			// every chunk samples from a random stream of its own, seeded by
+			// the iteration and the chunk, which keeps the tables reproducible
+			run_chunks(Nchunks, [&](size_t c){
+				vegas_chunk & chunk = chunks[c];
+				chunk.sum.assign(K, 0.);
+				chunk.sum2.assign(K, 0.);
+				chunk.d2.assign(dim*Nbins, 0.);
+				chunk.ref = chunk.ref2 = 0.;
+				std::seed_seq seed = {uint32_t(Nsteps), uint32_t(c)};
+				std::mt19937 gen(seed);
+				std::uniform_real_distribution<double> uniform(0., 1.);
+				std::vector<double> x(dim), values(K);
+				std::vector<size_t> bin(dim);
+				for (size_t n=c*calls/Nchunks; n<(c+1)*calls/Nchunks; n++){
+					double jacobian = volume;
+					for (size_t d=0; d<dim; d++){
+						const double * e = &chunk.edges[d*(Nbins+1)];
+						double u = uniform(gen)*Nbins;
+						size_t b = std::min(size_t(u), Nbins-1);
+						double width = e[b+1]-e[b];
+						bin[d] = b;
+						jacobian *= Nbins*width;
+						x[d] = xl[d] + (xu[d]-xl[d])*(e[b] + (u-b)*width);
+					}
+					f->f(x.data(), dim, f->params, values.data());
+					double total = 0.;
+					for (size_t k=0; k<K; k++){
+						double w = values[k]*jacobian;
+						chunk.sum[k] += w;
+						chunk.sum2[k] += w*w;
+						total += w;
+					}
+					chunk.ref += total;
+					chunk.ref2 += total*total;
+					for (size_t d=0; d<dim; d++) chunk.d2[d*Nbins+bin[d]] += total*total;
+				}
+			});
+			// merged in a fixed order, the result does not depend on the threads
+			std::fill(sum.begin(), sum.end(), 0.);
+			std::fill(sum2.begin(), sum2.end(), 0.);
+			std::fill(d2.begin(), d2.end(), 0.);
+			double ref = 0., ref2 = 0.;
+			for (auto&& chunk : chunks){
+				for (size_t k=0; k<K; k++){
+					sum[k] += chunk.sum[k];
+					sum2[k] += chunk.sum2[k];
+				}
+				for (size_t i=0; i<dim*Nbins; i++) d2[i] += chunk.d2[i];
+				ref += chunk.ref;
+				ref2 += chunk.ref2;
+			}
+			Nevals += calls;
+			for (size_t k=0; k<K; k++){
+				if (exact[k]) continue;
+				double mean = sum[k]/calls, var = std::max((sum2[k]/calls - mean*mean)/(calls-1.), 0.);
+				if (var == 0.){
+					exact[k] = true;
+					weighted_sum[k] = mean;
+					continue;
+				}
+				double w = 1./std::max(var, DBL_MIN);
+				weight_sum[k] += w;
+				weighted_sum[k] += w*mean;
+			}
+			double mean = ref/calls, var = std::max((ref2/calls - mean*mean)/(calls-1.), 1e-300);
+			ref_weights += 1./var;
+			ref_weighted += mean/var;
+			ref_weighted2 += mean*mean/var;
+
+			// move the edges so that every bin carries the same share of f^2
+			for (size_t d=0; d<dim; d++){
+				double * e = &edges[d*(Nbins+1)], * g = &d2[d*Nbins];
+				std::vector<double> smooth(Nbins), r(Nbins);
+				for (size_t b=0; b<Nbins; b++){
+					double left = g[b > 0 ? b-1 : b], right = g[b+1 < Nbins ? b+1 : b];
+					smooth[b] = (left + g[b] + right)/3.;
+				}
+				double total = 0.;
+				for (auto&& s : smooth) total += s;
+				if (total <= 0.) continue;
+				double rtotal = 0.;
+				for (size_t b=0; b<Nbins; b++){
+					double share = smooth[b]/total;
+					r[b] = (share > 0. && share < 1.) ? std::pow((share-1.)/std::log(share), alpha) : share;
+					rtotal += r[b];
+				}
+				std::vector<double> old(e, e+Nbins+1);
+				double per_bin = rtotal/Nbins, acc = 0.;
+				size_t b = 0;
+				for (size_t nb=1; nb<Nbins; nb++){
+					while (b+1 < Nbins && acc + r[b] < nb*per_bin){ acc += r[b]; b++; }
+					double fraction = (r[b] > 0.) ? std::min((nb*per_bin - acc)/r[b], 1.) : 0.;
+					e[nb] = old[b] + fraction*(old[b+1]-old[b]);
+				}
+			}
+		}
+		Npasses++;
+		bool all_exact = true;
+		for (size_t k=0; k<K; k++){
+			results[k].value = exact[k] ? weighted_sum[k] : weighted_sum[k]/weight_sum[k];
+			results[k].error = exact[k] ? 0. : 1./std::sqrt(weight_sum[k]);
+			results[k].Nevals = Nevals;
+			results[k].Niterations = Npasses*Niterations;
+			all_exact = all_exact && exact[k];
+		}
+		if (all_exact) break;
+		double ref_mean = ref_weighted/ref_weights;
+		double chisq = (ref_weighted2 - ref_mean*ref_weighted)/(Niterations-1.);
+		if (std::abs(chisq-1.) <= goal.max_chisq_deviation && goal_met(results, K, goal.epsrel)) break;
+		// the next pass doubles the calls
+		calls *= 2;
+		if (!budget.allows(Nevals + calls*Niterations)) break;
+	}
+}
+
+void sobol_integrator::run_vector(vector_monte_function * f, const double * xl, const double * xu,
+								  const integration_goal & goal, integration_result * results){
+	// independently shifted replicas, their spread is the error estimate
+	const size_t Nreplicas = 8;
+	const double two32 = 4294967296.;
+	size_t dim = f->dim, K = f->Ncomponents, Npasses = 0;
+	integration_budget budget(goal);
+	// Sobol points are balanced in blocks of powers of two
+	size_t N = 16;
+	while (N*Nreplicas < goal.calls) N *= 2;
+
+	// a fixed seed keeps the tables reproducible
+	std::mt19937 gen;
+	std::vector<uint32_t> shift(Nreplicas*dim);
+	for (auto&& s : shift) s = gen();
+	// restarted at the first point of the sequence
+	qrng_lease q(context_of_thread.qrngs,
+		[dim](gsl_qrng * old){return old->dimension == dim;},
+		[dim](){return gsl_qrng_alloc(gsl_qrng_sobol, dim);});
+	gsl_qrng_init(q.get());
+	std::vector<double> u(dim), x(dim), values(K), sum(Nreplicas*K, 0.);
+	double volume = 1.;
+	for (size_t d=0; d<dim; d++) volume *= xu[d]-xl[d];
+
+	size_t n = 0;
+	while (true){
+		for (size_t i=0; i<N; i++){
+			gsl_qrng_get(q.get(), u.data());
+			for (size_t r=0; r<Nreplicas; r++){
+				for (size_t d=0; d<dim; d++){
+					uint32_t bits = uint32_t(u[d]*two32) ^ shift[r*dim+d];
+					x[d] = xl[d] + (xu[d]-xl[d])*(bits+0.5)/two32;
+				}
+				f->f(x.data(), dim, f->params, values.data());
+				for (size_t k=0; k<K; k++) sum[r*K+k] += values[k];
+			}
+		}
+		n += N;
+		Npasses++;
+		for (size_t k=0; k<K; k++){
+			double mean = 0., var = 0.;
+			for (size_t r=0; r<Nreplicas; r++) mean += sum[r*K+k]/n;
+			mean /= Nreplicas;
+			for (size_t r=0; r<Nreplicas; r++) var += std::pow(sum[r*K+k]/n - mean, 2);
+			var /= Nreplicas - 1.;
+			results[k].value = volume*mean;
+			results[k].error = volume*std::sqrt(var/Nreplicas);
+			results[k].Nevals = n*Nreplicas;
+			results[k].Niterations = Npasses;
+		}
+		if (goal_met(results, K, goal.epsrel)) break;
+		// the next pass doubles the points of every replica
+		if (!budget.allows(2*n*Nreplicas)) break;
+		N = n;
+	}
+}
+
+namespace {
+	// a box of the adaptive cubature, with its Genz-Malik estimates
+	struct cubature_region{
+		std::vector<double> center, halfwidth;
+		std::vector<double> value, error;
+		double priority;
+		size_t split;
+		bool operator<(const cubature_region & other) const {return priority < other.priority;};
+	};
+
+	// degree 7 rule with an embedded degree 5 rule for the error, see
+	// A.C. Genz and A.A. Malik, J. Comput. Appl. Math. 6, 295 (1980)
+	size_t genz_malik(vector_monte_function * f, cubature_region & region){
+		const double lambda2 = std::sqrt(9./70.), lambda4 = std::sqrt(9./10.), lambda5 = std::sqrt(9./19.);
+		const double ratio = lambda2*lambda2/(lambda4*lambda4);
+		const size_t n = f->dim, K = f->Ncomponents;
+		const double w1 = (12824. - 9120.*n + 400.*n*n)/19683., w2 = 980./6561.,
+					 w3 = (1820. - 400.*n)/19683., w4 = 200./19683.,
+					 w5 = 6859./19683./double(size_t(1) << n);
+		const double e1 = (729. - 950.*n + 50.*n*n)/729., e2 = 245./486.,
+					 e3 = (265. - 100.*n)/1458., e4 = 25./729.;
+		std::vector<double> x(region.center), values(K);
+		const std::vector<double> & c = region.center, & h = region.halfwidth;
+		// evaluate at x and add the components times weight to sum
+		auto F = [&](std::vector<double> & sum, double weight){
+			f->f(x.data(), n, f->params, values.data());
+			for (size_t k=0; k<K; k++) sum[k] += weight*values[k];
+		};
+
+		std::vector<double> f0(K, 0.), sum2(K, 0.), sum3(K, 0.), sum4(K, 0.), sum5(K, 0.),
+							diff(K), a2(K), b2(K), a4(K), b4(K);
+		F(f0, 1.);
+		double max_diff = -1.;
+		for (size_t i=0; i<n; i++){
+			std::fill(diff.begin(), diff.end(), 0.);
+			x[i] = c[i] - lambda2*h[i]; F(sum2, 1.); F(diff, 1.);
+			x[i] = c[i] + lambda2*h[i]; F(sum2, 1.); F(diff, 1.);
+			x[i] = c[i] - lambda4*h[i]; F(sum3, 1.); F(diff, -ratio);
+			x[i] = c[i] + lambda4*h[i]; F(sum3, 1.); F(diff, -ratio);
+			x[i] = c[i];
+			// split where the fourth difference of the components is largest
+			double d = 0.;
+			for (size_t k=0; k<K; k++) d += std::abs(diff[k] - 2.*(1.-ratio)*f0[k]);
+			if (d > max_diff){ max_diff = d; region.split = i; }
+		}
+		for (size_t i=0; i<n; i++){
+			for (size_t j=i+1; j<n; j++){
+				for (int s=0; s<4; s++){
+					x[i] = c[i] + ((s&1) ? lambda4 : -lambda4)*h[i];
+					x[j] = c[j] + ((s&2) ? lambda4 : -lambda4)*h[j];
+					F(sum4, 1.);
+				}
+				x[i] = c[i]; x[j] = c[j];
+			}
+		}
+		for (size_t corner=0; corner < (size_t(1) << n); corner++){
+			for (size_t d=0; d<n; d++) x[d] = c[d] + (((corner>>d)&1) ? lambda5 : -lambda5)*h[d];
+			F(sum5, 1.);
+		}
+		double volume = 1.;
+		for (size_t d=0; d<n; d++) volume *= 2.*h[d];
+		region.value.resize(K);
+		region.error.resize(K);
+		for (size_t k=0; k<K; k++){
+			region.value[k] = volume*(w1*f0[k] + w2*sum2[k] + w3*sum3[k] + w4*sum4[k] + w5*sum5[k]);
+			region.error[k] = std::abs(region.value[k]
+								- volume*(e1*f0[k] + e2*sum2[k] + e3*sum3[k] + e4*sum4[k]));
+		}
+		return 1 + 4*n + 2*n*(n-1) + (size_t(1) << n);
+	}
+}
+
+void cubature_integrator::run_vector(vector_monte_function * f, const double * xl, const double * xu,
+									 const integration_goal & goal, integration_result * results){
+	size_t dim = f->dim, K = f->Ncomponents, Nsplits = 0;
+	integration_budget budget(goal);
+	cubature_region whole;
+	for (size_t d=0; d<dim; d++){
+		whole.center.push_back(0.5*(xl[d]+xu[d]));
+		whole.halfwidth.push_back(0.5*(xu[d]-xl[d]));
+	}
+	size_t cost = genz_malik(f, whole), Nevals = cost;
+	// regions are ranked by their largest error relative to the first
+	// estimate of the respective component
+	std::vector<double> scale(K);
+	for (size_t k=0; k<K; k++)
+		scale[k] = (whole.value[k] != 0.) ? 1./std::abs(whole.value[k]) : 1.;
+	auto rank = [&](cubature_region & region){
+		region.priority = 0.;
+		for (size_t k=0; k<K; k++) region.priority = std::max(region.priority, region.error[k]*scale[k]);
+	};
+	rank(whole);
+	std::priority_queue<cubature_region> regions;
+	regions.push(whole);
+	std::vector<double> value(whole.value), error(whole.error);
+	while (true){
+		for (size_t k=0; k<K; k++){
+			results[k].value = value[k];
+			results[k].error = error[k];
+		}
+		if (goal_met(results, K, goal.epsrel)) break;
+		if (!budget.allows(Nevals + 2*cost)) break;
+		Nsplits++;
+		cubature_region parent = regions.top(), lower = parent, upper = parent;
+		regions.pop();
+		size_t d = parent.split;
+		lower.halfwidth[d] = upper.halfwidth[d] = 0.5*parent.halfwidth[d];
+		lower.center[d] -= lower.halfwidth[d];
+		upper.center[d] += upper.halfwidth[d];
+		Nevals += genz_malik(f, lower) + genz_malik(f, upper);
+		rank(lower);
+		rank(upper);
+		for (size_t k=0; k<K; k++){
+			value[k] += lower.value[k] + upper.value[k] - parent.value[k];
+			error[k] += lower.error[k] + upper.error[k] - parent.error[k];
+		}
+		regions.push(lower);
+		regions.push(upper);
+	}
+	// sum up again, the running totals accumulate round-off
+	for (size_t k=0; k<K; k++) results[k] = {0., 0., Nevals, Nsplits};
+	while (!regions.empty()){
+		for (size_t k=0; k<K; k++){
+			results[k].value += regions.top().value[k];
+			results[k].error += regions.top().error[k];
+		}
+		regions.pop();
+	}
+}
+
+std::unique_ptr<multi_integrator> make_integrator(std::string name){
+	if (name == "vegas") return std::unique_ptr<multi_integrator>(new vegas_integrator);
+	if (name == "parallel_vegas") return std::unique_ptr<multi_integrator>(new parallel_vegas_integrator);
+	if (name == "sobol") return std::unique_ptr<multi_integrator>(new sobol_integrator);
+	if (name == "cubature") return std::unique_ptr<multi_integrator>(new cubature_integrator);
+	throw std::invalid_argument("unknown integrator " + name);
+}
@@ -0,0 +1,218 @@
+#ifndef INTEGRATION_H
+#define INTEGRATION_H
+
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <gsl/gsl_integration.h>
+#include <gsl/gsl_monte.h>
+
+//=============integrator failure bookkeeping==================================
+// GSL's default error handler aborts the whole process, so it is switched off
+// once for the program and every integrator status is checked instead.
+// Failures are recorded for the calling thread, which also covers the nested
+// integrations of the rate tables. The tabulation driver resets this record
+// before a cell, and retries the cell at a higher escalation level when a
+// failure was recorded. It also keeps the accuracy the cell reached, which
+// the driver saves alongside the table.
+struct integration_status{
+	size_t level;		// escalation level of the current attempt, 0 = default limits
+	size_t Nfailures;	// integrator calls that reported an error
+	int last_error;		// GSL error code of the last failure
+	double relerr;		// largest relative error estimate of the integrations
+	size_t Niterations;	// qag subintervals, Vegas iterations, QMC passes and cubature bisections
+};
+integration_status & current_integration(void);
+void check_integration(int status);
+
+//=============per-thread scratch objects======================================
+// The GSL objects of an integration, qag workspaces, random and quasi random
+// number generators and Vegas states, are allocated once per thread and
+// nesting depth and reused by every later integration of that thread, so
+// the integrands of a table build do not allocate them per call. Random
+// number generators are reseeded and Sobol sequences restarted for every
+// integration, so results do not depend on what a thread integrated before.
+
+// gsl_integration_qag with a checked status, on a workspace of the thread.
+// At escalation level l the subinterval limit is raised by 4^l, and from
+// level 2 on the relative tolerance is relaxed by 10^(l-1).
+double qag_integrate(gsl_function * F, double a, double b,
+					 double epsabs, double epsrel, size_t limit, int key,
+					 double * error = NULL);
+
+//=============multi-dimensional integrators===================================
+// Backends for the phase-space integrals of the 2->3 and 3->2 tables, chosen
+// per table by the table spec key "<class>.integrator":
+//   vegas     gsl_monte_vegas, iterated on its adapted grid until chi^2/dof
+//             is close to 1
+//   parallel_vegas
+//             our own Vegas below for scalar integrands too, whose iterations
+//             can use the whole thread pool
+//   sobol     randomized quasi Monte Carlo: several digitally shifted copies
+//             of one Sobol sequence, doubled until their spread meets epsrel
+//   cubature  deterministic adaptive cubature with the degree 7/5 Genz-Malik
+//             rule, bisecting the region of largest error
+// Every backend returns an error estimate and its number of evaluations, and
+// keeps totals that are printed when it is destroyed, so backends can be
+// compared on the same table.
+// All backends stop once every component meets epsrel, Vegas in addition
+// needs chi^2/dof close to 1; the passes of Vegas and of QMC double their
+// calls until then. An integration is bounded by its evaluation and wall time
+// budgets: a result short of its tolerance within them counts as an
+// integrator failure (GSL_EMAXITER, see check_integration), and the budgets
+// grow by 4^l at escalation level l.
+// integrate() may be called from several threads at once.
+// A vector_monte_function computes several integrands at every point, e.g.
+// one per dt of a 2->3 table, and all of them share the evaluations; the
+// goal then applies to every component. GSL's Vegas has no such mode, vector
+// integrands get a Vegas grid of our own adapted to the sum of the components,
+// whose chi^2/dof decides when to stop.
+// Every iteration of our own Vegas splits its evaluations into chunks with
+// random streams of their own, and merges their sums in a fixed order. An
+// integration started outside of the thread pool, e.g. a single lazy cell or
+// a direct calculate() for validation, spreads the chunks over the pool; the
+// result does not depend on the number of threads.
+// Both Vegas variants keep the grid they adapted, per thread and integrator,
+// and the next integration of that thread starts from it instead of from a
+// uniform grid (warm start). The tabulation driver hands neighbouring cells
+// to a thread one after the other and calls forget_warm_start() before a
+// cell that is not a neighbour of the previous one; retries always start
+// from a uniform grid.
+struct integration_goal{
+	size_t calls;				// evaluations of the first pass (Vegas iterations, QMC points)
+	double epsrel;				// relative tolerance
+	size_t max_evals;			// evaluation budget
+	double max_chisq_deviation;	// vegas also needs |chi^2/dof - 1| below this
+	double max_seconds;			// wall time budget, <= 0 for none
+};
+
+struct integration_result{
+	double value, error;
+	size_t Nevals, Niterations;
+};
+
+struct vector_monte_function{
+	void (*f)(double * x, size_t dim, void * params, double * values);
+	size_t dim, Ncomponents;
+	void * params;
+};
+
+void forget_warm_start(void);
+
+class multi_integrator{
+private:
+	std::string name;
+	size_t id;
+	std::mutex m;
+	size_t Nintegrals, Nevals;
+	double sum_relerr;
+	void record(const integration_result & result);
+protected:
+	// unique among all integrators of the program, keys the warm start grids
+	size_t get_id(void) const {return id;};
+	// the default passes the integrand on to run_vector() as one component
+	virtual integration_result run(gsl_monte_function * f, const double * xl, const double * xu,
+								   const integration_goal & goal);
+	virtual void run_vector(vector_monte_function * f, const double * xl, const double * xu,
+							const integration_goal & goal, integration_result * results) = 0;
+public:
+	multi_integrator(std::string name_);
+	virtual ~multi_integrator();
+	std::string get_name(void) const {return name;};
+	integration_result integrate(gsl_monte_function * f, const double * xl, const double * xu,
+								 const integration_goal & goal);
+	// one result per component of f
+	void integrate(vector_monte_function * f, const double * xl, const double * xu,
+				   const integration_goal & goal, integration_result * results);
+};
+
+class vegas_integrator : public multi_integrator{
+protected:
+	vegas_integrator(std::string name_) : multi_integrator(name_) {};
+	integration_result run(gsl_monte_function * f, const double * xl, const double * xu,
+						   const integration_goal & goal);
+	void run_vector(vector_monte_function * f, const double * xl, const double * xu,
+					const integration_goal & goal, integration_result * results);
+public:
+	vegas_integrator(void) : multi_integrator("vegas") {};
+};
+
+class parallel_vegas_integrator : public vegas_integrator{
+protected:
+	integration_result run(gsl_monte_function * f, const double * xl, const double * xu,
+						   const integration_goal & goal){
+		return multi_integrator::run(f, xl, xu, goal);
+	};
+public:
+	parallel_vegas_integrator(void) : vegas_integrator("parallel_vegas") {};
+};
+
+class sobol_integrator : public multi_integrator{
+protected:
+	void run_vector(vector_monte_function * f, const double * xl, const double * xu,
+					const integration_goal & goal, integration_result * results);
+public:
+	sobol_integrator(void) : multi_integrator("sobol") {};
+};
+
+class cubature_integrator : public multi_integrator{
+protected:
+	void run_vector(vector_monte_function * f, const double * xl, const double * xu,
+					const integration_goal & goal, integration_result * results);
+public:
+	cubature_integrator(void) : multi_integrator("cubature") {};
+};
+
+// "vegas", "parallel_vegas", "sobol" or "cubature"
+std::unique_ptr<multi_integrator> make_integrator(std::string name);
+
+//=============typed integrands================================================
+// GSL and the samplers take an integrand as a C function and a void pointer.
+// These adaptors make one from any function object, usually a lambda that
+// captures its parameters by reference from the caller's stack, so parameters
+// keep their types and the call into an interpX can be inlined. The void
+// pointer refers to the function object, which has to outlive the integration.
+template <typename F>
+double gsl_function_adaptor(double x, void * f){
+	return (*static_cast<F *>(f))(x);
+}
+
+template <typename F>
+gsl_function make_gsl_function(F & f){
+	gsl_function G;
+	G.function = &gsl_function_adaptor<F>;
+	G.params = &f;
+	return G;
+}
+
+// f(x) with x the point in dim dimensions
+template <typename F>
+double monte_function_adaptor(double * x, size_t dim, void * f){
+	(void) dim;
+	return (*static_cast<F *>(f))(x);
+}
+
+template <typename F>
+gsl_monte_function make_monte_function(F & f, size_t dim){
+	gsl_monte_function G;
+	G.f = &monte_function_adaptor<F>;
+	G.dim = dim;
+	G.params = &f;
+	return G;
+}
+
+// f(x, values) fills the Ncomponents values at x
+template <typename F>
+void vector_function_adaptor(double * x, size_t dim, void * f, double * values){
+	(void) dim;
+	(*static_cast<F *>(f))(x, values);
+}
+
+template <typename F>
+vector_monte_function make_vector_function(F & f, size_t dim, size_t Ncomponents){
+	vector_monte_function G = {&vector_function_adaptor<F>, dim, Ncomponents, &f};
+	return G;
+}
+
+#endif
@@ -1,172 +1,205 @@
 #include <iostream>
-#include <fstream>
+#include <limits>
+#include <string>
 #include <vector>
-#include <cmath>
-#include <boost/multi_array.hpp>
-#include <H5Cpp.h>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
 
 #include "matrix_elements.h"
 #include "Xsection.h"
 #include "rates.h"
-//#include "qhat_Xsection.h"
+#include "qhat_Xsection.h"
 #include "qhat.h"
-#include "Langevin.h"
+#include "tabulation.h"
+#include "table_set.h"
+#include "table_spec.h"
 
+namespace po = boost::program_options;
 
-using std::vector;
+// the cells "first-last" (both included) of a shard
+static void parse_cells(std::string cells, size_t & first, size_t & last)
+{
+        size_t dash = cells.find('-');
+        if (dash == std::string::npos)
+                throw std::invalid_argument("--cells expects first-last, got " + cells);
+        first = std::stoul(cells.substr(0, dash));
+        last = std::stoul(cells.substr(dash+1));
+        if (last < first)
+                throw std::invalid_argument("--cells: empty range " + cells);
+}
 
-int main()
+static void check_table_name(std::string table)
 {
-        double M = 1.3;
+        for (auto&& name : table_set::table_names())
+                if (name == table) return;
+        throw std::invalid_argument("unknown table " + table);
+}
 
-        double temp = 0.3;
+// compute the cells [first, last] of a single table into a partial file,
+// without --cells only print the number of cells to split
+static int run_shard(po::variables_map & vm)
+{
+        double M = vm["mass"].as<double>();
+        size_t Nf = vm["Nf"].as<size_t>();
+        std::string folder = vm["folder"].as<std::string>();
+        std::string table = vm["table"].as<std::string>();
+        check_table_name(table);
+
+        tabulated_table * xsection = NULL;
+        std::string dep = table_set::dependency(table);
+        if (!dep.empty()){
+                if (!boost::filesystem::exists(folder + "/" + dep + ".hdf5"))
+                        throw std::runtime_error(table + " needs " + folder + "/" + dep
+                                                 + ".hdf5, build or merge it first");
+                xsection = table_set::make_table(dep, M, Nf, folder, false);
+        }
+        // lazy construction only sets up the grid, the shard fills it
+        bool lazy = table_options().lazy;
+        table_options().lazy = true;
+        tabulated_table * target = table_set::make_table(table, M, Nf, folder, true, xsection);
+        table_options().lazy = lazy;
+
+        if (!vm.count("cells")){
+                std::cout << table << ": " << target->table_size() << " cells" << std::endl;
+        }
+        else{
+                size_t first, last;
+                parse_cells(vm["cells"].as<std::string>(), first, last);
+                std::string output = vm.count("output") ? vm["output"].as<std::string>()
+                        : folder + "/" + table + ".cells-" + std::to_string(first) + "-" + std::to_string(last) + ".hdf5";
+                target->tabulate_shard(first, last+1, output, table_set::dataset_name(table));
+        }
+        delete target;
+        delete xsection;
+        return 0;
+}
 
-        //Xsection_2to2 xQq2Qq(&dX_Qq2Qq_dPS, &approx_XQq2Qq, M, "XQq2Qq.hdf5", false);
-        //Xsection_2to2 xQg2Qg(&dX_Qg2Qg_dPS, &approx_XQg2Qg, M, "XQg2Qg.hdf5", false);
-        //rates_2to2 rQq2Qq(&xQq2Qq, 36, 0., "rQq2Qq.hdf5", false);
-        //rates_2to2 rQg2Qg(&xQg2Qg, 16, 0., "rQg2Qg.hdf5", false);
+static int run_merge(po::variables_map & vm, std::vector<std::string> shards)
+{
+        std::string table = vm["table"].as<std::string>();
+        check_table_name(table);
+        if (shards.empty())
+                throw std::invalid_argument("merge: no shard files given");
+        std::string output = vm.count("output") ? vm["output"].as<std::string>()
+                : vm["folder"].as<std::string>() + "/" + table + ".hdf5";
+        merge_table_shards(shards, output, table_set::dataset_name(table));
+        return 0;
+}
 
-        bool refresh = true;
-        QhatXsection_2to2 qhat_xQq2Qq(&dqhat_Qq2Qq_dPS, &approx_XQq2Qq, M, "qhat_XQq2Qq.hdf5", refresh);
-        QhatXsection_2to2 qhat_xQg2Qg(&dqhat_Qg2Qg_dPS, &approx_XQg2Qg, M, "qhat_XQg2Qg.hdf5", refresh);
+// widen one axis of an existing table, only the new cells are computed
+static int run_extend(po::variables_map & vm)
+{
+        double M = vm["mass"].as<double>();
+        size_t Nf = vm["Nf"].as<size_t>();
+        std::string folder = vm["folder"].as<std::string>();
+        std::string table = vm["table"].as<std::string>();
+        check_table_name(table);
+        if (!vm.count("axis"))
+                throw std::invalid_argument("extend needs --axis");
+        if (!boost::filesystem::exists(folder + "/" + table + ".hdf5"))
+                throw std::runtime_error(folder + "/" + table + ".hdf5 does not exist");
+
+        tabulated_table * xsection = NULL;
+        std::string dep = table_set::dependency(table);
+        if (!dep.empty()) xsection = table_set::make_table(dep, M, Nf, folder, false);
+        tabulated_table * target = table_set::make_table(table, M, Nf, folder, false, xsection);
+        target->extend(vm["axis"].as<std::string>(), vm["low"].as<double>(), vm["high"].as<double>());
+        delete target;
+        delete xsection;
+        return 0;
+}
+
+static int run_qhat(po::variables_map & vm)
+{
+        double M = vm["mass"].as<double>();
+        bool refresh = vm.count("refresh") > 0;
+        QhatXsection_2to2 qhat_xQq2Qq(&dqhat_Qq2Qq_dPS, M, "qhat_XQq2Qq.hdf5", refresh);
+        QhatXsection_2to2 qhat_xQg2Qg(&dqhat_Qg2Qg_dPS, M, "qhat_XQg2Qg.hdf5", refresh);
         Qhat_2to2 qhatQq2Qq(&qhat_xQq2Qq, 36, 0., "qhat_Qq2Qq.hdf5", refresh);
         Qhat_2to2 qhatQg2Qg(&qhat_xQg2Qg, 16, 0., "qhat_Qg2Qg.hdf5", refresh);
+        return 0;
+}
 
-/*
-
-        std::cout << "read in table successfully :) " << std::endl;
-
-        particle testHQ;
-    
-        double E1 = 10.;
-    
-        testHQ.p={E1, 0., 0, std::sqrt(E1*E1 - M*M)};
-        testHQ.x={0., 0., 0.};
-
-        double drag_Qq, drag_Qg, drag;
-        double kperp_Qq, kperp_Qg, kperp;
-        double kpara_Qq, kpara_Qg, kpara;
-
-        int npart = 20000;
-        vector<particle> events(npart, testHQ);
-
-        int ntime = 10000;
-        double deltat = 0.01;
-
-        int NTau = int(ntime*deltat);
-
-
-        typedef boost::multi_array<double, 3> array3D;
-        array3D part_info(boost::extents[NTau][npart][4]);
-
-*/
-        // test 
-        /*
-        particle HQ;
-        HQ.p = testHQ.p;
-        HQ.x = testHQ.x;
-
-        double* args = new double[4];
-        args[0] = HQ.p[0];
-        args[1] = temp;
-        args[2] = 0.0;
- 
-        args[3] = 1;  drag_Qq = qhatQq2Qq.interpQ(args); drag_Qg = qhatQg2Qg.interpQ(args);
-        args[3] = 2;  kperp_Qq = qhatQq2Qq.interpQ(args); kperp_Qg = qhatQg2Qg.interpQ(args);
-        args[3] = 3;  kpara_Qq = qhatQq2Qq.interpQ(args); kpara_Qg = qhatQg2Qg.interpQ(args);
-        delete [] args;
-        drag = (drag_Qq + drag_Qg) * 5.068;
-        kperp = (kperp_Qq + kperp_Qg) * 5.068;
-        kpara = ((kpara_Qq - drag_Qq*drag_Qq) + (kpara_Qg - drag_Qg*drag_Qg) ) * 5.068;
-
-        std::cout << "main: " << HQ.p[0] <<" " <<  drag << " " << kperp << " " << kpara << std::endl;
-
-
-        //update_by_Langevin_test(HQ, &qhatQq2Qq, &qhatQg2Qg, temp, deltat, true);
-        update_by_Langevin(HQ, temp, drag, kpara, kperp, deltat, false);
-        std::cout << "main: " << HQ.p[0] <<" " <<  HQ.p[1]<< " " << HQ.p[2] << " " << HQ.p[3] << std::endl;
-        */
-
-/*
-        for (size_t ipart = 0; ipart < npart; ++ipart)
-        {
-                particle HQ;
-                HQ.p = testHQ.p;
-                HQ.x = testHQ.x;
-
-                for (size_t itime=0; itime<ntime; ++itime)
-                {
-                        update_by_Langevin_test(HQ, &qhatQq2Qq, &qhatQg2Qg, temp, deltat, false);
-                        if (itime % 100 == 0)
-                        {
-                                int idx_t = itime/100;
-                                part_info[idx_t][ipart][0] = HQ.p[0];
-                                part_info[idx_t][ipart][1] = HQ.p[1];
-                                part_info[idx_t][ipart][2] = HQ.p[2];
-                                part_info[idx_t][ipart][3] = HQ.p[3];
-                        }
+int main(int argc, char* argv[])
+{
+        po::options_description options("Options");
+        options.add_options()
+                ("help,h", "show this message")
+                ("mass", po::value<double>()->default_value(1.3), "heavy quark mass [GeV]")
+                ("Nf", po::value<size_t>()->default_value(3), "number of light flavours")
+                ("mD-type", po::value<unsigned int>()->default_value(0), "Debye mass prescription")
+                ("scale", po::value<double>()->default_value(1.0), "Debye mass scale factor")
+                ("folder", po::value<std::string>()->default_value("./tables"), "table folder")
+                ("refresh", "recompute existing tables")
+                ("profile", po::value<std::string>(), "table accuracy profile: fast-dev, production or high-precision")
+                ("spec", po::value<std::string>(), "table spec file of key = value lines, applied after --profile")
+                ("cache", po::value<std::string>(), "directory of finished tables shared between runs, "
+                        "tables with matching inputs are copied from there instead of computed")
+                ("cell-time-limit", po::value<double>(), "wall time budget [s] of the Monte Carlo integration "
+                        "of a table cell, a cell over budget is retried with larger budgets")
+                ("fuse-channels", "build: compute the Q+q and Q+g 2->3 cross sections from common integrations")
+                ("table", po::value<std::string>(), "table to shard, merge or extend, e.g. RQg2Qgg")
+                ("cells", po::value<std::string>(), "shard: cells first-last to compute (inclusive)")
+                ("output,o", po::value<std::string>(), "shard / merge: output file")
+                ("axis", po::value<std::string>(), "extend: axis to widen, e.g. T or E1")
+                ("low", po::value<double>()->default_value(std::numeric_limits<double>::quiet_NaN(), "keep"),
+                        "extend: new lower end of the axis")
+                ("high", po::value<double>()->default_value(std::numeric_limits<double>::quiet_NaN(), "keep"),
+                        "extend: new upper end of the axis")
+        ;
+        po::options_description hidden;
+        hidden.add_options()
+                ("command", po::value<std::string>()->default_value("build"), "")
+                ("files", po::value< std::vector<std::string> >()->default_value({}, ""), "")
+        ;
+        po::options_description all;
+        all.add(options).add(hidden);
+        po::positional_options_description positional;
+        positional.add("command", 1).add("files", -1);
+
+        try{
+                po::variables_map vm;
+                po::store(po::command_line_parser(argc, argv).options(all).positional(positional).run(), vm);
+                po::notify(vm);
+                if (vm.count("help")){
+                        std::cout << "usage: " << argv[0] << " [build|shard|merge|extend|qhat] [options] [shard files]\n\n"
+                                  << options << "\n"
+                                  << "Tables are split by cell range across processes or machines, e.g.\n"
+                                  << "  " << argv[0] << " shard --table XQq2Qq                  # prints the number of cells\n"
+                                  << "  " << argv[0] << " shard --table XQq2Qq --cells 0-4999 &\n"
+                                  << "  " << argv[0] << " shard --table XQq2Qq --cells 5000-9999 &\n"
+                                  << "  " << argv[0] << " merge --table XQq2Qq tables/XQq2Qq.cells-*.hdf5\n"
+                                  << "A rate table needs its merged cross section in the folder first.\n"
+                                  << "Existing tables are widened at their grid spacing, computing only the new cells:\n"
+                                  << "  " << argv[0] << " extend --table XQq2Qq --axis T --high 1.0\n"
+                                  << "  " << argv[0] << " extend --table RQq2Qq --axis T --high 1.0"
+                                  << std::endl;
+                        return 0;
                 }
-
-        }
-      
-*/
- 
-/*
-        for (int ipart = 0; ipart < npart; ++ipart)
-        {
-
-        particle HQ;
-        HQ.p = testHQ.p;
-        HQ.x = testHQ.x;
-
-        for (int itime = 0; itime < ntime; ++itime)
-        {
-                double *args = new double[4];
-                args[0] = HQ.p[0];
-                args[1] = temp;
-                args[2] = 0.0;
-                args[3] = 1;  drag_Qq = qhatQq2Qq.interpQ(args); drag_Qg = qhatQg2Qg.interpQ(args);
-                args[3] = 2;  kperp_Qq = qhatQq2Qq.interpQ(args); kperp_Qg = qhatQg2Qg.interpQ(args);
-                args[3] = 3;  kpara_Qq = qhatQq2Qq.interpQ(args); kpara_Qg = qhatQg2Qg.interpQ(args);
-
-                drag = (drag_Qq + drag_Qg)*5.068;
-                kperp = (kperp_Qq + kperp_Qg) * 5.068;
-                kpara = ((kpara_Qq - drag_Qq*drag_Qq) + (kpara_Qg - drag_Qg*drag_Qg)) * 5.068;
-
-                delete [] args;
-
-                update_by_Langevin(HQ, temp, drag, kpara, kperp, deltat, false);
-
-                if (itime % 100 == 0)
-                {
-                    int idx_t = itime/100;
-                    part_info[idx_t][ipart][0] = HQ.p[0];
-                    part_info[idx_t][ipart][1] = HQ.p[1];
-                    part_info[idx_t][ipart][2] = HQ.p[2];
-                    part_info[idx_t][ipart][3] = HQ.p[3];
+                initialize_mD_and_scale(vm["mD-type"].as<unsigned int>(), vm["scale"].as<double>());
+                if (vm.count("profile")) table_specs().set_profile(vm["profile"].as<std::string>());
+                if (vm.count("spec")) table_specs().read(vm["spec"].as<std::string>());
+                if (vm.count("cache")) table_options().cache_dir = vm["cache"].as<std::string>();
+                if (vm.count("cell-time-limit")) table_options().cell_time_limit = vm["cell-time-limit"].as<double>();
+                if (vm.count("fuse-channels")) table_options().fuse_channels = true;
+
+                std::string command = vm["command"].as<std::string>();
+                if (command == "build"){
+                        table_set tables(vm["mass"].as<double>(), vm["Nf"].as<size_t>(),
+                                         vm["folder"].as<std::string>(), true, true, true, vm.count("refresh") > 0);
+                        return 0;
                 }
+                if ((command == "shard" || command == "merge" || command == "extend") && !vm.count("table"))
+                        throw std::invalid_argument(command + " needs --table");
+                if (command == "shard") return run_shard(vm);
+                if (command == "merge") return run_merge(vm, vm["files"].as< std::vector<std::string> >());
+                if (command == "extend") return run_extend(vm);
+                if (command == "qhat") return run_qhat(vm);
+                throw std::invalid_argument("unknown command " + command);
         }
+        catch (const std::exception & e){
+                std::cerr << argv[0] << ": " << e.what() << std::endl;
+                return 1;
         }
-*/
-
-
-/*
-
-        H5::H5File* file = new H5::H5File("Event_static_EinRFalse_preIto.hdf5", H5F_ACC_TRUNC);
-        std::string datasetname("Langevin-events");
-        const size_t rank=3;
-        hsize_t dims[rank] = {NTau, npart, 4};
-        H5::DSetCreatPropList proplist{};
-        proplist.setChunk(rank, dims);
-
-        H5::DataSpace dataspace(rank, dims);
-        auto datatype(H5::PredType::NATIVE_DOUBLE);
-        H5::DataSet* dataset = new H5::DataSet( file->createDataSet(datasetname, datatype, dataspace, proplist) );
-        dataset->write(part_info.data(), datatype);
-
-        delete dataset;
-        delete file;
-*/
-
-        return 0;
 }
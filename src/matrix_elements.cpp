@@ -3,6 +3,7 @@
 
 #include "utility.h"
 #include "matrix_elements.h"
+#include "tabulation.h"
 
 #include <boost/math/tools/roots.hpp>
 
@@ -81,6 +82,9 @@ double Debye_mass::get_mD2(double T){
 void initialize_mD_and_scale(const unsigned int type, const double scale){
 	t_channel_mD2 = new Debye_mass(type);
 	renormalization_scale = scale;
+	// every table depends on both
+	table_inputs::set_global("mD_type", type);
+	table_inputs::set_global("scale", scale);
 	std::cout << "Scale = " << renormalization_scale << std::endl;
 }
 
@@ -186,20 +190,22 @@ double dX_Qg2Qg_dPS(double * PS, size_t n_dims, void * params){
 	return M2_Qg2Qg(t, params)/c16pi/std::pow(s-M2, 2);
 }
 
-/// Q + q --> Q + q + g
-double M2_Qq2Qqg(double * x_, size_t n_dims_, void * params_){
-	(void) n_dims_;
+/// Q + q(g) --> Q + q(g) + g without the elastic matrix element M2_elastic(t)
+/// and the LPM factor f_LPM(u), which is the only dependence on dt = params[3];
+/// the channels share everything else. t and u/dt are returned in t and
+/// u_per_dt, 0 outside of the phase space
+static double Q2Qg_kinematics(double * x_, double * params, double & t, double & u_per_dt){
+	t = 0.;
+	u_per_dt = 0.;
 	// unpack variables, parameters and check integration range
 	double phi4k = x_[3];
 	if ( phi4k <= -M_PI || phi4k >= M_PI) return 0.0;
-	double * params = static_cast<double*>(params_);
 	double s = params[0];
 	double sqrts = std::sqrt(s);
 	double T = params[1];
 	double M2 = params[2]*params[2];
 	double M2s = M2/s;
 	double sfactor = 1. - M2s;
-	double dt = params[3];
 	double pmax =  0.5*sqrts*sfactor;
 	double expx1 = std::exp(x_[0]);
 	double expmx2 = std::exp(-x_[1]);
@@ -236,92 +242,81 @@ double M2_Qq2Qqg(double * x_, size_t n_dims_, void * params_){
 	// mean-free-path \sim mean-free-time*v_HQ,
 	// v_HQ = p/E = (s - M^2)/(s + M^2)
 	// formation length = tau_k*v_k = tau_k
-	double u = dt/tauk*(s-M2)/(s+M2);
+	u_per_dt = 1./tauk*(s-M2)/(s+M2);
 
 	// 2->2
-	double t = -2.*pmax*p4*(1.+cos4);
-	double M2_elastic = M2_Qq2Qq_rad(t, params);
+	t = -2.*pmax*p4*(1.+cos4);
 
 	// 1->2
 	double iD1 = 1./basic_denominator,
 	       iD2 = 1./(basic_denominator - 2.*qx*kx  + qx*qx);
 	double Pg = alpha_rad*std::pow(one_minus_xbar, 2)
-				*f_LPM(u)
 				*(kt2*std::pow(iD1-iD2, 2.) + std::pow(qx*iD2,2) + 2.*kx*qx*iD2*(iD1-iD2));
 	// Jacobian
 	double J = (k+p4-pmax)*(pmax-p4-M2s*k)/sfactor*sin4*sin4;
 	// 2->3 = 2->2 * 1->2
-	return c48pi*M2_elastic*Pg*J;
+	return c48pi*Pg*J;
 }
 
+/// Q + q(g) --> Q + q(g) + g without the LPM factor
+static double M2_Q2Qg_no_LPM(double * x_, double * params, double (*M2_elastic_)(double, void *),
+							 double & u_per_dt){
+	double t, shared = Q2Qg_kinematics(x_, params, t, u_per_dt);
+	if (shared == 0.) return 0.;
+	return shared*M2_elastic_(t, params);
+}
 
-/// Q + g --> Q + g + g
-double M2_Qg2Qgg(double * x_, size_t n_dims_, void * params_){
+/// the same phase space point for all dt = params[4], ..., params[3+Ndt],
+/// Ndt = params[3]
+static void M2_Q2Qg_dt(double * x_, double * params, double (*M2_elastic_)(double, void *),
+					   double * values){
+	size_t Ndt = size_t(params[3]);
+	double u_per_dt, M2 = M2_Q2Qg_no_LPM(x_, params, M2_elastic_, u_per_dt);
+	for (size_t i=0; i<Ndt; i++) values[i] = M2*f_LPM(params[4+i]*u_per_dt);
+}
+
+/// Q + q --> Q + q + g
+double M2_Qq2Qqg(double * x_, size_t n_dims_, void * params_){
 	(void) n_dims_;
-	// unpack variables, parameters and check integration range
-	double phi4k = x_[3];
-	if ( phi4k <= -M_PI || phi4k >= M_PI) return 0.0;
 	double * params = static_cast<double*>(params_);
-	double s = params[0];
-	double sqrts = std::sqrt(s);
-	double T = params[1];
-	double M2 = params[2]*params[2];
-	double M2s = M2/s;
-	double sfactor = 1. - M2s;
-	double dt = params[3];
-	double pmax =  0.5*sqrts*sfactor;
-	double expx1 = std::exp(x_[0]);
-	double expmx2 = std::exp(-x_[1]);
-	double k = pmax*(expx1+expmx2)/sfactor;
-
-	/// prevent a soft emission less than mD in the CoM frame
-	/// If the emission is collinear, than it actually prevents an emission
-	/// in the local restframe with energy gamma*mD = E/M*mD
+	double u_per_dt, M2 = M2_Q2Qg_no_LPM(x_, params, &M2_Qq2Qq_rad, u_per_dt);
+	return M2*f_LPM(params[3]*u_per_dt);
+}
 
+void M2_Qq2Qqg_dt(double * x_, size_t n_dims_, void * params_, double * values){
+	(void) n_dims_;
+	M2_Q2Qg_dt(x_, static_cast<double*>(params_), &M2_Qq2Qq_rad, values);
+}
 
-		double p4 = pmax - pmax*(expx1*M2s+expmx2)/sfactor;
-		if ( p4 <= 0. || k <= 0. ||p4 >= pmax || k >= pmax ) return 0.0;
-		double cos4 = std::tanh(x_[2]);
-		double cos_star = ((s-M2)-2.*sqrts*(p4+k))/(2.*p4*k) +1.;
-		if ( cos_star <= -1. || 1. <= cos_star) return 0.0;
-		// more useful variables
-		double sin_star = std::sqrt(1. - cos_star*cos_star), sin4 = std::sqrt(1. - cos4*cos4);
-		double cos_4k = std::cos(phi4k), sin_4k = std::sin(phi4k);
-		// k-vec
-		double kx = k*(sin_star*cos_4k*cos4 + sin4*cos_star),
-			   ky = k*sin_star*sin_4k,
-			   kz = k*(-sin_star*cos_4k*sin4 + cos4*cos_star);
-		double kt2 = kx*kx + ky*ky;
-		double mD2 = t_channel_mD2->get_mD2(T);
-		double x = (k+kz)/sqrts, xbar = (k+std::abs(kz))/sqrts;
-		double one_minus_xbar = 1.-xbar;
-		double basic_denominator = kt2 + x*x*M2 + one_minus_xbar*mD2/2.;
-		double tauk = 2.*k*one_minus_xbar/basic_denominator;
-
-		// q-perp-vec
-		double qx = -p4*sin4;
-		double alpha_rad = alpha_s(kt2, T);
-
-		// here u is the ratio of the mean-free-path over the formation length
-		// mean-free-path \sim mean-free-time*v_HQ,
-		// v_HQ = p/E = (s - M^2)/(s + M^2)
-		// formation length = tau_k*v_k = tau_k
-		double u = dt/tauk*(s-M2)/(s+M2);
+/// Q + g --> Q + g + g
+double M2_Qg2Qgg(double * x_, size_t n_dims_, void * params_){
+	(void) n_dims_;
+	double * params = static_cast<double*>(params_);
+	double u_per_dt, M2 = M2_Q2Qg_no_LPM(x_, params, &M2_Qg2Qg_rad, u_per_dt);
+	return M2*f_LPM(params[3]*u_per_dt);
+}
 
-		// 2->2
-		double t = -2.*pmax*p4*(1.+cos4);
-		double M2_elastic = M2_Qg2Qg_rad(t, params);
+void M2_Qg2Qgg_dt(double * x_, size_t n_dims_, void * params_, double * values){
+	(void) n_dims_;
+	M2_Q2Qg_dt(x_, static_cast<double*>(params_), &M2_Qg2Qg_rad, values);
+}
 
-		// 1->2
-		double iD1 = 1./basic_denominator,
-			   iD2 = 1./(basic_denominator - 2.*qx*kx  + qx*qx);
-		double Pg = alpha_rad*std::pow(one_minus_xbar, 2)
-					*f_LPM(u)
-					*(kt2*std::pow(iD1-iD2, 2.) + std::pow(qx*iD2,2) + 2.*kx*qx*iD2*(iD1-iD2));
-		// Jacobian
-		double J = (k+p4-pmax)*(pmax-p4-M2s*k)/sfactor*sin4*sin4;
-		// 2->3 = 2->2 * 1->2
-		return c48pi*M2_elastic*Pg*J;
+/// Q + q --> Q + q + g and Q + g --> Q + g + g from the same kinematics
+void M2_Q2Qg_channels_dt(double * x_, size_t n_dims_, void * params_, double * values){
+	(void) n_dims_;
+	double * params = static_cast<double*>(params_);
+	size_t Ndt = size_t(params[3]);
+	double t, u_per_dt, shared = Q2Qg_kinematics(x_, params, t, u_per_dt);
+	double M2_q = 0., M2_g = 0.;
+	if (shared != 0.){
+		M2_q = shared*M2_Qq2Qq_rad(t, params);
+		M2_g = shared*M2_Qg2Qg_rad(t, params);
+	}
+	for (size_t i=0; i<Ndt; i++){
+		double LPM = f_LPM(params[4+i]*u_per_dt);
+		values[i] = M2_q*LPM;
+		values[Ndt+i] = M2_g*LPM;
+	}
 }
 
 
@@ -36,8 +36,14 @@ double dqhat_Qg2Qg_dPS(double* PS, size_t ndims, void* params);
 
 //=============Baisc function for Q+q --> Q+q+g==================================
 double M2_Qq2Qqg(double * x_, size_t n_dims_, void * params_);
+// all dt at once: params = {s, T, M, Ndt, dt_0, ..., dt_Ndt-1}, Ndt values
+void M2_Qq2Qqg_dt(double * x_, size_t n_dims_, void * params_, double * values);
 //=============Baisc function for Q+g --> Q+g+g==================================
 double M2_Qg2Qgg(double * x_, size_t n_dims_, void * params_);
+void M2_Qg2Qgg_dt(double * x_, size_t n_dims_, void * params_, double * values);
+// both channels at once, they only differ by the elastic matrix element:
+// params as for M2_Qq2Qqg_dt, 2*Ndt values, the Ndt of Q+q->Q+q+g first
+void M2_Q2Qg_channels_dt(double * x_, size_t n_dims_, void * params_, double * values);
 
 //=============Baisc function for Q+q+g --> Q+q==================================
 double Ker_Qqg2Qq(double * x_, size_t n_dims_, void * params_);
@@ -1,23 +1,23 @@
 #include <cmath>
 #include <vector>
-#include <thread>
 #include <fstream>
 #include <string>
 
-#include <boost/filesystem.hpp>
 #include <gsl/gsl_errno.h>
 
 #include "utility.h"
+#include "integration.h"
+#include "table_spec.h"
 #include "qhat.h"
+#include "tabulation.h"
 #include "TLorentz.h"
 #include "H5Cpp.h"
 
-using std::placeholders::_1;
 using std::vector;
 
-vector<double> transform_from_CoM_array2(double *args)
+void transform_from_CoM_array2(const double *args, double *botMatrix)
 // args ={sqrts, M2, E1, E2, cos_theta12}
-// return Boost*Rotation([1][1], [1][3], [3][1], [3][3])
+// botMatrix = Boost*Rotation([1][1], [1][3], [3][1], [3][3])
 {
         double sqrts = args[0];
         double M2 = args[1];
@@ -45,7 +45,6 @@ vector<double> transform_from_CoM_array2(double *args)
         //std::cout << cosTheta13 << std::endl;
         double sinTheta13 = std::sqrt(1. - cosTheta13 * cosTheta13);
 
-        vector<double> botMatrix(4);
         double gammaBetaxx = gamma2*betax*betax;
         double gammaBetaxz = gamma2*betax*betaz;
         double gammaBetazz = gamma2*betaz*betaz;
@@ -57,7 +56,6 @@ vector<double> transform_from_CoM_array2(double *args)
         botMatrix[2] = gammaBetaxz *cosTheta13 + (1. + gammaBetazz) * sinTheta13 ;
         botMatrix[3] = - gammaBetaxz*sinTheta13 + (1. + gammaBetazz) * cosTheta13 ;
         //std::cout << "transform: " << botMatrix[0] << " " << botMatrix[1] << " " << botMatrix[2] << " " << botMatrix[3] << std::endl;
-        return botMatrix;
 }
 
 
@@ -89,31 +87,38 @@ double viscosgn(double costheta, int n)
 
 
 
-double fy_wrapper22_YX(double y, void *params_)
+// the parameters of the qhat integrands, x = E2/T and y = cos(theta2)
+struct qhat_params
 {
-        integrate_params_2_YX *params = static_cast<integrate_params_2_YX *>(params_);
-        double coeff = params->params[0]; // coeff = 2*E1*E2;
-        double Temp = params->params[1];
-        double M2 = params->params[2];
-        double v1 = params->params[3];
-        double E1 = params->params[4];
-        int qidx = int(params->params[5] + 0.5);
+        double E1, v1, Temp, M2, zeta;
+        int qidx;
+};
+
+// Xsection(args) with args = {s, T, index} calls QhatXsection_2to2::interpX
+template <typename Xsection>
+double fy_wrapper22_YX(double y, double coeff, const qhat_params & p, Xsection & Xsection_)
+{
+        // coeff = 2*E1*E2
+        double Temp = p.Temp;
+        double M2 = p.M2;
+        double v1 = p.v1;
+        double E1 = p.E1;
+        int qidx = p.qidx;
 
         double s = M2 + coeff * (1. - v1*y);
-        double *args = new double[3];
+        double args[3];
         args[0] = s; args[1] = Temp;
-        //args[2] = 0; double QhatXsection_q1 = params->f(args);
-        args[2] = 1; double QhatXsection_q3 = params->f(args);
-        args[2] = 2; double QhatXsection_q11 = params->f(args);
-        args[2] = 3; double QhatXsection_q33 = params->f(args);
-        //args[2] = 4; double QhatXsection_q13 = params->f(args);
-        delete [] args;
+        //args[2] = 0; double QhatXsection_q1 = Xsection_(args);
+        args[2] = 1; double QhatXsection_q3 = Xsection_(args);
+        args[2] = 2; double QhatXsection_q11 = Xsection_(args);
+        args[2] = 3; double QhatXsection_q33 = Xsection_(args);
+        //args[2] = 4; double QhatXsection_q13 = Xsection_(args);
 
         double E2 = coeff/(2.*E1);
-        double* args_ = new double[5];
+        double args_[5];
         args_[0] = std::sqrt(s); args_[1] = M2; args_[2] = E1; args_[3] = E2; args_[4] = y;
-        vector<double> botMatrix = transform_from_CoM_array2(args_); // [1][1], [1][3], [3][1], [3][3]
-        delete[] args_;
+        double botMatrix[4];
+        transform_from_CoM_array2(args_, botMatrix); // [1][1], [1][3], [3][1], [3][3]
 
         /*
         double Qhat_q1cell = botMatrix[0]*QhatXsection_q1 + botMatrix[1]*QhatXsection_q3;
@@ -140,55 +145,19 @@ double fy_wrapper22_YX(double y, void *params_)
 
 
 
-double fx_wrapper22_YX(double x, void *px_)
+template <typename Xsection>
+double fx_wrapper22_YX(double x, const qhat_params & p, Xsection & Xsection_)
 {
-        integrate_params_2_YX * px = static_cast<integrate_params_2_YX *>(px_);
-        double E1 = px->params[0];
-        double v1 = px->params[1];
-        double Temp = px->params[2];
-        double M2 = px->params[3];
-        double zeta = px->params[4];
-
-        int qidx = int(px->params[5]);
-
-
-        {
         double result, error, ymin, ymax;
-        gsl_integration_workspace *w = gsl_integration_workspace_alloc(10000);
-        gsl_error_handler_t * old_handler = gsl_set_error_handler_off();
-        integrate_params_2_YX* py = new integrate_params_2_YX;
-        py->f = px->f;
-        py->params = new double[7];
-        py->params[0] = 2.*E1*x*Temp;
-        py->params[1] = Temp;
-        py->params[2] = M2;
-        py->params[3] = v1;
-        py->params[4] = E1;
-        py->params[5] = qidx;
-
-        gsl_function F;
-        F.function = fy_wrapper22_YX;
-        F.params = py;
+        double coeff = 2.*p.E1*x*p.Temp;
+        auto fy = [&](double y){return fy_wrapper22_YX(y, coeff, p, Xsection_);};
+        gsl_function F = make_gsl_function(fy);
         ymax = 1.;
         ymin = -1.;
-        int status = 1, nloop = 0;
-
-        while(status && nloop < 5)
-        {
-                status = gsl_integration_qag(&F, ymin, ymax, 0, 1e-3, 10000,6, w, &result, &error);
-                nloop += 1;
-        }
-
-
-        delete [] py->params;
-        delete py;
-       
-        gsl_set_error_handler(old_handler);
-        gsl_integration_workspace_free(w);
-       
-        return x*x*f0(x, zeta)*result;
-       }
+        // failures are retried by the tabulation driver with raised limits
+        result = qag_integrate(&F, ymin, ymax, 0, table_specs().epsrel(1e-3), 10000, 6, &error);
 
+        return x*x*f0(x, p.zeta)*result;
 }
 
 
@@ -207,39 +176,15 @@ Qhat::Qhat(std::string name_)
 Qhat_2to2::Qhat_2to2(QhatXsection_2to2 * Xprocess_, int degeneracy_, double eta_2_, std::string name_, bool refresh)
 :  Qhat(name_), Xprocess(Xprocess_), M(Xprocess->get_M1()),
    degeneracy(degeneracy_), eta_2(eta_2_),
-   NE(50), NT(10), E1L(M*1.01), E1M(M*20), E1H(M*100), TL(0.15), TH(0.60),
+   NE(table_specs().points("Qhat_2to2.N_E1_half", 50)), NT(table_specs().points("Qhat_2to2.N_T", 10)),
+   E1L(table_specs().value("Qhat_2to2.E1_low", M*1.01)), E1M(table_specs().value("Qhat_2to2.E1_mid", M*20)),
+   E1H(table_specs().value("Qhat_2to2.E1_high", M*100)),
+   TL(table_specs().value("Qhat_2to2.T_low", 0.15)), TH(table_specs().value("Qhat_2to2.T_high", 0.60)),
    dE1((E1M - E1L)/(NE -1.)), dE2((E1H - E1M)/(NE -1.)),
    dT((TH - TL)/(NT -1.)),
-   QhatTab(boost::extents[4][2*NE][NT])
+   QhatTab({grid_axis({E1L, E1M, E1H}, {NE, NE}), grid_axis(TL, TH, NT)}, 3)
 {
-        bool fileexist = boost::filesystem::exists(name_);
-        if ((!fileexist) || (fileexist && refresh))
-        {
-                std::cout << "Populating table with new calculation" << std::endl;
-                std::vector<std::thread> threads;
-                size_t Ncores = std::min(size_t(std::thread::hardware_concurrency()), NT);
-                    
-                size_t call_per_core = int(NT*1./Ncores);
-                size_t call_for_last_core = NT - call_per_core*(Ncores -1);
-                //std::cout << Ncores << " " << call_per_core <<  " " << call_for_last_core << std::endl;
-                for (size_t i=0; i< Ncores; i++)
-                {
-                        size_t Nstart = i*call_per_core;
-                        size_t dN = (i==Ncores-1) ? call_for_last_core : call_per_core;
-                        auto code = [this](size_t NTstart_, size_t dNT_) {this->tabulate_E1_T(NTstart_, dNT_);};
-                        threads.push_back(std::thread(code, Nstart, dN));
-                }
-
-                for (std::thread& t: threads) t.join();
-
-                
-                save_to_file(name_, "Qhat-tab");
-        }
-        else
-        {
-                std::cout << "loading existing table " << std::endl;
-                read_from_file(name_, "Qhat-tab");
-        }
+        load_or_tabulate(name_, "Qhat-tab", refresh);
         std::cout << std::endl;
 }
 
@@ -247,6 +192,7 @@ Qhat_2to2::Qhat_2to2(QhatXsection_2to2 * Xprocess_, int degeneracy_, double eta_
 
 void Qhat_2to2::save_to_file(std::string filename, std::string datasetname)
 {
+		std::lock_guard<std::mutex> lock(hdf5_mutex());
 		H5::H5File file(filename.c_str(), H5F_ACC_TRUNC);
         const size_t rank=3;
         hsize_t dims[rank] = {3, 2*NE, NT};
@@ -273,6 +219,7 @@ void Qhat_2to2::save_to_file(std::string filename, std::string datasetname)
 
 void Qhat_2to2::read_from_file(std::string  filename, std::string datasetname)
 {
+		std::lock_guard<std::mutex> lock(hdf5_mutex());
 		H5::H5File file(filename.c_str(), H5F_ACC_RDONLY);
         const size_t rank=3;
         H5::DataSet dataset = file.openDataSet(datasetname.c_str());
@@ -288,7 +235,7 @@ void Qhat_2to2::read_from_file(std::string  filename, std::string datasetname)
         hdf5_read_scalar_attr(dataset, "N_T", NT);
         dT = (TH - TL)/(NT -1.);
 
-        QhatTab.resize(boost::extents[3][2*NE][NT]);
+        QhatTab.reset({grid_axis({E1L, E1M, E1H}, {NE, NE}), grid_axis(TL, TH, NT)}, 3);
 
         hsize_t dims_mem[rank];
         dims_mem[0] = 3;
@@ -302,30 +249,32 @@ void Qhat_2to2::read_from_file(std::string  filename, std::string datasetname)
 		file.close();
 }
 
+void Qhat_2to2::describe_inputs(table_inputs & inputs)
+{
+        inputs.add("M", M);
+        inputs.add("degeneracy", degeneracy);
+        inputs.add("eta_2", eta_2);
+        inputs.add("xsection", Xprocess->input_physics_hash());
+        inputs.add_axis("E1_lower", E1L, E1M, NE);
+        inputs.add_axis("E1_upper", E1M, E1H, NE);
+        inputs.add_axis("T", TL, TH, NT);
+}
+
 
-void Qhat_2to2::tabulate_E1_T(size_t T_start, size_t dnT)
+void Qhat_2to2::tabulate_E1_T(size_t cell, double * result)
 {
-        double *args = new double[3];
-        for (size_t i=0; i < 2*NE; ++i)
-        {
-        	if (i < NE) args[0] = E1L + i * dE1;
-		else args[0] = E1M + (i-NE)*dE2;
-                for (size_t j = T_start; j < (T_start + dnT) ; ++j)
-                {
-                        args[1] = TL + j * dT;
-                        args[2] = 1; double drag = calculate(args); // dpz/dt
-                        args[2] = 2; double kperp = calculate(args); // dpx^2/dt
-                        args[2] = 3; double kpara = calculate(args); // dpz^2/dt
-						args[2] = 5; double R = calculate(args); // 1/dt
-                        QhatTab[0][i][j] = drag;
-                        QhatTab[1][i][j] = kperp;
-                        QhatTab[2][i][j] = kpara - drag*drag/R;
-                        //if (i == 0) std::cout << i <<  " " << j <<" " <<  TL << " " << dT << " " << args[0] << " " << args[1] << " " << QhatTab[0][i][j] << " "<< QhatTab[1][i][j] << " " << QhatTab[2][i][j] << std::endl;
-                           
-                }
-        }
-        
-        delete [] args;
+        size_t i = cell/NT, j = cell%NT;
+        double args[3];
+        if (i < NE) args[0] = E1L + i * dE1;
+        else args[0] = E1M + (i-NE)*dE2;
+        args[1] = TL + j * dT;
+        args[2] = 1; double drag = calculate(args); // dpz/dt
+        args[2] = 2; double kperp = calculate(args); // dpx^2/dt
+        args[2] = 3; double kpara = calculate(args); // dpz^2/dt
+        args[2] = 5; double R = calculate(args); // 1/dt
+        result[0] = drag;
+        result[1] = kperp;
+        result[2] = kpara - drag*drag/R;
 }
 
 
@@ -333,25 +282,11 @@ void Qhat_2to2::tabulate_E1_T(size_t T_start, size_t dnT)
 
 double Qhat_2to2::interpQ(double * args)
 {
-        double E1 = args[0], Temp = args[1];
         int qidx = int(args[2]);
-
-        if (Temp < TL) Temp = TL;
-        if (Temp >= TH) Temp = TH - dT;
-        if (E1 < E1L) E1 = E1L;
-        if (E1 > E1H) E1  = E1H - dE1;
-
-        double xT, rT, xE, rE, dE, Emin;
-        size_t iT, iE, Noffset;
-	if (E1 < E1M)
-	{dE=dE1; Emin = E1L; Noffset = 0;}
-	else
-	{dE=dE2; Emin = E1M; Noffset =NE;}
-
-        xT = (Temp - TL)/dT;    iT = floor(xT);     rT = xT - iT;
-        xE = (E1 - Emin)/dE;    iE = floor(xE);     rE = xE - iE; iE += Noffset;
-
-        return interpolate2d_YX(&QhatTab, qidx, iE, iT, rE, rT); 
+        grid_point<2> p;
+        QhatTab.locate(args, p);
+        require_cells({p.index[0], p.index[1]});
+        return QhatTab.interpolate(p, size_t(qidx));
 }
 
 
@@ -364,35 +299,15 @@ double Qhat_2to2::calculate(double *args)
         double p1 = std::sqrt(E1*E1 - M*M);
         double result, error, xmin, xmax;
 
-        gsl_error_handler_t * old_handler = gsl_set_error_handler_off();
-
-        gsl_integration_workspace * w = gsl_integration_workspace_alloc(5000);
-        integrate_params_2_YX * px = new integrate_params_2_YX;
-        px->f = std::bind(&QhatXsection_2to2::interpX, Xprocess, _1);
-        px->params = new double[6];
-        px->params[0] = E1;
-        px->params[1] = p1/E1;
-        px->params[2] = Temp;
-        px->params[3] = M*M;
-        px->params[4] = eta_2;
-        px->params[5] = qidx;
-
-        gsl_function F;
-        F.function = fx_wrapper22_YX;
-        F.params=px;
+        qhat_params p = {E1, p1/E1, Temp, M*M, eta_2, qidx};
+        QhatXsection_2to2 * X = Xprocess;
+        auto Xsection_ = [X](double *Xargs){return X->interpX(Xargs);};
+        auto fx = [&](double x){return fx_wrapper22_YX(x, p, Xsection_);};
+        gsl_function F = make_gsl_function(fx);
         xmax = 10.0;
         xmin = 0.0;
-        int status = 1, nloop = 0;
-        while(status && nloop < 5)
-        {
-        status = gsl_integration_qag(&F, xmin, xmax, 0, 1e-3, 5000, 6, w, &result, &error);
-        nloop += 1;
-        }
-
-        gsl_set_error_handler(old_handler);
-        gsl_integration_workspace_free(w);
-        delete [] px->params;
-        delete px;
+        result = qag_integrate(&F, xmin, xmax, 0, table_specs().epsrel(1e-3), 5000, 6, &error);
+
         //if ((E1-1.313)<0.001 && (Temp-0.13)<0.001 && iweight==0) std::cout << "qhat calculate: " << E1 << " " << Temp << " " <<result << std::endl;
         return result*std::pow(Temp, 3)*4 / c16pi2 * degeneracy;
 }
@@ -2,31 +2,20 @@
 #define QHAT_H
 
 #include <iostream>
-#include <functional>
 #include <vector>
 #include <string>
 
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_integration.h>
 
-#include <boost/multi_array.hpp>
-
-
 #include "qhat_Xsection.h"
 
-struct integrate_params_2_YX
-{
-        std::function<double(double*)> f;
-        double *params;
-};
-
-
-class Qhat
+class Qhat: public tabulated_table
 {
 protected:
-        virtual void tabulate_E1_T(size_t T_start, size_t dnT) = 0;
-        virtual void save_to_file(std::string filename, std::string datasetname) = 0;
-        virtual void read_from_file(std::string filename, std::string datasetname) = 0;
+        // compute all coefficients of a single (E1, T) cell
+        virtual void tabulate_E1_T(size_t cell, double * result) = 0;
+        void tabulate_cell(size_t cell, double * result) {tabulate_E1_T(cell, result);};
 
 public:
         Qhat(std::string name_);
@@ -44,13 +33,22 @@ private:
         const double eta_2;
         size_t NE, NT;
         double E1L, E1M, E1H, TL, TH, dE1, dE2, dT;
-        boost::multi_array<double, 3> QhatTab;
-        void tabulate_E1_T(size_t T_start, size_t dnT);
+        // drag, kperp and kpara are three components of each (E1, T) cell,
+        // E1 has two uniform segments
+        grid_table<2> QhatTab;
+        std::vector<size_t> table_shape(void) {return {2*NE, NT};};
+        size_t table_components(void) {return 3;};
+        double * table_data(void) {return QhatTab.data();};
+        // E1 has two spacings, only T can be extended
+        std::vector<table_axis> table_axes(void) {return {{"T", 1, "T_low", "T_high", "N_T"}};};
+        void describe_inputs(table_inputs & inputs);
+        void tabulate_E1_T(size_t cell, double * result);
         void save_to_file(std::string filename, std::string datasetname);
         void read_from_file(std::string filename, std::string datasetname);
 
 public:
         Qhat_2to2(QhatXsection_2to2 * Xprocess_, int degeneracy_, double eta_2_, std::string name_, bool refresh);
+        ~Qhat_2to2(){persist_lazy_cells();};
         double calculate(double *args);
         double interpQ(double *args);
 };
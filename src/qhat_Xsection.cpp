@@ -1,17 +1,18 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
-#include <thread>
 #include <vector>
 #include <string>
 
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_integration.h>
 
-#include <boost/filesystem.hpp>
 
 #include "utility.h"
+#include "integration.h"
+#include "table_spec.h"
 #include "qhat_Xsection.h"
+#include "tabulation.h"
 
 
 double gsl_1dfunc_wrapper_YX(double x, void *params_)
@@ -38,35 +39,15 @@ QhatXsection::QhatXsection(double (*dXdPS_)(double* , size_t, void*), double M1_
 // ==== derived 2->2 QhatXsection class ========
 QhatXsection_2to2::QhatXsection_2to2(double (*dXdPS_)(double*, size_t, void*), double M1_, std::string name_, bool refresh)
 :    QhatXsection(dXdPS_, M1_, name_, refresh),
-     Nsqrts(50), NT(32),
-     sqrtsL(M1_*1.01), sqrtsM(M1_*5.), sqrtsH(M1_*40.),
+     Nsqrts(table_specs().points("QhatXsection_2to2.N_sqrt_half", 50)), NT(table_specs().points("QhatXsection_2to2.N_T", 32)),
+     sqrtsL(table_specs().value("QhatXsection_2to2.sqrts_low", M1_*1.01)), sqrtsM(table_specs().value("QhatXsection_2to2.sqrts_mid", M1_*5.)),
+     sqrtsH(table_specs().value("QhatXsection_2to2.sqrts_high", M1_*40.)),
      dsqrts1((sqrtsM-sqrtsL)/(Nsqrts-1.)), dsqrts2((sqrtsH - sqrtsM)/(Nsqrts - 1.)),
-     TL(0.12), TH(0.8), dT((TH-TL)/(NT-1.)),
-     QhatXtab(boost::extents[6][Nsqrts*2][NT])
+     TL(table_specs().value("QhatXsection_2to2.T_low", 0.12)), TH(table_specs().value("QhatXsection_2to2.T_high", 0.8)),
+     dT((TH-TL)/(NT-1.)),
+     QhatXtab({grid_axis({sqrtsL, sqrtsM, sqrtsH}, {Nsqrts, Nsqrts}), grid_axis(TL, TH, NT)}, 6)
 {
-        bool fileexist = boost::filesystem::exists(name_);
-        if ( (!fileexist) || (fileexist && refresh))
-        {
-                std::cout << "Populating table with new calculation" << std::endl;
-                std::vector<std::thread> threads;
-                size_t Ncores = std::min(size_t(std::thread::hardware_concurrency()), NT);
-                size_t call_per_core = size_t(NT*1./Ncores);
-                size_t call_for_last_core = NT - call_per_core * (Ncores- 1);
-                auto code = [this](size_t NTstart_, size_t dNT_) {this->tabulate(NTstart_, dNT_);};
-		for (size_t i=0; i < Ncores; i++)
-                {
-                        size_t Nstart = i * call_per_core;
-                        size_t dN = (i==Ncores -1) ? call_for_last_core : call_per_core;
-                        threads.push_back(std::thread(code, Nstart, dN));
-                }
-                for (std::thread& t: threads) t.join();
-                save_to_file(name_, "QhatXsection-tab");
-        }
-        else
-        {
-                std::cout << "loading existing table" << std::endl;
-                read_from_file(name_, "QhatXsection-tab");
-        }
+        load_or_tabulate(name_, "QhatXsection-tab", refresh);
         std::cout << std::endl;
 }
 
@@ -77,6 +58,7 @@ QhatXsection_2to2::QhatXsection_2to2(double (*dXdPS_)(double*, size_t, void*), d
 void QhatXsection_2to2::save_to_file(std::string filename, std::string datasetname)
 {
         const size_t rank = 3;
+        std::lock_guard<std::mutex> lock(hdf5_mutex());
         H5::H5File file(filename.c_str(), H5F_ACC_TRUNC);
         hsize_t dims[rank] = {6,Nsqrts*2, NT};
         H5::DSetCreatPropList proplist{};
@@ -103,6 +85,7 @@ void QhatXsection_2to2::save_to_file(std::string filename, std::string datasetna
 void QhatXsection_2to2::read_from_file(std::string filename, std::string datasetname)
 {
         const size_t rank=3;
+        std::lock_guard<std::mutex> lock(hdf5_mutex());
         H5::H5File file(filename.c_str(), H5F_ACC_RDONLY);
         H5::DataSet dataset = file.openDataSet(datasetname.c_str());
         hdf5_read_scalar_attr(dataset, "sqrts_low", sqrtsL);
@@ -117,7 +100,7 @@ void QhatXsection_2to2::read_from_file(std::string filename, std::string dataset
         hdf5_read_scalar_attr(dataset, "N_T", NT);
         dT = (TH - TL)/ (NT-1.);
 
-        QhatXtab.resize(boost::extents[6][Nsqrts*2][NT]);
+        QhatXtab.reset({grid_axis({sqrtsL, sqrtsM, sqrtsH}, {Nsqrts, Nsqrts}), grid_axis(TL, TH, NT)}, 6);
         hsize_t dims_mem[rank];
         dims_mem[0] = 6;
         dims_mem[1] = 2*Nsqrts;
@@ -129,25 +112,23 @@ void QhatXsection_2to2::read_from_file(std::string filename, std::string dataset
         //std::cout << "Read in QhatXtab successfully :)" << std::endl;
 }
 
-void QhatXsection_2to2::tabulate(size_t T_start, size_t dnT)
+void QhatXsection_2to2::describe_inputs(table_inputs & inputs)
 {
-        double *args = new double[3];
-        for (size_t index = 0; index < 6; ++index)
-        {
-                args[2] = index;
-                for (size_t i=0; i<2*Nsqrts; ++i)
-                {
-                        if (i < Nsqrts) args[0] = std::pow(sqrtsL + i*dsqrts1, 2);
-                        else args[0] = std::pow(sqrtsM + (i - Nsqrts) * dsqrts2, 2);
-                        for (size_t j = T_start; j < (T_start + dnT); j++)
-                        {
-                                args[1] = TL + j*dT;
-                                QhatXtab[index][i][j] = calculate(args)/approx_QhatX22(args, M1);
-                                //QhatXtab[index][i][j] = calculate(args);
-                        }
-                }
-        }
-        delete [] args;
+        inputs.add("M", M1);
+        inputs.add_axis("sqrts_lower", sqrtsL, sqrtsM, Nsqrts);
+        inputs.add_axis("sqrts_upper", sqrtsM, sqrtsH, Nsqrts);
+        inputs.add_axis("T", TL, TH, NT);
+}
+
+double QhatXsection_2to2::tabulate(size_t cell)
+{
+        size_t index = cell/(2*Nsqrts*NT), i = (cell/NT)%(2*Nsqrts), j = cell%NT;
+        double args[3];
+        args[2] = index;
+        if (i < Nsqrts) args[0] = std::pow(sqrtsL + i*dsqrts1, 2);
+        else args[0] = std::pow(sqrtsM + (i - Nsqrts) * dsqrts2, 2);
+        args[1] = TL + j*dT;
+        return calculate(args)/approx_QhatX22(args, M1);
 }
 
 
@@ -156,27 +137,14 @@ void QhatXsection_2to2::tabulate(size_t T_start, size_t dnT)
 
 double QhatXsection_2to2::interpX(double* args)
 {
-        double sqrts = std::sqrt(args[0]), Temp = args[1];
+        double x[2] = {std::sqrt(args[0]), args[1]};
         int index = static_cast<int>(args[2]); //floor double into integer
 
-        if (Temp < TL) Temp = TL;
-        if (Temp >= TH) Temp = TH - dT;
-        if (sqrts < sqrtsL) sqrts = sqrtsL;
-        if (sqrts >= sqrtsH) sqrts = sqrtsH - dsqrts2;
-
-        double xT, rT, xsqrts, rsqrts, dsqrts, sqrtsmin;
-        size_t iT, isqrts, Noffsets;
-        if (sqrts < sqrtsM)
-        {dsqrts = dsqrts1; sqrtsmin = sqrtsL; Noffsets = 0;}
-        else
-        {dsqrts = dsqrts2; sqrtsmin = sqrtsM; Noffsets = Nsqrts;}
-
-        xsqrts = (sqrts - sqrtsmin)/dsqrts; isqrts = floor(xsqrts);  rsqrts = xsqrts-isqrts; isqrts += Noffsets;
-        xT = (Temp - TL)/dT; iT = floor(xT);  rT = xT-iT;
+        grid_point<2> p;
+        QhatXtab.locate(x, p);
 
-//        std::cout << "interpX: "<< iT << " " << isqrts <<" " << interpolate2d_YX(&QhatXtab, index, isqrts, iT, rsqrts, rT) <<std::endl;
-        return approx_QhatX22(args, M1) * interpolate2d_YX(&QhatXtab, index, isqrts, iT, rsqrts, rT);
-//        return interpolate2d_YX(&QhatXtab, index, isqrts, iT, rsqrts, rT);
+        require_cells({size_t(index), p.index[0], p.index[1]}, {1, 2, 2});
+        return approx_QhatX22(args, M1) * QhatXtab.interpolate(p, size_t(index));
 }
 
 
@@ -186,7 +154,6 @@ double QhatXsection_2to2::calculate(double* args)
         int index = static_cast<int>(args[2]);  // floor double into integer
 
         double result, error, tmin, tmax;
-        gsl_integration_workspace *w = gsl_integration_workspace_alloc(5000);
         YXgsl_integration_params * params = new YXgsl_integration_params;
         params->f = dXdPS;
         double* p = new double[4];
@@ -202,11 +169,10 @@ double QhatXsection_2to2::calculate(double* args)
         F.params = params;
         tmax = 0.0;
         tmin = -pow(s-M1*M1,2)/s;
-        gsl_integration_qag(&F, tmin, tmax, 0, 1e-4, 5000, 6, w, &result, &error);
+        result = qag_integrate(&F, tmin, tmax, 0, table_specs().epsrel(1e-4), 5000, 6, &error);
         
         delete [] p;
         delete params;
-        gsl_integration_workspace_free(w);
 
         return result;
 
@@ -5,7 +5,8 @@
 #include <vector>
 #include <string>
 #include <random>
-#include <boost/multi_array.hpp>
+#include "tabulation.h"
+#include "grid_table.h"
 
 
 struct YXgsl_integration_params
@@ -17,12 +18,12 @@ struct YXgsl_integration_params
 
 
 //==== qhat_Xsection base class
-class QhatXsection
+class QhatXsection: public tabulated_table
 {
 protected:
-        virtual void tabulate(size_t T_start, size_t dnT) = 0;
-        virtual void save_to_file(std::string filename, std::string datasetname) = 0;
-        virtual void read_from_file(std::string filename, std::string datasetname) =0;
+        // compute a single cell, given by its flat index into the table
+        virtual double tabulate(size_t cell) = 0;
+        void tabulate_cell(size_t cell, double * result) {*result = tabulate(cell);};
         double (*dXdPS)(double * PS, size_t ndims, void* params);
         double M1;
 public:
@@ -42,15 +43,22 @@ public:
 class QhatXsection_2to2: public QhatXsection
 {
 private:
-        void tabulate(size_t T_start, size_t dnT);
+        double tabulate(size_t cell);
         void save_to_file(std::string filename, std::string datasetname);
         void read_from_file(std::string filename, std::string datasetname);
         size_t Nsqrts, NT;
         double sqrtsL, sqrtsM, sqrtsH, dsqrts1, dsqrts2, 
                 TL, TH, dT;
-        boost::multi_array<double, 3> QhatXtab;
+        // the 6 components of the coefficients, sqrts has two uniform segments
+        grid_table<2> QhatXtab;
+        std::vector<size_t> table_shape(void) {return {6, 2*Nsqrts, NT};};
+        double * table_data(void) {return QhatXtab.data();};
+        // sqrts has two spacings, only T can be extended
+        std::vector<table_axis> table_axes(void) {return {{"T", 2, "T_low", "T_high", "N_T"}};};
+        void describe_inputs(table_inputs & inputs);
 public:
         QhatXsection_2to2(double (*dXdPS_)(double*, size_t, void*), double M1_, std::string name_, bool refresh);
+        ~QhatXsection_2to2(){persist_lazy_cells();};
         double interpX(double *args);
         double calculate(double *args);
 };
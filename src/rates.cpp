@@ -1,16 +1,19 @@
 #include <cmath>
+#include <algorithm>
+#include <array>
 #include <vector>
-#include <thread>
 #include <fstream>
+#include <stdexcept>
 #include <string>
 
-#include <boost/filesystem.hpp>
 
 #include "utility.h"
+#include "integration.h"
+#include "table_spec.h"
 #include "matrix_elements.h"
 #include "rates.h"
+#include "tabulation.h"
 #include "H5Cpp.h"
-using std::placeholders::_1;
 extern Debye_mass * t_channel_mD2;
 //=============Thernalized Distribution funtion=================================
 // xi = 1: Fermi Dirac; xi = -1 Bose Einsterin; xi = 0, Maxwell-Boltzmann
@@ -45,108 +48,87 @@ double approx_R32(double * arg){
 	return u/(1.+u)*T;
 }
 
-double fy_wrapper22(double y, void * params_){
-	// unpack Vegas params
-	integrate_params_2 * params = static_cast<integrate_params_2 *>(params_);
-	double coeff = params->params[0];
-	double Temp = params->params[1];
-	double M2 = params->params[2];
-	double v1 = params->params[3];
-	double s = M2 + coeff*(1.-v1*y);
+// the parameters shared by the rate integrands, x = E2/T and y = cos(theta2)
+struct rate_params{
+	double E1, v1, Temp, M2, zeta;
+};
+
+// the integrands take the cross section as a function object sigma(arg),
+// arg = {s, T[, dt]}, which calls the interpX of the process
+template <typename Xsection>
+double fy_wrapper22(double y, double coeff, const rate_params & p, Xsection & sigma){
 	double arg[2];
-	arg[0] = s; arg[1] = Temp;
-	double Xsection = params->f(arg);
-	return (1.-v1*y)*Xsection;
-}
-
-double fx_wrapper22(double x, void * px_){
-	integrate_params_2 * px = static_cast<integrate_params_2 *>(px_);
-	double E1 = px->params[0];
-	double v1 = px->params[1];
-	double Temp = px->params[2];
-	double M2 = px->params[3];
-	double zeta = px->params[4];
-
-	double result, error, ymin, ymax;
-	gsl_integration_workspace *w = gsl_integration_workspace_alloc(10000);
-	integrate_params_2 * py = new integrate_params_2;
-	py->f = px->f;
-	py->params = new double[4];
-	py->params[0] = 2.*E1*x*Temp;
-	py->params[1] = Temp;
-	py->params[2] = M2;
-	py->params[3] = v1;
-
-        gsl_function F;
-	F.function = fy_wrapper22;
-	F.params = py;
-	ymax = 1.;
-	ymin = -1.;
-	gsl_integration_qag(&F, ymin, ymax, 0, 1e-4, 10000, 6, w, &result, &error);
-	delete [] py->params;
-	delete py;
-	gsl_integration_workspace_free(w);
-	return x*x*f_0(x, zeta)*result;
+	arg[0] = p.M2 + coeff*(1.-p.v1*y); arg[1] = p.Temp;
+	return (1.-p.v1*y)*sigma(arg);
+}
+
+template <typename Xsection>
+double fx_wrapper22(double x, const rate_params & p, Xsection & sigma){
+	double coeff = 2.*p.E1*x*p.Temp;
+	auto fy = [&](double y){return fy_wrapper22(y, coeff, p, sigma);};
+	gsl_function F = make_gsl_function(fy);
+	double error, ymin = -1., ymax = 1.;
+	double result = qag_integrate(&F, ymin, ymax, 0, table_specs().epsrel(1e-4), 10000, 6, &error);
+	return x*x*f_0(x, p.zeta)*result;
+}
+
+// fx_wrapper22 with sigma = Xsection_2to2::integrate_moment: s is linear in y,
+// so int dy (1-v1*y) sigma(s) = int ds (s-M^2) sigma(s) / (c^2 v1)
+template <typename Xsection>
+double fx_moment_wrapper22(double x, const rate_params & p, Xsection & sigma){
+	double coeff = 2.*p.E1*x*p.Temp;
+	if (coeff <= 0.) return 0.;
+	double arg[3];
+	arg[0] = p.M2 + coeff*(1.-p.v1); // y = 1
+	arg[1] = p.M2 + coeff*(1.+p.v1); // y = -1
+	arg[2] = p.Temp;
+	return x*x*f_0(x, p.zeta)*sigma(arg)/(coeff*coeff*p.v1);
 }
 
 
 //=============function wrapper for GSL integration R23======================
-double fy_wrapper23(double y, void * params_){
-	// unpack Vegas params
-	integrate_params_2 * params = static_cast<integrate_params_2 *>(params_);
-	double coeff = params->params[0];
-	double Temp = params->params[1];
-	double M2 = params->params[2];
-	double v1 = params->params[3];
-	double dt = params->params[4];// dts in the Cell Frame
-	double E2 = params->params[5];// E2 in the Cell Frame
-	double E1 = params->params[6];// E1 in the Cell Frame
-	double s = M2 + coeff*(1.-v1*y);// s variable
+// dt in the Cell Frame, E2 = x*T
+template <typename Xsection>
+double fy_wrapper23(double y, double E2, double dt, const rate_params & p, Xsection & sigma){
+	double coeff = 2.*p.E1*E2;
+	double s = p.M2 + coeff*(1.-p.v1*y);// s variable
 	// transform time separation in to CoM frame
-	double costheta2 = (M2 + 2.*E1*E2 - s)/(2.*v1*E1*E2);
-	double vz_com = (v1*E1 + E2*costheta2)/(E1+E2);
-	double gamma_com = (E1+E2)/std::sqrt(s);
-	double dtp = gamma_com*(1. - vz_com*v1)*dt; // dt in the CoM Frame
-	double * arg = new double[3];
-	arg[0] = s; arg[1] = Temp; arg[2] = dtp; // dt in the CoM Frame
-	double Xsection = params->f(arg);
-	delete [] arg;
-	return (1.-v1*y)*Xsection;
-}
-
-double fx_wrapper23(double x, void * px_){
-	integrate_params_2 * px = static_cast<integrate_params_2 *>(px_);
-	double E1 = px->params[0];
-	double v1 = px->params[1];
-	double Temp = px->params[2];
-	double M2 = px->params[3];
-	double zeta = px->params[4];
-	double dt = px->params[5]; // dt in the Cell Frame
-
-	double result, error, ymin, ymax;
-	gsl_integration_workspace *w = gsl_integration_workspace_alloc(10000);
-	integrate_params_2 * py = new integrate_params_2;
-	py->f = px->f;
-	py->params = new double[7];
-	py->params[0] = 2.*E1*x*Temp;
-	py->params[1] = Temp;
-	py->params[2] = M2;
-	py->params[3] = v1;
-	py->params[4] = dt; // dt in the Cell Frame
-	py->params[5] = x*Temp; // E2 in the Cell Frame
-	py->params[6] = E1; // E1 in the Cell Frame
-
-        gsl_function F;
-	F.function = fy_wrapper23;
-	F.params = py;
-	ymax = 1.;
-	ymin = -1.;
-	gsl_integration_qag(&F, ymin, ymax, 0, 1e-3, 10000, 6, w, &result, &error);
-
-	delete [] py->params;
-	delete py;
-	gsl_integration_workspace_free(w);
-	return x*x*f_0(x, zeta)*result;
+	double costheta2 = (p.M2 + 2.*p.E1*E2 - s)/(2.*p.v1*p.E1*E2);
+	double vz_com = (p.v1*p.E1 + E2*costheta2)/(p.E1+E2);
+	double gamma_com = (p.E1+E2)/std::sqrt(s);
+	double dtp = gamma_com*(1. - vz_com*p.v1)*dt; // dt in the CoM Frame
+	double arg[3];
+	arg[0] = s; arg[1] = p.Temp; arg[2] = dtp; // dt in the CoM Frame
+	return (1.-p.v1*y)*sigma(arg);
+}
+
+template <typename Xsection>
+double fx_wrapper23(double x, double dt, const rate_params & p, Xsection & sigma){
+	double E2 = x*p.Temp; // E2 in the Cell Frame
+	auto fy = [&](double y){return fy_wrapper23(y, E2, dt, p, sigma);};
+	gsl_function F = make_gsl_function(fy);
+	double error, ymin = -1., ymax = 1.;
+	double result = qag_integrate(&F, ymin, ymax, 0, table_specs().epsrel(1e-3), 10000, 6, &error);
+	return x*x*f_0(x, p.zeta)*result;
+}
+
+// the integrand of fx_wrapper23 and fy_wrapper23 at (x, y) for all Ndt
+// values of dt at once, dt in the Cell Frame
+template <typename Xsection>
+void dRdxdy_wrapper23(const double * x_, const double * dts, size_t Ndt, const rate_params & p,
+					  Xsection & sigma, double * values){
+	double x = x_[0], y = x_[1];
+	double E2 = x*p.Temp; // E2 in the Cell Frame
+	double s = p.M2 + 2.*p.E1*E2*(1.-p.v1*y);
+	// transform time separation in to CoM frame, y = cos(theta2)
+	double vz_com = (p.v1*p.E1 + E2*y)/(p.E1+E2);
+	double gamma_com = (p.E1+E2)/std::sqrt(s);
+	double weight = x*x*f_0(x, p.zeta)*(1.-p.v1*y);
+	double arg[3] = {s, p.Temp, 0.};
+	for (size_t k=0; k<Ndt; k++){
+		arg[2] = gamma_com*(1. - vz_com*p.v1)*dts[k]; // dt in the CoM Frame
+		values[k] = weight*sigma(arg);
+	}
 }
 
 //=======================Rates abstract class==================================
@@ -161,51 +143,41 @@ rates::rates(std::string name_)
 rates_2to2::rates_2to2(Xsection_2to2 * Xprocess_, int degeneracy_, double eta_2_, std::string name_, bool refresh)
 :	rates(name_), Xprocess(Xprocess_), M(Xprocess->get_M1()), degeneracy(degeneracy_),
 	eta_2(eta_2_),
-	NE1(120), NT(16), E1L(M*1.01), E1H(M*120), TL(0.13), TH(0.75),
-	dE1((E1H-E1L)/(NE1-1.)), dT((TH-TL)/(NT-1.)),
-	Rtab(boost::extents[NE1][NT])
+	NE1(table_specs().points("rates_2to2.N_E1", 120)), NT(table_specs().points("rates_2to2.N_T", 16)),
+	E1L(table_specs().value("rates_2to2.E1_low", M*1.01)), E1H(table_specs().value("rates_2to2.E1_high", M*120)),
+	TL(table_specs().value("rates_2to2.T_low", 0.13)), TH(table_specs().value("rates_2to2.T_high", 0.75)),
+	dT((TH-TL)/(NT-1.)),
+	E1axis(table_specs().axis("rates_2to2.E1", E1L, E1H, NE1)),
+	Rtab({E1axis, grid_axis(TL, TH, NT)}),
+	y_moments(table_specs().choice("rates_2to2.y_integration", "moments") == "moments")
 {
-	bool fileexist = boost::filesystem::exists(name_);
-	if ( (!fileexist) || ( fileexist && refresh) ){
-		std::cout << "# Populating table with new calculation" << std::endl;
-		std::vector<std::thread> threads;
-		size_t Ncores = std::min(size_t(std::thread::hardware_concurrency()), NT);
-		size_t call_per_core = size_t(NT*1./Ncores);
-		size_t call_for_last_core = NT - call_per_core*(Ncores-1);
-		auto code = [this](size_t NTstart_, size_t dNT_) { this->tabulate_E1_T(NTstart_, dNT_); };
-		for (size_t i=0; i< Ncores ; i++){
-			size_t Nstart = i*call_per_core;
-			size_t dN = (i==Ncores-1)? call_for_last_core : call_per_core;
-			threads.push_back( std::thread(code, Nstart, dN) );
-		}
-		for (std::thread& t : threads)	t.join();
-
-		save_to_file(name_, "Rates-tab");
-	}
-	else{
-		std::cout << "# loading existing table" << std::endl;
-		read_from_file(name_, "Rates-tab");
-	}
+	load_or_tabulate(name_, "Rates-tab", refresh);
 	std::cout << std::endl;
 }
 
 void rates_2to2::save_to_file(std::string filename, std::string datasetname){
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
 	H5::H5File file(filename.c_str(), H5F_ACC_TRUNC);
 
-	const size_t rank = 2;
-	hsize_t dims[rank] = {NE1, NT};
-	H5::DSetCreatPropList proplist{};
-	proplist.setChunk(rank, dims);
-
-	H5::DataSpace dataspace(rank, dims);
-	auto datatype(H5::PredType::NATIVE_DOUBLE);
-	H5::DataSet dataset = file.createDataSet(datasetname.c_str(), datatype, dataspace, proplist);
-	dataset.write(Rtab.data(), datatype);
+	H5::DataSet dataset;
+	if (Rgrid.empty()){
+		const size_t rank = 2;
+		hsize_t dims[rank] = {NE1, NT};
+		H5::DSetCreatPropList proplist{};
+		proplist.setChunk(rank, dims);
+
+		H5::DataSpace dataspace(rank, dims);
+		auto datatype(H5::PredType::NATIVE_DOUBLE);
+		dataset = file.createDataSet(datasetname.c_str(), datatype, dataspace, proplist);
+		dataset.write(Rtab.data(), datatype);
+	}
+	else dataset = Rgrid.save(file, datasetname);
 
 	// Attributes
 	hdf5_add_scalar_attr(dataset, "E1_low", E1L);
 	hdf5_add_scalar_attr(dataset, "E1_high", E1H);
 	hdf5_add_scalar_attr(dataset, "N_E1", NE1);
+	hdf5_add_axis_attrs(dataset, "E1", E1axis);
 
 	hdf5_add_scalar_attr(dataset, "T_low", TL);
 	hdf5_add_scalar_attr(dataset, "T_high", TH);
@@ -215,6 +187,7 @@ void rates_2to2::save_to_file(std::string filename, std::string datasetname){
 }
 
 void rates_2to2::read_from_file(std::string filename, std::string datasetname){
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
 	H5::H5File file(filename.c_str(), H5F_ACC_RDONLY);
 	const size_t rank = 2;
 
@@ -222,14 +195,20 @@ void rates_2to2::read_from_file(std::string filename, std::string datasetname){
 	hdf5_read_scalar_attr(dataset, "E1_low", E1L);
 	hdf5_read_scalar_attr(dataset, "E1_high", E1H);
 	hdf5_read_scalar_attr(dataset, "N_E1", NE1);
-	dE1 = (E1H-E1L)/(NE1-1.);
+	E1axis = hdf5_read_axis(dataset, "E1", E1L, E1H, NE1);
 
 	hdf5_read_scalar_attr(dataset, "T_low", TL);
 	hdf5_read_scalar_attr(dataset, "T_high", TH);
 	hdf5_read_scalar_attr(dataset, "N_T", NT);
 	dT = (TH-TL)/(NT-1.);
 
-	Rtab.resize(boost::extents[NE1][NT]);
+	if (adaptive_grid::is_adaptive(file, datasetname)){
+		Rgrid = adaptive_grid({E1L, TL}, {E1H, TH}, {NE1, NT});
+		Rgrid.read(file, datasetname);
+		return;
+	}
+	Rgrid = adaptive_grid();
+	Rtab.reset({E1axis, grid_axis(TL, TH, NT)});
 
 	hsize_t dims_mem[rank];
   	dims_mem[0] = NE1;
@@ -241,56 +220,80 @@ void rates_2to2::read_from_file(std::string filename, std::string datasetname){
 	file.close();
 }
 
-void rates_2to2::tabulate_E1_T(size_t T_start, size_t dnT){
-	double * arg = new double[2];
-	for (size_t i=0; i<NE1; i++){
-		arg[0] = E1L + i*dE1;
-		for (size_t j=T_start; j<(T_start+dnT); j++){
-			arg[1] = TL + j*dT;
-			Rtab[i][j] = calculate(arg)/approx_R22(arg);
-		}
-	}
-	delete [] arg;
+void rates_2to2::describe_inputs(table_inputs & inputs){
+	inputs.add("M", M);
+	inputs.add("degeneracy", degeneracy);
+	inputs.add("eta_2", eta_2);
+	inputs.add("xsection", Xprocess->input_physics_hash());
+	inputs.add("y_integration", y_moments ? "moments" : "quadrature");
+	inputs.add_axis("E1", E1L, E1H, NE1, E1axis.name());
+	inputs.add_axis("T", TL, TH, NT);
+}
+
+double rates_2to2::tabulate_E1_T(size_t cell){
+	size_t i = cell/NT, j = cell%NT;
+	double arg[2];
+	arg[0] = E1axis.node(i);
+	arg[1] = TL + j*dT;
+	return calculate(arg)/approx_R22(arg);
+}
+
+bool rates_2to2::tabulate_adaptive(std::string filename, std::string datasetname){
+	// base grid 8 times coarser than the uniform one, refined where needed;
+	// the adaptive grid is uniform in E1 whatever the spacing of Rtab
+	NE1 = std::max<size_t>(2, (NE1-1)/8 + 1); E1axis = grid_axis(E1L, E1H, NE1);
+	NT = std::max<size_t>(2, (NT-1)/8 + 1); dT = (TH-TL)/(NT-1.);
+	Rgrid = adaptive_grid({E1L, TL}, {E1H, TH}, {NE1, NT}, table_options().refine_max_level);
+	Rgrid.build(filename, [this](double * x){
+			return calculate(x)/approx_R22(x);
+		}, table_options().refine_tolerance);
+	save_to_file(filename, datasetname);
+	return true;
 }
 
 double rates_2to2::interpR(double * arg){
-	double E1 = arg[0], Temp = arg[1];
-	if (Temp < TL) Temp = TL;
-	if (Temp >= TH) Temp = TH-dT;
-	if (E1 < E1L) E1 = E1L;
-	if (E1 >= E1H) E1 = E1H-dE1;
-	double xT, rT, xE1, rE1;
-	size_t iT, iE1;
-	xT = (Temp-TL)/dT;	iT = floor(xT); rT = xT - iT;
-	xE1 = (E1 - E1L)/dE1; iE1 = floor(xE1); rE1 = xE1 - iE1;
-	return interpolate2d(&Rtab, iE1, iT, rE1, rT)*approx_R22(arg);
+	if (!Rgrid.empty()) return Rgrid.interpolate(arg)*approx_R22(arg);
+	grid_point<2> p;
+	Rtab.locate(arg, p);
+	require_cells({p.index[0], p.index[1]});
+	return Rtab.interpolate(p)*approx_R22(arg);
+}
+
+void rates_2to2::interpR(size_t n, const double * E1, const double * Temp, const double *, double * R){
+	if (!Rgrid.empty() || lazy_mode()){
+		for (size_t k=0; k<n; k++){
+			double arg[2] = {E1[k], Temp[k]};
+			R[k] = interpR(arg);
+		}
+		return;
+	}
+	const double * x[2] = {E1, Temp};
+	Rtab.interpolate(x, n, R);
+	for (size_t k=0; k<n; k++){
+		double arg[2] = {E1[k], Temp[k]};
+		R[k] *= approx_R22(arg);
+	}
 }
 
 double rates_2to2::calculate(double * arg)
 {
 	double E1 = arg[0], Temp = arg[1];
 	double p1 = std::sqrt(E1*E1-M*M);
-	double result, error, xmin, xmax;
-	gsl_integration_workspace *w = gsl_integration_workspace_alloc(5000);
-	integrate_params_2 * px = new integrate_params_2;
-	px->f = std::bind( &Xsection_2to2::interpX, Xprocess, _1);
-	px->params = new double[5];
-	px->params[0] = E1;
-	px->params[1] = p1/E1;
-	px->params[2] = Temp;
-	px->params[3] = M*M;
-	px->params[4] = eta_2;
-
-    gsl_function F;
-	F.function = fx_wrapper22;
-	F.params = px;
-	xmax = 10.0;
-	xmin = 0.0;
-	gsl_integration_qag(&F, xmin, xmax, 0, 1e-3, 5000, 6, w, &result, &error);
-
-	gsl_integration_workspace_free(w);
-	delete [] px->params;
-	delete px;
+	double result, error, xmin = 0.0, xmax = 10.0;
+	rate_params p = {E1, p1/E1, Temp, M*M, eta_2};
+	Xsection_2to2 * X = Xprocess;
+	if (y_moments){
+		auto sigma = [X](double * Xarg){return X->integrate_moment(Xarg);};
+		auto fx = [&](double x){return fx_moment_wrapper22(x, p, sigma);};
+		gsl_function F = make_gsl_function(fx);
+		result = qag_integrate(&F, xmin, xmax, 0, table_specs().epsrel(1e-3), 5000, 6, &error);
+	}
+	else{
+		auto sigma = [X](double * Xarg){return X->interpX(Xarg);};
+		auto fx = [&](double x){return fx_wrapper22(x, p, sigma);};
+		gsl_function F = make_gsl_function(fx);
+		result = qag_integrate(&F, xmin, xmax, 0, table_specs().epsrel(1e-3), 5000, 6, &error);
+	}
 	return result*std::pow(Temp, 3)*4./c16pi2*degeneracy;
 }
 
@@ -302,7 +305,7 @@ void rates_2to2::sample_initial(double * arg, std::vector< std::vector<double> >
 	// and finally rejected with P_rej(x,y) = (1-v1*y) * sigma(M^2 + 2*E1*T*x - 2*p1*T*x*y, T);
 	// this function returns all initial state particles' four-vector in the order (p1, p2)
 	double E1 = arg[0], Temp = arg[1];
-	double * Xarg = new double[2];
+	double Xarg[2];
 	double M2 = M*M, x, y, max, smax;
 	double v1 = std::sqrt(E1*E1 - M2)/E1;
 	double intersection = M2, coeff1 = 2.*E1*Temp, coeff2 = -2.*E1*v1*Temp;
@@ -314,7 +317,6 @@ void rates_2to2::sample_initial(double * arg, std::vector< std::vector<double> >
 		y = dist_norm_y(gen);
 		Xarg[0] = intersection + (coeff1 + coeff2*y)*x;
 	}while( (1.-v1*y)*Xprocess->interpX(Xarg)/max < dist_reject(gen) );
-	delete [] Xarg;
 	double costheta2 = y, sintheta2 = std::sqrt(1. - y*y);
 	double E2 = x*Temp, phi2 = (rand()*2.*M_PI)/RAND_MAX;
 	double cosphi2 = std::cos(phi2), sinphi2 = std::sin(phi2);
@@ -334,34 +336,22 @@ void rates_2to2::sample_initial(double * arg, std::vector< std::vector<double> >
 rates_2to3::rates_2to3(Xsection_2to3 * Xprocess_, int degeneracy_, double eta_2_, std::string name_, bool refresh)
 :	rates(name_), Xprocess(Xprocess_), M(Xprocess->get_M1()), degeneracy(degeneracy_),
 	eta_2(eta_2_),
-	NE1(120), NT(8), Ndt(20), E1L(M*1.01), E1H(M*120), TL(0.13), TH(0.75), dtL(0.1), dtH(10.0),
-	dE1((E1H-E1L)/(NE1-1.)), dT((TH-TL)/(NT-1.)), ddt((dtH-dtL)/(Ndt-1.)),
-	Rtab(boost::extents[NE1][NT][Ndt])
+	NE1(table_specs().points("rates_2to3.N_E1", 120)), NT(table_specs().points("rates_2to3.N_T", 8)),
+	Ndt(table_specs().points("rates_2to3.N_dt", 20)),
+	E1L(table_specs().value("rates_2to3.E1_low", M*1.01)), E1H(table_specs().value("rates_2to3.E1_high", M*120)),
+	TL(table_specs().value("rates_2to3.T_low", 0.13)), TH(table_specs().value("rates_2to3.T_high", 0.75)),
+	dtL(table_specs().value("rates_2to3.dt_low", 0.1)), dtH(table_specs().value("rates_2to3.dt_high", 10.0)),
+	dT((TH-TL)/(NT-1.)), ddt((dtH-dtL)/(Ndt-1.)),
+	E1axis(table_specs().axis("rates_2to3.E1", E1L, E1H, NE1)),
+	Rtab({E1axis, grid_axis(TL, TH, NT), grid_axis(dtL, dtH, Ndt)}),
+	integrator(make_integrator(table_specs().choice("rates_2to3.integrator", "cubature")))
 {
-	bool fileexist = boost::filesystem::exists(name_);
-	if ( (!fileexist) || ( fileexist && refresh) ){
-		std::cout << "# Populating table with new calculation" << std::endl;
-		std::vector<std::thread> threads;
-		size_t Ncores = std::min(size_t(std::thread::hardware_concurrency()), NT);
-		size_t call_per_core = size_t(NT*1./Ncores);
-		size_t call_for_last_core = NT - call_per_core*(Ncores-1);
-		auto code = [this](size_t NTstart_, size_t dNT_) { this->tabulate_E1_T(NTstart_, dNT_); };
-		for (size_t i=0; i< Ncores ; i++){
-			size_t Nstart = i*call_per_core;
-			size_t dN = (i==Ncores-1)? call_for_last_core : call_per_core;
-			threads.push_back( std::thread(code, Nstart, dN) );
-		}
-		for (std::thread& t : threads)	t.join();
-		save_to_file(name_, "Rates-tab");
-	}
-	else{
-		std::cout << "# loading existing table" << std::endl;
-		read_from_file(name_, "Rates-tab");
-	}
+	load_or_tabulate(name_, "Rates-tab", refresh);
 	std::cout << std::endl;
 }
 
 void rates_2to3::save_to_file(std::string filename, std::string datasetname){
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
 	H5::H5File file(filename.c_str(), H5F_ACC_TRUNC);
 	const size_t rank = 3;
 
@@ -378,6 +368,7 @@ void rates_2to3::save_to_file(std::string filename, std::string datasetname){
 	hdf5_add_scalar_attr(dataset, "E1_low", E1L);
 	hdf5_add_scalar_attr(dataset, "E1_high", E1H);
 	hdf5_add_scalar_attr(dataset, "N_E1", NE1);
+	hdf5_add_axis_attrs(dataset, "E1", E1axis);
 
 	hdf5_add_scalar_attr(dataset, "T_low", TL);
 	hdf5_add_scalar_attr(dataset, "T_high", TH);
@@ -390,6 +381,7 @@ void rates_2to3::save_to_file(std::string filename, std::string datasetname){
 }
 
 void rates_2to3::read_from_file(std::string filename, std::string datasetname){
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
 	H5::H5File file(filename.c_str(), H5F_ACC_RDONLY);
 	const size_t rank = 3;
 
@@ -397,7 +389,7 @@ void rates_2to3::read_from_file(std::string filename, std::string datasetname){
 	hdf5_read_scalar_attr(dataset, "E1_low", E1L);
 	hdf5_read_scalar_attr(dataset, "E1_high", E1H);
 	hdf5_read_scalar_attr(dataset, "N_E1", NE1);
-	dE1 = (E1H-E1L)/(NE1-1.);
+	E1axis = hdf5_read_axis(dataset, "E1", E1L, E1H, NE1);
 
 	hdf5_read_scalar_attr(dataset, "T_low", TL);
 	hdf5_read_scalar_attr(dataset, "T_high", TH);
@@ -409,7 +401,7 @@ void rates_2to3::read_from_file(std::string filename, std::string datasetname){
 	hdf5_read_scalar_attr(dataset, "N_dt", Ndt);
 	ddt = (dtH-dtL)/(Ndt-1.);
 
-	Rtab.resize(boost::extents[NE1][NT][Ndt]);
+	Rtab.reset({E1axis, grid_axis(TL, TH, NT), grid_axis(dtL, dtH, Ndt)});
 	hsize_t dims_mem[rank];
   	dims_mem[0] = NE1;
   	dims_mem[1] = NT;
@@ -421,63 +413,83 @@ void rates_2to3::read_from_file(std::string filename, std::string datasetname){
 	file.close();
 }
 
-void rates_2to3::tabulate_E1_T(size_t T_start, size_t dnT){
-	double * arg = new double[3];
-	for (size_t i=0; i<NE1; i++){
-		arg[0] = E1L + i*dE1;
-		for (size_t j=T_start; j<(T_start+dnT); j++){
-			arg[1] = TL + j*dT;
-			for (size_t k=0; k<Ndt; k++){
-				arg[2] = dtL + k*ddt;
-				Rtab[i][j][k] = calculate(arg)/approx_R23(arg, M);
-			}
-		}
+void rates_2to3::describe_inputs(table_inputs & inputs){
+	inputs.add("M", M);
+	inputs.add("degeneracy", degeneracy);
+	inputs.add("eta_2", eta_2);
+	inputs.add("xsection", Xprocess->input_physics_hash());
+	inputs.add("integrator", integrator->get_name());
+	inputs.add_axis("E1", E1L, E1H, NE1, E1axis.name());
+	inputs.add_axis("T", TL, TH, NT);
+	inputs.add_axis("dt", dtL, dtH, Ndt);
+}
+
+double rates_2to3::tabulate_E1_T(size_t cell){
+	size_t i = cell/(NT*Ndt), j = (cell/Ndt)%NT, k = cell%Ndt;
+	double arg[3];
+	arg[0] = E1axis.node(i);
+	arg[1] = TL + j*dT;
+	arg[2] = dtL + k*ddt;
+	return calculate(arg)/approx_R23(arg, M);
+}
+
+void rates_2to3::tabulate_group(size_t first, double * result){
+	size_t i = first/(NT*Ndt), j = (first/Ndt)%NT;
+	double E1 = E1axis.node(i), Temp = TL + j*dT;
+	rate_params p = {E1, std::sqrt(E1*E1-M*M)/E1, Temp, M*M, eta_2};
+	std::vector<double> dts(Ndt);
+	for (size_t k=0; k<Ndt; k++) dts[k] = dtL + k*ddt; // dt in the Cell Frame
+	Xsection_2to3 * X = Xprocess;
+	auto sigma = [X](double * Xarg){return X->interpX(Xarg);};
+	auto f = [&](double * x, double * values){dRdxdy_wrapper23(x, dts.data(), Ndt, p, sigma, values);};
+
+	// x = E2/T in (0, 10), y = cos(theta2) in (-1, 1), as in calculate()
+	vector_monte_function G = make_vector_function(f, 2, Ndt);
+	double xl[2] = {0., -1.}, xu[2] = {10., 1.};
+	integration_goal goal = {table_specs().calls(4000), table_specs().epsrel(1e-3), table_specs().calls(200000), 0.5,
+							 table_options().cell_time_limit};
+	std::vector<integration_result> results(Ndt);
+	integrator->integrate(&G, xl, xu, goal, results.data());
+	for (size_t k=0; k<Ndt; k++){
+		double arg[3] = {E1, Temp, dts[k]};
+		result[k] = results[k].value*std::pow(Temp, 3)*4./c16pi2*degeneracy/approx_R23(arg, M);
 	}
-	delete [] arg;
 }
 
 double rates_2to3::interpR(double * arg){
-	double E1 = arg[0], Temp = arg[1], dt = arg[2];
-	if (Temp < TL) Temp = TL;
-	if (Temp >= TH) Temp = TH-dT;
-	if (dt < dtL) dt = dtL;
-	if (dt >= dtH) dt = dtH-ddt;
-	if (E1 < E1L) E1 = E1L;
-	if (E1 >= E1H) E1 = E1H-dE1;
-	double xT, rT, xE1, rE1, xdt, rdt;
-	size_t iT, iE1, idt;
-	xT = (Temp-TL)/dT;	iT = floor(xT); rT = xT - iT;
-	xdt = (dt-dtL)/ddt;	idt = floor(xdt); rdt = xdt - idt;
-	xE1 = (E1 - E1L)/dE1; iE1 = floor(xE1); rE1 = xE1 - iE1;
-	return interpolate3d(&Rtab, iE1, iT, idt, rE1, rT, rdt)*approx_R23(arg, M);
+	grid_point<3> p;
+	Rtab.locate(arg, p);
+	require_cells({p.index[0], p.index[1], p.index[2]});
+	return Rtab.interpolate(p)*approx_R23(arg, M);
+}
+
+void rates_2to3::interpR(size_t n, const double * E1, const double * Temp, const double * dt, double * R){
+	if (lazy_mode()){
+		for (size_t k=0; k<n; k++){
+			double arg[3] = {E1[k], Temp[k], dt[k]};
+			R[k] = interpR(arg);
+		}
+		return;
+	}
+	const double * x[3] = {E1, Temp, dt};
+	Rtab.interpolate(x, n, R);
+	for (size_t k=0; k<n; k++){
+		double arg[3] = {E1[k], Temp[k], dt[k]};
+		R[k] *= approx_R23(arg, M);
+	}
 }
 
 double rates_2to3::calculate(double * arg)
 {
 	double E1 = arg[0], Temp = arg[1], dt = arg[2]; // dt in the Cell Frame
 	double p1 = std::sqrt(E1*E1-M*M);
-	double result, error, xmin, xmax;
-	gsl_integration_workspace *w = gsl_integration_workspace_alloc(2000);
-	integrate_params_2 * px = new integrate_params_2;
-	px->f = std::bind( &Xsection_2to3::interpX, Xprocess, _1);
-	px->params = new double[6];
-	px->params[0] = E1;
-	px->params[1] = p1/E1;
-	px->params[2] = Temp;
-	px->params[3] = M*M;
-	px->params[4] = eta_2;
-	px->params[5] = dt; // dt in the Cell Frame
-
-    gsl_function F;
-	F.function = fx_wrapper23;
-	F.params = px;
-	xmax = 10.0;
-	xmin = 0.0;
-	gsl_integration_qag(&F, xmin, xmax, 0, 1e-2, 2000, 6, w, &result, &error);
-
-	gsl_integration_workspace_free(w);
-	delete [] px->params;
-	delete px;
+	double result, error, xmin = 0.0, xmax = 10.0;
+	rate_params p = {E1, p1/E1, Temp, M*M, eta_2};
+	Xsection_2to3 * X = Xprocess;
+	auto sigma = [X](double * Xarg){return X->interpX(Xarg);};
+	auto fx = [&](double x){return fx_wrapper23(x, dt, p, sigma);};
+	gsl_function F = make_gsl_function(fx);
+	result = qag_integrate(&F, xmin, xmax, 0, table_specs().epsrel(1e-2), 2000, 6, &error);
 	return result*std::pow(Temp, 3)*4./c16pi2*degeneracy;
 }
 
@@ -488,7 +500,7 @@ void rates_2to3::sample_initial(double * arg, std::vector< std::vector<double> >
 	// and uniform sample y within (-1., 1.)
 	// and finally rejected with P_rej(x,y) = (1-v1*y) * sigma(M^2 + 2*E1*T*x - 2*p1*T*x*y, T);
 	double E1 = arg[0], Temp = arg[1], dt = arg[2];
-	double * Xarg = new double[3]; Xarg[1] = Temp; Xarg[2] = dt; // dt in Cell Frame
+	double Xarg[3]; Xarg[1] = Temp; Xarg[2] = dt; // dt in Cell Frame
 	double M2 = M*M, x, y, max, smax, stemp;
 	double v1 = std::sqrt(E1*E1 - M2)/E1;
 	double intersection = M*M, coeff1 = 2.*E1*Temp, coeff2 = -2.*E1*Temp*v1;
@@ -501,7 +513,6 @@ void rates_2to3::sample_initial(double * arg, std::vector< std::vector<double> >
 		stemp = intersection + coeff1*x + coeff2*x*y;
 		Xarg[0] = stemp;
 	}while( (1.-v1*y)*Xprocess->interpX(Xarg) <= max*dist_reject(gen) );
-	delete [] Xarg;
 	double E2 = x*Temp;
 	double costheta2 = y, sintheta2 = std::sqrt(1. - y*y);
 	double phi2 = (rand()*2.*M_PI)/RAND_MAX;
@@ -516,35 +527,22 @@ void rates_2to3::sample_initial(double * arg, std::vector< std::vector<double> >
 rates_3to2::rates_3to2(f_3to2 * Xprocess_, int degeneracy_, double eta_2_, double eta_k_, std::string name_, bool refresh)
 :	rates(name_), Xprocess(Xprocess_), M(Xprocess->get_M1()), degeneracy(degeneracy_),
 	eta_2(eta_2_), eta_k(eta_k_),
-	NE1(120), NT(8), Ndt(10), E1L(M*1.01), E1H(M*120), TL(0.13), TH(0.75), dtL(0.1), dtH(10.0),
-	dE1((E1H-E1L)/(NE1-1.)), dT((TH-TL)/(NT-1.)), ddt((dtH-dtL)/(Ndt-1.)),
-	Rtab(boost::extents[NE1][NT][Ndt])
+	NE1(table_specs().points("rates_3to2.N_E1", 120)), NT(table_specs().points("rates_3to2.N_T", 8)),
+	Ndt(table_specs().points("rates_3to2.N_dt", 10)),
+	E1L(table_specs().value("rates_3to2.E1_low", M*1.01)), E1H(table_specs().value("rates_3to2.E1_high", M*120)),
+	TL(table_specs().value("rates_3to2.T_low", 0.13)), TH(table_specs().value("rates_3to2.T_high", 0.75)),
+	dtL(table_specs().value("rates_3to2.dt_low", 0.1)), dtH(table_specs().value("rates_3to2.dt_high", 10.0)),
+	dT((TH-TL)/(NT-1.)), ddt((dtH-dtL)/(Ndt-1.)),
+	E1axis(table_specs().axis("rates_3to2.E1", E1L, E1H, NE1)),
+	Rtab({E1axis, grid_axis(TL, TH, NT), grid_axis(dtL, dtH, Ndt)}),
+	integrator(make_integrator(table_specs().choice("rates_3to2.integrator", "vegas")))
 {
-	bool fileexist = boost::filesystem::exists(name_);
-	if ( (!fileexist) || ( fileexist && refresh) ){
-		std::cout << "# Populating table with new calculation" << std::endl;
-		std::vector<std::thread> threads;
-		size_t Ncores = std::min(size_t(std::thread::hardware_concurrency()), NT);
-		size_t call_per_core = size_t(NT*1./Ncores);
-		size_t call_for_last_core = NT - call_per_core*(Ncores-1);
-		auto code = [this](size_t NTstart_, size_t dNT_) { this->tabulate_E1_T(NTstart_, dNT_); };
-		for (size_t i=0; i< Ncores ; i++){
-			size_t Nstart = i*call_per_core;
-			size_t dN = (i==Ncores-1)? call_for_last_core : call_per_core;
-			threads.push_back( std::thread(code, Nstart, dN) );
-		}
-		for (std::thread& t : threads)	t.join();
-
-		save_to_file(name_, "Rates-tab");
-	}
-	else{
-		std::cout << "# loading existing table" << std::endl;
-		read_from_file(name_, "Rates-tab");
-	}
+	load_or_tabulate(name_, "Rates-tab", refresh);
 	std::cout << std::endl;
 }
 
 void rates_3to2::save_to_file(std::string filename, std::string datasetname){
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
 	H5::H5File file(filename.c_str(), H5F_ACC_TRUNC);
 	const size_t rank = 3;
 
@@ -561,6 +559,7 @@ void rates_3to2::save_to_file(std::string filename, std::string datasetname){
 	hdf5_add_scalar_attr(dataset, "E1_low", E1L);
 	hdf5_add_scalar_attr(dataset, "E1_high", E1H);
 	hdf5_add_scalar_attr(dataset, "N_E1", NE1);
+	hdf5_add_axis_attrs(dataset, "E1", E1axis);
 
 	hdf5_add_scalar_attr(dataset, "T_low", TL);
 	hdf5_add_scalar_attr(dataset, "T_high", TH);
@@ -573,6 +572,7 @@ void rates_3to2::save_to_file(std::string filename, std::string datasetname){
 }
 
 void rates_3to2::read_from_file(std::string filename, std::string datasetname){
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
 	H5::H5File file(filename.c_str(), H5F_ACC_RDONLY);
 	const size_t rank = 3;
 
@@ -580,7 +580,7 @@ void rates_3to2::read_from_file(std::string filename, std::string datasetname){
 	hdf5_read_scalar_attr(dataset, "E1_low", E1L);
 	hdf5_read_scalar_attr(dataset, "E1_high", E1H);
 	hdf5_read_scalar_attr(dataset, "N_E1", NE1);
-	dE1 = (E1H-E1L)/(NE1-1.);
+	E1axis = hdf5_read_axis(dataset, "E1", E1L, E1H, NE1);
 
 	hdf5_read_scalar_attr(dataset, "T_low", TL);
 	hdf5_read_scalar_attr(dataset, "T_high", TH);
@@ -592,7 +592,7 @@ void rates_3to2::read_from_file(std::string filename, std::string datasetname){
 	hdf5_read_scalar_attr(dataset, "N_dt", Ndt);
 	ddt = (dtH-dtL)/(Ndt-1.);
 
-	Rtab.resize(boost::extents[NE1][NT][Ndt]);
+	Rtab.reset({E1axis, grid_axis(TL, TH, NT), grid_axis(dtL, dtH, Ndt)});
 	hsize_t dims_mem[rank];
   	dims_mem[0] = NE1;
   	dims_mem[1] = NT;
@@ -604,41 +604,60 @@ void rates_3to2::read_from_file(std::string filename, std::string datasetname){
 	file.close();
 }
 
-void rates_3to2::tabulate_E1_T(size_t T_start, size_t dnT){
-	double * arg = new double[3];
-	for (size_t i=0; i<NE1; i++){
-		arg[0] = E1L + i*dE1;
-		for (size_t j=T_start; j<(T_start+dnT); j++){
-			arg[1] = TL + j*dT;
-			for (size_t k=0; k<Ndt; k++){
-				arg[2] = dtL + k*ddt;
-				Rtab[i][j][k] = calculate(arg)/approx_R32(arg);
-			}
-		}
-	}
-	delete [] arg;
+void rates_3to2::describe_inputs(table_inputs & inputs){
+	inputs.add("M", M);
+	inputs.add("degeneracy", degeneracy);
+	inputs.add("eta_2", eta_2);
+	inputs.add("eta_k", eta_k);
+	inputs.add("xsection", Xprocess->input_physics_hash());
+	inputs.add("integrator", integrator->get_name());
+	inputs.add_axis("E1", E1L, E1H, NE1, E1axis.name());
+	inputs.add_axis("T", TL, TH, NT);
+	inputs.add_axis("dt", dtL, dtH, Ndt);
+}
+
+double rates_3to2::tabulate_E1_T(size_t cell){
+	size_t i = cell/(NT*Ndt), j = (cell/Ndt)%NT, k = cell%Ndt;
+	double arg[3];
+	arg[0] = E1axis.node(i);
+	arg[1] = TL + j*dT;
+	arg[2] = dtL + k*ddt;
+	return calculate(arg)/approx_R32(arg);
 }
 
 double rates_3to2::interpR(double * arg){
-	double E1 = arg[0], Temp = arg[1], dt = arg[2];
-	if (Temp < TL) Temp = TL;
-	if (Temp >= TH) Temp = TH-dT;
-	if (dt < dtL) dt = dtL;
-	if (dt >= dtH) dt = dtH-ddt;
-	if (E1 < E1L) E1 = E1L;
-	if (E1 >= E1H) E1 = E1H-dE1;
-	double xT, rT, xE1, rE1, xdt, rdt;
-	size_t iT, iE1, idt;
-	xT = (Temp-TL)/dT;	iT = floor(xT); rT = xT - iT;
-	xdt = (dt-dtL)/ddt;	idt = floor(xdt); rdt = xdt - idt;
-	xE1 = (E1 - E1L)/dE1; iE1 = floor(xE1); rE1 = xE1 - iE1;
-	return interpolate3d(&Rtab, iE1, iT, idt, rE1, rT, rdt)*approx_R32(arg);;
+	grid_point<3> p;
+	Rtab.locate(arg, p);
+	require_cells({p.index[0], p.index[1], p.index[2]});
+	return Rtab.interpolate(p)*approx_R32(arg);
+}
+
+void rates_3to2::interpR(size_t n, const double * E1, const double * Temp, const double * dt, double * R){
+	if (lazy_mode()){
+		for (size_t k=0; k<n; k++){
+			double arg[3] = {E1[k], Temp[k], dt[k]};
+			R[k] = interpR(arg);
+		}
+		return;
+	}
+	const double * x[3] = {E1, Temp, dt};
+	Rtab.interpolate(x, n, R);
+	for (size_t k=0; k<n; k++){
+		double arg[3] = {E1[k], Temp[k], dt[k]};
+		R[k] *= approx_R32(arg);
+	}
 }
 
 
 //-------------3->2 wrapper function--------------------------
-double dRdPS_wrapper(double * x_, size_t n_dims_, void * params_){
-	integrate_params_2 * params = static_cast<integrate_params_2 *>(params_);
+// the parameters of dRdPS_wrapper
+struct rate32_params{
+	double E1, Temp, dt, M, p1, eta_2, eta_k;
+};
+
+// sigma(arg) with arg = {s, T, a1, a2, dt} calls f_3to2::interpX
+template <typename Xsection>
+double dRdPS_wrapper(const double * x_, const rate32_params & p, Xsection & sigma){
 	double x2 = x_[0], costheta2 = x_[1],
 		   xk = x_[2], costhetak = x_[3],
 		   phik = x_[4];
@@ -652,13 +671,7 @@ double dRdPS_wrapper(double * x_, size_t n_dims_, void * params_){
 	double sinthetak = std::sqrt(1. - costhetak*costhetak);
 	double cosphik = std::cos(phik), sinphik = std::sin(phik);
 
-	double E1 = params->params[0],
-		   Temp = params->params[1],
-		   dt = params->params[2],
-		   M = params->params[3],
-		   p1 = params->params[4],
-		   eta_2 = params->params[5],
-		   eta_k = params->params[6];
+	double E1 = p.E1, Temp = p.Temp, dt = p.dt, M = p.M, p1 = p.p1, eta_2 = p.eta_2, eta_k = p.eta_k;
 	double E2 = x2*Temp, k = xk*Temp;
 
 	double kx = k*sinthetak*cosphik, ky = k*sinthetak*sinphik, kz = k*costhetak;
@@ -678,35 +691,18 @@ double dRdPS_wrapper(double * x_, size_t n_dims_, void * params_){
 	double w2 = E2p/p_tot, wk = kp/p_tot;
 
 	// Quantity in CoM frame of p1 and p2
-	double * arg = new double[5];
+	double arg[5];
 	arg[0] = s; arg[1] = Temp; arg[2] =  w2 + wk; arg[3] = (w2 - wk)/(1. - w2 - wk); arg[4] = gamma*(1. - vz*p1/E1)*dt;
-	double result = x2*f_0(x2, eta_2)*xk*f_0(xk, eta_k)*params->f(arg);
-	delete [] arg;
-	return result;
+	return x2*f_0(x2, eta_2)*xk*f_0(xk, eta_k)*sigma(arg);
 }
 
 double rates_3to2::calculate(double * arg){
 	double E1 = arg[0], Temp = arg[1], dt = arg[2]; // dt in the Cell Frame
-	double result, error;
-	integrate_params_2 * params = new integrate_params_2;
-	params->f = std::bind(&f_3to2::interpX, Xprocess, _1);
-
-	const gsl_rng_type * Tr = gsl_rng_default;
-	gsl_rng * r = gsl_rng_alloc(Tr);
-
-	params->params = new double[7];
-	params->params[0] = E1;
-	params->params[1] = Temp;
-	params->params[2] = dt;
-	params->params[3] = M;
-	params->params[4] = std::sqrt(E1*E1-M*M);
-	params->params[5] = eta_2;
-	params->params[6] = eta_k;
-
-	gsl_monte_function G;
-	G.f = dRdPS_wrapper;
-	G.dim = 5;
-	G.params = params;
+	rate32_params p = {E1, Temp, dt, M, std::sqrt(E1*E1-M*M), eta_2, eta_k};
+	f_3to2 * X = Xprocess;
+	auto sigma = [X](double * Xarg){return X->interpX(Xarg);};
+	auto f = [&](double * x){return dRdPS_wrapper(x, p, sigma);};
+	gsl_monte_function G = make_monte_function(f, 5);
 
 	// integration limits
 	double xl[5], xu[5];
@@ -716,38 +712,27 @@ double rates_3to2::calculate(double * arg){
 	xl[3] = -1.; xu[3] = 1.;
 	xl[4] = 0.0; xu[4] = 2.0*M_PI;
 
-	// Actuall integration, require the Xi-square to be close to 1,  (0.5, 1.5)
-	gsl_monte_vegas_state * sv = gsl_monte_vegas_alloc(5);
-	do{
-		gsl_monte_vegas_integrate(&G, xl, xu, 5, 10000, r, sv, &result, &error);
-	}while(std::abs(gsl_monte_vegas_chisq(sv)-1.0)>0.5);
-	gsl_monte_vegas_free(sv);
-	gsl_rng_free(r);
-	delete [] params->params;
-	delete params;
-
+	// Actuall integration, vegas requires the Xi-square to be close to 1,  (0.5, 1.5),
+	// and the relative error to meet the goal
+	integration_goal goal = {table_specs().calls(10000), table_specs().epsrel(1e-2), table_specs().calls(1000000), 0.5,
+							 table_options().cell_time_limit};
+	double result = integrator->integrate(&G, xl, xu, goal).value;
 	return result/256./std::pow(M_PI, 5)/E1*std::pow(Temp, 4)*degeneracy;
 }
 
 void rates_3to2::sample_initial(double * arg, std::vector< std::vector<double> > & IS){
 	double E1 = arg[0], Temp = arg[1], dt = arg[2];
 	double p1 = std::sqrt(E1*E1-M*M);
-	integrate_params_2 * params = new integrate_params_2;
-	params->f = std::bind(&f_3to2::interpX, Xprocess, _1);
-	params->params = new double[7];
-	params->params[0] = E1;
-	params->params[1] = Temp;
-	params->params[2] = dt;
-	params->params[3] = M;
-	params->params[4] = p1;
-	params->params[5] = eta_2;
-	params->params[6] = eta_k;
-	size_t n_dims = 5;
-	double * guessl = new double[n_dims];
-	double * guessh = new double[n_dims];
+	rate32_params p = {E1, Temp, dt, M, p1, eta_2, eta_k};
+	f_3to2 * X = Xprocess;
+	auto sigma = [X](double * Xarg){return X->interpX(Xarg);};
+	auto f = [&](double * x){return dRdPS_wrapper(x, p, sigma);};
+	const size_t n_dims = 5;
+	gsl_monte_function G = make_monte_function(f, n_dims);
+	double guessl[n_dims], guessh[n_dims];
 	guessl[0] = 0.9; guessl[1] = -0.1; guessl[2] = 0.9; guessl[3] = -0.1; guessl[4] = 0.9*M_PI;
 	guessh[0] = 1.1; guessh[1] = 0.1; guessh[2] = 1.1; guessh[3] = 0.1; guessh[4] = 1.1*M_PI;
-	std::vector<double> vec5 = sampler.sample(dRdPS_wrapper, n_dims, params, guessl, guessh);
+	std::vector<double> vec5 = sampler.sample(G.f, n_dims, G.params, guessl, guessh);
 	double x2 = vec5[0],
 		   costheta2 = vec5[1],
 		   xk = vec5[2],
@@ -761,8 +746,91 @@ void rates_3to2::sample_initial(double * arg, std::vector< std::vector<double> >
 	IS[0][0] = E1; IS[0][1] = 0.; IS[0][2] = 0.; IS[0][3] = p1;
 	IS[1][0] = E2; IS[1][1] = E2*sintheta2*std::cos(phi2); IS[1][2] = E2*sintheta2*std::sin(phi2); IS[1][3] = E2*costheta2;
 	IS[2][0] = k; IS[2][1] = k*sinthetak*std::cos(phi2+phik); IS[2][2] = k*sinthetak*std::sin(phi2+phik); IS[2][3] = k*costhetak;
-	delete [] params->params;
-	delete params;
-	delete [] guessl;
-	delete [] guessh;
+}
+
+//=======================Rates of all channels at once=======================================
+namespace{
+	// the uniform tables of a and b interleaved into pair, false if they are
+	// not uniform or not on the same grid
+	template <size_t N>
+	bool interleave(const grid_table<N> * a, const grid_table<N> * b, grid_table<N> & pair){
+		if (a == NULL || b == NULL || !a->same_grid(*b)) return false;
+		std::array<grid_axis, N> axes;
+		for (size_t d=0; d<N; d++) axes[d] = a->axis(d);
+		pair.reset(axes, 2, true);
+		for (size_t n=0; n<pair.size(); n++){
+			pair.value(n, 0) = a->value(n);
+			pair.value(n, 1) = b->value(n);
+		}
+		return true;
+	}
+}
+
+channel_rates::channel_rates(rates_2to2 * Qq_Qq_, rates_2to2 * Qg_Qg_, rates_2to3 * Qq_Qqg_, rates_2to3 * Qg_Qgg_,
+							 rates_3to2 * Qqg_Qq_, rates_3to2 * Qgg_Qg_)
+:	Qq_Qq(Qq_Qq_), Qg_Qg(Qg_Qg_), Qq_Qqg(Qq_Qqg_), Qg_Qgg(Qg_Qgg_), Qqg_Qq(Qqg_Qq_), Qgg_Qg(Qgg_Qg_),
+	M(0.), Nchannels(0)
+{
+	if ((Qq_Qq == NULL) != (Qg_Qg == NULL) || (Qq_Qqg == NULL) != (Qg_Qgg == NULL)
+		|| (Qqg_Qq == NULL) != (Qgg_Qg == NULL))
+		throw std::invalid_argument("channel_rates: the Q+q and Q+g channels of a kind come in pairs");
+	if (Qq_Qq){
+		Nchannels += 2;
+		interleave(Qq_Qq->Rgrid.empty() && !Qq_Qq->lazy_mode() ? &Qq_Qq->Rtab : NULL,
+				   Qg_Qg->Rgrid.empty() && !Qg_Qg->lazy_mode() ? &Qg_Qg->Rtab : NULL, elastic);
+	}
+	if (Qq_Qqg){
+		Nchannels += 2;
+		M = Qq_Qqg->M;
+		if (Qg_Qgg->M == M)
+			interleave(Qq_Qqg->lazy_mode() ? NULL : &Qq_Qqg->Rtab, Qg_Qgg->lazy_mode() ? NULL : &Qg_Qgg->Rtab, inelastic);
+	}
+	if (Qqg_Qq){
+		Nchannels += 2;
+		interleave(Qqg_Qq->lazy_mode() ? NULL : &Qqg_Qq->Rtab, Qgg_Qg->lazy_mode() ? NULL : &Qgg_Qg->Rtab,
+				   detailed_balance);
+	}
+}
+
+double channel_rates::interpR(double E1, double Temp, double dt23, double dt32, double * R, double * P){
+	size_t i = 0;
+	if (Qq_Qq){
+		double arg[2] = {E1, Temp};
+		if (elastic.size()){
+			grid_point<2> p;
+			elastic.locate(arg, p);
+			elastic.interpolate_all(p, R+i);
+			double approx = approx_R22(arg);
+			R[i] *= approx; R[i+1] *= approx;
+		}
+		else {R[i] = Qq_Qq->interpR(arg); R[i+1] = Qg_Qg->interpR(arg);}
+		i += 2;
+	}
+	if (Qq_Qqg){
+		double arg[3] = {E1, Temp, dt23};
+		if (inelastic.size()){
+			grid_point<3> p;
+			inelastic.locate(arg, p);
+			inelastic.interpolate_all(p, R+i);
+			double approx = approx_R23(arg, M);
+			R[i] *= approx; R[i+1] *= approx;
+		}
+		else {R[i] = Qq_Qqg->interpR(arg); R[i+1] = Qg_Qgg->interpR(arg);}
+		i += 2;
+	}
+	if (Qqg_Qq){
+		double arg[3] = {E1, Temp, dt32};
+		if (detailed_balance.size()){
+			grid_point<3> p;
+			detailed_balance.locate(arg, p);
+			detailed_balance.interpolate_all(p, R+i);
+			double approx = approx_R32(arg);
+			R[i] *= approx; R[i+1] *= approx;
+		}
+		else {R[i] = Qqg_Qq->interpR(arg); R[i+1] = Qgg_Qg->interpR(arg);}
+		i += 2;
+	}
+	double total = 0.;
+	for (size_t c=0; c<Nchannels; c++) {total += R[c]; P[c] = total;}
+	return total;
 }
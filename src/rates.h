@@ -3,7 +3,6 @@
 
 #include <iostream>
 #include <random>
-#include <functional>
 #include <vector>
 #include <string>
 
@@ -11,101 +10,171 @@
 #include <gsl/gsl_integration.h>
 #include <gsl/gsl_monte.h>
 #include <gsl/gsl_monte_vegas.h>
-#include <boost/multi_array.hpp>
-
 #include "Xsection.h"
 
 double f_0(double x, double xi);
-double fy_wrapper22(double y, void * params_);
-double fx_wrapper22(double x, void * px_);
-double fy_wrapper23(double y, void * params_);
-double fx_wrapper23(double x, void * px_);
-
-struct integrate_params_2{
-	std::function<double(double*)> f;   // store a call to member funtion (interp) and object
-	double * params;  // other double type parameters
-};
 
-double Vegas_func_wrapper(double * var, long unsigned int n_dims, void *params);
+class channel_rates;
 
-class rates{
+class rates : public tabulated_table{
 protected:
 	std::random_device rd;
     std::mt19937 gen;
     std::gamma_distribution<double> dist_x, dist_xcorr;
 	std::uniform_real_distribution<double> dist_norm_y;
 	std::uniform_real_distribution<double> dist_reject;
-	virtual void tabulate_E1_T(size_t T_start, size_t dnT) = 0;
-	virtual void save_to_file(std::string filename, std::string datasetname) = 0;
-	virtual void read_from_file(std::string filename, std::string datasetname) = 0;
+	// compute a single (E1, T[, dt]) cell, given by its flat index into the table
+	virtual double tabulate_E1_T(size_t cell) = 0;
+	void tabulate_cell(size_t cell, double * result) {*result = tabulate_E1_T(cell);};
 public:
 	rates(std::string name_);
+	virtual ~rates(){};
 	virtual double calculate(double * arg) = 0;
 	virtual double interpR(double * arg) = 0;
+	// interpR() of n particles into R, particle k at E1[k], Temp[k] and
+	// dt[k]; 2->2 rates do not read dt, which may be NULL
+	virtual void interpR(size_t n, const double * E1, const double * Temp, const double * dt, double * R) = 0;
 	virtual void sample_initial(double * arg, std::vector< std::vector<double> > & IS) = 0;
 };
 
 class rates_2to2 : public rates{
 private:
+	friend class channel_rates;
 	Xsection_2to2 * Xprocess;
 	const double M;
 	const int degeneracy;
 	const double eta_2;
 	size_t NE1, NT;
 	double E1L, E1H, TL, TH,
-		   dE1, dT;
-	boost::multi_array<double, 2> Rtab;
-	void tabulate_E1_T(size_t T_start, size_t dnT);
+		   dT;
+	// spaced by the table spec "rates_2to2.E1_spacing"
+	grid_axis E1axis;
+	grid_table<2> Rtab;
+	// the y = cos(theta2) integral from the moment tables of the cross
+	// section instead of by quadrature
+	const bool y_moments;
+	std::vector<size_t> table_shape(void) {return {NE1, NT};};
+	double * table_data(void) {return Rtab.data();};
+	// only a uniform E1 axis can be extended
+	std::vector<table_axis> table_axes(void){
+		std::vector<table_axis> axes = {{"T", 1, "T_low", "T_high", "N_T"}};
+		if (E1axis.get_spacing() == grid_axis::uniform) axes.push_back({"E1", 0, "E1_low", "E1_high", "N_E1"});
+		return axes;
+	};
+	void describe_inputs(table_inputs & inputs);
+	// (E1, T) grid used instead of Rtab when built with a refine tolerance
+	adaptive_grid Rgrid;
+	bool tabulate_adaptive(std::string filename, std::string datasetname);
+	double tabulate_E1_T(size_t cell);
 	void save_to_file(std::string filename, std::string datasetname);
 	void read_from_file(std::string filename, std::string datasetname);
 public:
 	rates_2to2(Xsection_2to2 * Xprocess_, int degeneracy_, double eta_2_, std::string name_, bool refresh);
+	~rates_2to2(){persist_lazy_cells();};
 	double calculate(double * arg);
 	double interpR(double * arg);
+	void interpR(size_t n, const double * E1, const double * Temp, const double * dt, double * R);
 	void sample_initial(double * arg, std::vector< std::vector<double> > & IS);
 };
 
 class rates_2to3 : public rates{
 private:
+	friend class channel_rates;
 	Xsection_2to3 * Xprocess;
 	const double M;
 	const int degeneracy;
 	const double eta_2;
 	size_t NE1, NT, Ndt;
 	double E1L, E1H, TL, TH, dtL, dtH,
-		   dE1, dT, ddt;
-	boost::multi_array<double, 3> Rtab;
-	void tabulate_E1_T(size_t T_start, size_t dnT);
+		   dT, ddt;
+	grid_axis E1axis;
+	grid_table<3> Rtab;
+	std::unique_ptr<multi_integrator> integrator;
+	std::vector<size_t> table_shape(void) {return {NE1, NT, Ndt};};
+	double * table_data(void) {return Rtab.data();};
+	std::vector<table_axis> table_axes(void){
+		std::vector<table_axis> axes = {{"T", 1, "T_low", "T_high", "N_T"}, {"dt", 2, "dt_low", "dt_high", "N_dt"}};
+		if (E1axis.get_spacing() == grid_axis::uniform) axes.push_back({"E1", 0, "E1_low", "E1_high", "N_E1"});
+		return axes;
+	};
+	void describe_inputs(table_inputs & inputs);
+	double tabulate_E1_T(size_t cell);
+	// the whole dt axis of an (E1, T) cell from one (x, y) integration
+	size_t table_group(void) {return Ndt;};
+	void tabulate_group(size_t first, double * result);
 	void save_to_file(std::string filename, std::string datasetname);
 	void read_from_file(std::string filename, std::string datasetname);
 public:
 	rates_2to3(Xsection_2to3 * Xprocess_, int degeneracy_, double eta_2_, std::string name_, bool refresh);
+	~rates_2to3(){persist_lazy_cells();};
 	double calculate(double * arg);
 	double interpR(double * arg);
+	void interpR(size_t n, const double * E1, const double * Temp, const double * dt, double * R);
 	void sample_initial(double * arg, std::vector< std::vector<double> > & IS);
 };
 
 class rates_3to2 : public rates{
 private:
+	friend class channel_rates;
 	f_3to2 * Xprocess;
 	const double M;
 	const int degeneracy;
 	const double eta_2, eta_k;
 	size_t NE1, NT, Ndt;
 	double E1L, E1H, TL, TH, dtL, dtH,
-		   dE1, dT, ddt;
-	boost::multi_array<double, 3> Rtab;
+		   dT, ddt;
+	grid_axis E1axis;
+	grid_table<3> Rtab;
+	std::unique_ptr<multi_integrator> integrator;
+	std::vector<size_t> table_shape(void) {return {NE1, NT, Ndt};};
+	double * table_data(void) {return Rtab.data();};
+	std::vector<table_axis> table_axes(void){
+		std::vector<table_axis> axes = {{"T", 1, "T_low", "T_high", "N_T"}, {"dt", 2, "dt_low", "dt_high", "N_dt"}};
+		if (E1axis.get_spacing() == grid_axis::uniform) axes.push_back({"E1", 0, "E1_low", "E1_high", "N_E1"});
+		return axes;
+	};
+	void describe_inputs(table_inputs & inputs);
 	AiMS sampler;
-	void tabulate_E1_T(size_t T_start, size_t dnT);
+	double tabulate_E1_T(size_t cell);
 	void save_to_file(std::string filename, std::string datasetname);
 	void read_from_file(std::string filename, std::string datasetname);
 public:
 	rates_3to2(f_3to2 * Xprocess_, int degeneracy_, double eta_2_, double eta_k_, std::string name_, bool refresh);
+	~rates_3to2(){persist_lazy_cells();};
 	double calculate(double * arg);
 	double interpR(double * arg);
+	void interpR(size_t n, const double * E1, const double * Temp, const double * dt, double * R);
 	void sample_initial(double * arg, std::vector< std::vector<double> > & IS);
 };
 
-
+//=============rates of all channels at once===================================
+// The transport picks a channel from the cumulative rates of all enabled
+// channels at every step. The Q+q and Q+g tables of one kind (2->2, 2->3 or
+// 3->2) are tabulated on the same grid, and channel_rates copies each such
+// pair into one interleaved grid_table, the two rates of a grid point next to
+// each other: a kind then costs a single locate() and one pass over its
+// corners. A kind whose tables are adaptive, lazy or on different grids is
+// looked up channel by channel. The tables are copied when channel_rates is
+// constructed, so it has to be made once they are complete.
+class channel_rates{
+private:
+	rates_2to2 * Qq_Qq, * Qg_Qg;
+	rates_2to3 * Qq_Qqg, * Qg_Qgg;
+	rates_3to2 * Qqg_Qq, * Qgg_Qg;
+	double M;
+	size_t Nchannels;
+	// the pairs of the kinds, empty if not enabled or not interleaved
+	grid_table<2> elastic;
+	grid_table<3> inelastic, detailed_balance;
+public:
+	// the channels of a kind that is not enabled are NULL
+	channel_rates(rates_2to2 * Qq_Qq_, rates_2to2 * Qg_Qg_, rates_2to3 * Qq_Qqg_, rates_2to3 * Qg_Qgg_,
+				  rates_3to2 * Qqg_Qq_, rates_3to2 * Qgg_Qg_);
+	size_t size(void) const {return Nchannels;};
+	// the rates R of the enabled channels in the order of the constructor,
+	// 2->3 at dt23 and 3->2 at dt32, and their cumulative sums P; returns
+	// the total
+	double interpR(double E1, double Temp, double dt23, double dt32, double * R, double * P);
+};
 
 #endif
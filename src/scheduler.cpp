@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+
+#include "scheduler.h"
+
+namespace {
+	// identifies the pool worker running on the current thread
+	thread_local const thread_pool * current_pool = NULL;
+	thread_local size_t current_worker = 0;
+}
+
+thread_pool::thread_pool(size_t Nworkers)
+:	pending(0), stop(false)
+{
+	if (Nworkers < 1) Nworkers = 1;
+	for (size_t i=0; i<Nworkers; i++) queues.emplace_back(new pool_queue);
+	for (size_t i=0; i<Nworkers; i++)
+		workers.push_back( std::thread(&thread_pool::worker_loop, this, i) );
+}
+
+thread_pool::~thread_pool(){
+	{
+		std::lock_guard<std::mutex> lock(m_idle);
+		stop = true;
+	}
+	cv_idle.notify_all();
+	for (std::thread& t : workers) t.join();
+}
+
+thread_pool & thread_pool::instance(void){
+	static thread_pool pool(std::thread::hardware_concurrency());
+	return pool;
+}
+
+size_t thread_pool::worker_index(void) const{
+	return (current_pool == this) ? current_worker : size();
+}
+
+bool thread_pool::pop(size_t iqueue, pool_task & task){
+	pool_queue & q = *queues[iqueue];
+	std::lock_guard<std::mutex> lock(q.m);
+	if (q.tasks.empty()) return false;
+	task = q.tasks.front();
+	q.tasks.pop_front();
+	pending--;
+	return true;
+}
+
+bool thread_pool::steal(size_t ithief, pool_task & task){
+	size_t Nq = queues.size();
+	for (size_t k=1; k<=Nq; k++){
+		pool_queue & q = *queues[(ithief+k)%Nq];
+		std::lock_guard<std::mutex> lock(q.m);
+		if (q.tasks.empty()) continue;
+		task = q.tasks.back();
+		q.tasks.pop_back();
+		pending--;
+		return true;
+	}
+	return false;
+}
+
+bool thread_pool::run_one(size_t ithief){
+	pool_task task = {NULL, 0};
+	if ( (ithief < queues.size() && pop(ithief, task)) || steal(ithief, task) ){
+		execute(task);
+		return true;
+	}
+	return false;
+}
+
+bool thread_pool::run_own(pool_batch * b){
+	pool_task task = {NULL, 0};
+	for (auto&& queue : queues){
+		pool_queue & q = *queue;
+		std::lock_guard<std::mutex> lock(q.m);
+		// the tasks of a batch are appended last, search from the back
+		auto found = std::find_if(q.tasks.rbegin(), q.tasks.rend(),
+								  [b](const pool_task & t){ return t.batch == b; });
+		if (found == q.tasks.rend()) continue;
+		task = *found;
+		q.tasks.erase(std::next(found).base());
+		pending--;
+		break;
+	}
+	if (!task.batch) return false;
+	execute(task);
+	return true;
+}
+
+void thread_pool::execute(pool_task & task){
+	pool_batch * b = task.batch;
+	try{
+		b->f(task.index);
+	}
+	catch (...){
+		std::lock_guard<std::mutex> lock(b->m);
+		if (!b->error) b->error = std::current_exception();
+	}
+	// decrement under the lock: the owner may destroy the batch as soon as
+	// it sees remaining == 0
+	std::lock_guard<std::mutex> lock(b->m);
+	if (--(b->remaining) == 0) b->done.notify_all();
+}
+
+void thread_pool::worker_loop(size_t iworker){
+	current_pool = this;
+	current_worker = iworker;
+	while (true){
+		if (run_one(iworker)) continue;
+		std::unique_lock<std::mutex> lock(m_idle);
+		cv_idle.wait(lock, [this]{ return stop || pending > 0; });
+		if (stop) return;
+	}
+}
+
+void thread_pool::parallel_for(size_t Ntasks, std::function<void(size_t)> task, bool help_others){
+	if (Ntasks == 0) return;
+	pool_batch batch;
+	batch.f = task;
+	batch.remaining = Ntasks;
+
+	// deal contiguous blocks of tasks to the worker queues, neighbouring
+	// cells then tend to run on the same thread
+	size_t Nq = queues.size();
+	size_t block = (Ntasks + Nq - 1)/Nq;
+	for (size_t iq=0; iq<Nq; iq++){
+		size_t start = iq*block, end = std::min(Ntasks, start+block);
+		if (start >= end) break;
+		pool_queue & q = *queues[iq];
+		std::lock_guard<std::mutex> lock(q.m);
+		for (size_t i=start; i<end; i++){
+			pool_task t = {&batch, i};
+			q.tasks.push_back(t);
+		}
+		pending += end - start;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_idle);
+	}
+	cv_idle.notify_all();
+
+	// help until our own batch is finished
+	size_t self = worker_index();
+	while (batch.remaining > 0){
+		if (help_others ? run_one(self) : run_own(&batch)) continue;
+		std::unique_lock<std::mutex> lock(batch.m);
+		batch.done.wait_for(lock, std::chrono::milliseconds(1),
+							[&batch]{ return batch.remaining == 0; });
+	}
+	// wait for the last worker to release the batch
+	std::lock_guard<std::mutex> lock(batch.m);
+	if (batch.error) std::rethrow_exception(batch.error);
+}
@@ -0,0 +1,70 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdlib>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//=============work-stealing thread pool=======================================
+// A persistent pool shared by every table build. parallel_for() splits the
+// index range [0, Ntasks) into single tasks which are dealt out to the
+// per-worker queues in contiguous blocks. A worker pops from the front of its
+// own queue and, once it runs dry, steals from the back of the others, so a
+// few expensive cells (e.g. high sqrts Vegas integrations) no longer decide
+// the wall time of a whole table.
+// The calling thread helps executing tasks while it waits, therefore
+// parallel_for() may be called from inside a task or from several threads
+// at the same time. A caller whose thread-local state must not be touched by
+// unrelated tasks while its batch runs, e.g. the Vegas grid the tasks read,
+// passes help_others = false and then only executes tasks of its own batch.
+struct pool_batch{
+	std::function<void(size_t)> f;
+	std::atomic<size_t> remaining;
+	std::mutex m;
+	std::condition_variable done;
+	std::exception_ptr error;
+};
+
+struct pool_task{
+	pool_batch * batch;
+	size_t index;
+};
+
+struct pool_queue{
+	std::mutex m;
+	std::deque<pool_task> tasks;
+};
+
+class thread_pool{
+private:
+	std::vector<std::unique_ptr<pool_queue> > queues;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> pending;
+	std::mutex m_idle;
+	std::condition_variable cv_idle;
+	bool stop;
+	bool pop(size_t iqueue, pool_task & task);
+	bool steal(size_t ithief, pool_task & task);
+	bool run_one(size_t ithief);
+	// execute one queued task of batch b, if any
+	bool run_own(pool_batch * b);
+	void execute(pool_task & task);
+	void worker_loop(size_t iworker);
+public:
+	thread_pool(size_t Nworkers);
+	~thread_pool();
+	static thread_pool & instance(void);
+	size_t size(void) const {return workers.size();};
+	// index of the calling pool worker, size() for any other thread
+	size_t worker_index(void) const;
+	void parallel_for(size_t Ntasks, std::function<void(size_t)> task, bool help_others = true);
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include <future>
+#include <iostream>
+#include <stdexcept>
+
+#include "matrix_elements.h"
+#include "table_set.h"
+
+table_set::table_set(double M_, size_t Nf_, std::string folder_,
+					 bool elastic, bool inelastic, bool detailed_balance, bool refresh)
+:	M(M_), Nf(Nf_), folder(folder_),
+	x_Qq_Qq(NULL), x_Qg_Qg(NULL), x_Qq_Qqg(NULL), x_Qg_Qgg(NULL), x_Qqg_Qq(NULL), x_Qgg_Qg(NULL),
+	r_Qq_Qq(NULL), r_Qg_Qg(NULL), r_Qq_Qqg(NULL), r_Qg_Qgg(NULL), r_Qqg_Qq(NULL), r_Qgg_Qg(NULL),
+	channels(NULL)
+{
+	if (elastic){
+		size_t xq = add_node([=]{ x_Qq_Qq = static_cast<Xsection_2to2*>(make("XQq2Qq", refresh)); }, {});
+		size_t xg = add_node([=]{ x_Qg_Qg = static_cast<Xsection_2to2*>(make("XQg2Qg", refresh)); }, {});
+		add_node([=]{ r_Qq_Qq = static_cast<rates_2to2*>(make("RQq2Qq", refresh, x_Qq_Qq)); }, {xq});
+		add_node([=]{ r_Qg_Qg = static_cast<rates_2to2*>(make("RQg2Qg", refresh, x_Qg_Qg)); }, {xg});
+	}
+	if (inelastic){
+		if (table_options().fuse_channels) fused_Q2Qg.reset(new fused_cells(2));
+		fused_cells * fused = fused_Q2Qg.get();
+		size_t xq = add_node([=]{ x_Qq_Qqg = static_cast<Xsection_2to3*>(make("XQq2Qqg", refresh, NULL, fused)); }, {});
+		size_t xg = add_node([=]{ x_Qg_Qgg = static_cast<Xsection_2to3*>(make("XQg2Qgg", refresh, NULL, fused)); }, {});
+		add_node([=]{ r_Qq_Qqg = static_cast<rates_2to3*>(make("RQq2Qqg", refresh, x_Qq_Qqg)); }, {xq});
+		add_node([=]{ r_Qg_Qgg = static_cast<rates_2to3*>(make("RQg2Qgg", refresh, x_Qg_Qgg)); }, {xg});
+	}
+	if (detailed_balance){
+		size_t xq = add_node([=]{ x_Qqg_Qq = static_cast<f_3to2*>(make("XQqg2Qq", refresh)); }, {});
+		size_t xg = add_node([=]{ x_Qgg_Qg = static_cast<f_3to2*>(make("XQgg2Qg", refresh)); }, {});
+		add_node([=]{ r_Qqg_Qq = static_cast<rates_3to2*>(make("RQqg2Qq", refresh, x_Qqg_Qq)); }, {xq});
+		add_node([=]{ r_Qgg_Qg = static_cast<rates_3to2*>(make("RQgg2Qg", refresh, x_Qgg_Qg)); }, {xg});
+	}
+	build_all();
+	channels = new channel_rates(r_Qq_Qq, r_Qg_Qg, r_Qq_Qqg, r_Qg_Qgg, r_Qqg_Qq, r_Qgg_Qg);
+}
+
+table_set::~table_set(){
+	delete channels;
+	delete r_Qq_Qq; delete r_Qg_Qg; delete r_Qq_Qqg;
+	delete r_Qg_Qgg; delete r_Qqg_Qq; delete r_Qgg_Qg;
+	delete x_Qq_Qq; delete x_Qg_Qg; delete x_Qq_Qqg;
+	delete x_Qg_Qgg; delete x_Qqg_Qq; delete x_Qgg_Qg;
+}
+
+tabulated_table * table_set::make(std::string table, bool refresh, tabulated_table * xsection,
+								  fused_cells * fused){
+	return make_table(table, M, Nf, folder, refresh, xsection, fused);
+}
+
+std::vector<std::string> table_set::table_names(void){
+	return {"XQq2Qq", "XQg2Qg", "RQq2Qq", "RQg2Qg",
+			"XQq2Qqg", "XQg2Qgg", "RQq2Qqg", "RQg2Qgg",
+			"XQqg2Qq", "XQgg2Qg", "RQqg2Qq", "RQgg2Qg"};
+}
+
+std::string table_set::dependency(std::string table){
+	return (table[0] == 'R') ? "X" + table.substr(1) : "";
+}
+
+std::string table_set::dataset_name(std::string table){
+	return (table[0] == 'R') ? "Rates-tab" : "Xsection-tab";
+}
+
+tabulated_table * table_set::make_table(std::string table, double M, size_t Nf, std::string folder,
+										bool refresh, tabulated_table * xsection, fused_cells * fused){
+	std::string file = folder + "/" + table + ".hdf5";
+	int dq = 12*Nf; // quark degeneracy
+	// cross sections
+	if (table == "XQq2Qq") return new Xsection_2to2(&dX_Qq2Qq_dPS, M, file, refresh);
+	if (table == "XQg2Qg") return new Xsection_2to2(&dX_Qg2Qg_dPS, M, file, refresh);
+	if (table == "XQq2Qqg")
+		return new Xsection_2to3(&M2_Qq2Qqg, M, file, refresh, &M2_Qq2Qqg_dt, fused, 0, &M2_Q2Qg_channels_dt);
+	if (table == "XQg2Qgg")
+		return new Xsection_2to3(&M2_Qg2Qgg, M, file, refresh, &M2_Qg2Qgg_dt, fused, 1, &M2_Q2Qg_channels_dt);
+	if (table == "XQqg2Qq") return new f_3to2(&Ker_Qqg2Qq, M, file, refresh);
+	if (table == "XQgg2Qg") return new f_3to2(&Ker_Qgg2Qg, M, file, refresh);
+	// rates, each needs its own cross section
+	if (dependency(table).empty() || xsection == NULL)
+		throw std::invalid_argument("make_table: unknown table or missing cross section for " + table);
+	if (Xsection_2to2 * x = dynamic_cast<Xsection_2to2*>(xsection)){
+		if (table == "RQq2Qq") return new rates_2to2(x, dq, 0., file, refresh);
+		if (table == "RQg2Qg") return new rates_2to2(x, 16, 0., file, refresh);
+	}
+	if (Xsection_2to3 * x = dynamic_cast<Xsection_2to3*>(xsection)){
+		if (table == "RQq2Qqg") return new rates_2to3(x, dq, 0., file, refresh);
+		if (table == "RQg2Qgg") return new rates_2to3(x, 16/2, 0., file, refresh);
+	}
+	if (f_3to2 * x = dynamic_cast<f_3to2*>(xsection)){
+		if (table == "RQqg2Qq") return new rates_3to2(x, dq*16, 0., 0., file, refresh);
+		if (table == "RQgg2Qg") return new rates_3to2(x, 16*16/2, 0., 0., file, refresh);
+	}
+	throw std::invalid_argument("make_table: " + table + " does not match its cross section");
+}
+
+size_t table_set::add_node(std::function<void()> build, std::vector<size_t> depends_on){
+	build_node node = {build, depends_on};
+	nodes.push_back(node);
+	return nodes.size()-1;
+}
+
+void table_set::build_all(void){
+	// nodes only depend on earlier nodes, so launching them in order
+	// guarantees that the futures they wait for already exist
+	std::vector< std::shared_future<void> > finished(nodes.size());
+	for (size_t i=0; i<nodes.size(); i++){
+		finished[i] = std::async(std::launch::async, [this, i, &finished]{
+			for (size_t d : nodes[i].depends_on) finished[d].get();
+			nodes[i].build();
+		}).share();
+	}
+	for (auto&& f : finished) f.get();
+	std::cout << "# " << nodes.size() << " tables ready" << std::endl;
+}
@@ -0,0 +1,64 @@
+#ifndef TABLE_SET_H
+#define TABLE_SET_H
+
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Xsection.h"
+#include "rates.h"
+
+//=============the full set of LBT tables=======================================
+// Builds the cross-section and rate tables of all enabled channels as a small
+// dependency graph: a rate table only waits for its own cross-section table,
+// so independent channels (Qq vs Qg, 2->2 vs 2->3 vs 3->2) are tabulated at
+// the same time, all feeding cells into the shared thread pool. Every table is
+// written to disk as soon as it is finished while the others keep computing,
+// and the cold-start time approaches the longest X -> R chain instead of the
+// sum of all builds.
+// With table_options().fuse_channels the 2->3 cross sections of Q+q and Q+g
+// share their integrations (see fused_cells), each computes about half of the
+// cells for both.
+// channels combines the rate tables of all enabled channels for picking a
+// channel, see channel_rates.
+class table_set{
+private:
+	double M;
+	size_t Nf;
+	std::string folder;
+	struct build_node{
+		std::function<void()> build;
+		std::vector<size_t> depends_on;
+	};
+	std::vector<build_node> nodes;
+	std::unique_ptr<fused_cells> fused_Q2Qg;
+	size_t add_node(std::function<void()> build, std::vector<size_t> depends_on);
+	tabulated_table * make(std::string table, bool refresh, tabulated_table * xsection = NULL,
+						   fused_cells * fused = NULL);
+	void build_all(void);
+public:
+	Xsection_2to2 * x_Qq_Qq, * x_Qg_Qg;
+	Xsection_2to3 * x_Qq_Qqg, * x_Qg_Qgg;
+	f_3to2 * x_Qqg_Qq, * x_Qgg_Qg;
+	rates_2to2 * r_Qq_Qq, * r_Qg_Qg;
+	rates_2to3 * r_Qq_Qqg, * r_Qg_Qgg;
+	rates_3to2 * r_Qqg_Qq, * r_Qgg_Qg;
+	channel_rates * channels;
+	table_set(double M_, size_t Nf_, std::string folder_,
+			  bool elastic, bool inelastic, bool detailed_balance, bool refresh);
+	~table_set();
+	// all tables by their file stem, e.g. "XQq2Qq" or "RQg2Qgg"
+	static std::vector<std::string> table_names(void);
+	// the cross-section table a rate table is integrated from, "" for X tables
+	static std::string dependency(std::string table);
+	static std::string dataset_name(std::string table);
+	// construct a single table, xsection must be its dependency for rates;
+	// fused (2 channels) lets XQq2Qqg and XQg2Qgg share their integrations
+	static tabulated_table * make_table(std::string table, double M, size_t Nf, std::string folder,
+										bool refresh, tabulated_table * xsection = NULL,
+										fused_cells * fused = NULL);
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "table_spec.h"
+
+table_spec & table_specs(void){
+	static table_spec spec;
+	return spec;
+}
+
+table_spec::table_spec(void)
+:	profile("production"), grid_scale(1.), epsrel_scale(1.), calls_scale(1.)
+{
+}
+
+void table_spec::set_profile(std::string name){
+	if (name == "production"){ grid_scale = 1.; epsrel_scale = 1.; calls_scale = 1.; }
+	else if (name == "fast-dev"){ grid_scale = 0.25; epsrel_scale = 10.; calls_scale = 0.1; }
+	else if (name == "high-precision"){ grid_scale = 2.; epsrel_scale = 0.1; calls_scale = 4.; }
+	else throw std::invalid_argument("table_spec: unknown profile " + name);
+	profile = name;
+}
+
+void table_spec::set(std::string key, double value){
+	if (key == "grid_scale") grid_scale = value;
+	else if (key == "epsrel_scale") epsrel_scale = value;
+	else if (key == "calls_scale") calls_scale = value;
+	else values[key] = value;
+}
+
+void table_spec::read(std::string filename){
+	std::ifstream file(filename);
+	if (!file) throw std::runtime_error("table_spec: cannot open " + filename);
+	std::string line;
+	for (size_t n=1; std::getline(file, line); n++){
+		line = line.substr(0, line.find('#'));
+		size_t eq = line.find('=');
+		std::istringstream key_stream(line.substr(0, eq)), value_stream;
+		std::string key, value;
+		key_stream >> key;
+		if (key.empty()) continue;
+		if (eq != std::string::npos){
+			value_stream.str(line.substr(eq+1));
+			value_stream >> value;
+		}
+		if (value.empty())
+			throw std::runtime_error(filename + ":" + std::to_string(n) + ": expected key = value");
+		if (key == "profile") set_profile(value);
+		else{
+			std::istringstream number(value);
+			double x;
+			if (number >> x && number.eof()) set(key, x);
+			else set_choice(key, value);
+		}
+	}
+	std::cout << "# table spec " << filename << ", profile " << profile << std::endl;
+}
+
+double table_spec::value(std::string key, double compiled) const{
+	auto it = values.find(key);
+	return (it == values.end()) ? compiled : it->second;
+}
+
+size_t table_spec::points(std::string key, size_t compiled, size_t minimum) const{
+	auto it = values.find(key);
+	if (it != values.end()){
+		double N = it->second;
+		if (!(N >= double(minimum)) || N != std::floor(N)){
+			std::ostringstream message;
+			message << "table_spec: " << key << " = " << N << " is not an integer of at least " << minimum;
+			throw std::invalid_argument(message.str());
+		}
+		return size_t(N);
+	}
+	// scale the number of intervals
+	return std::max(size_t(2), size_t(std::lround((compiled-1.)*grid_scale)) + 1);
+}
+
+std::string table_spec::choice(std::string key, std::string compiled) const{
+	auto it = choices.find(key);
+	return (it == choices.end()) ? compiled : it->second;
+}
+
+grid_axis table_spec::axis(std::string key, double low, double high, size_t N) const{
+	std::string spacing = choice(key + "_spacing", "uniform");
+	if (spacing == "uniform") return grid_axis(low, high, N);
+	if (spacing == "log"){
+		if (low <= 0.) throw std::invalid_argument("table_spec: " + key + " needs a positive low end for log spacing");
+		return grid_axis(low, high, N, grid_axis::logarithmic);
+	}
+	if (spacing.compare(0, 6, "power:") == 0){
+		std::istringstream number(spacing.substr(6));
+		double exponent;
+		if (number >> exponent && number.eof() && exponent > 0.)
+			return grid_axis(low, high, N, grid_axis::power, exponent);
+	}
+	throw std::invalid_argument("table_spec: unknown spacing " + spacing + " of " + key);
+}
+
+size_t table_spec::calls(size_t compiled) const{
+	return std::max(size_t(100), size_t(std::lround(compiled*calls_scale)));
+}
@@ -0,0 +1,60 @@
+#ifndef TABLE_SPEC_H
+#define TABLE_SPEC_H
+
+#include <cstdlib>
+#include <map>
+#include <string>
+#include "grid_table.h"
+
+//=============table specification=============================================
+// Grid sizes, ranges and integrator accuracy of all tables, chosen at run
+// time instead of being compiled into the constructors. A spec starts from a
+// named profile that scales the compiled defaults:
+//   production      the compiled grids and tolerances
+//   fast-dev        about 1/4 of the points per axis, tolerances x10, calls /10
+//   high-precision  twice the points per axis, tolerances /10, calls x4
+// and may be refined by a file of "key = value" lines ('#' starts a comment):
+//   profile = fast-dev
+//   Xsection_2to3.N_T = 8
+//   rates_2to2.T_high = 1.0
+//   epsrel_scale = 0.5
+//   rates_3to2.integrator = sobol
+//   rates_2to2.E1_spacing = log
+// Grid keys are "<class>.<attribute>" with the attribute names of the table
+// files (N_T, T_high, E1_low, ...); an explicit number of points is used as
+// is, not scaled by the profile. Values that are not numbers are kept as
+// named choices, e.g. the integrator backend of a table.
+// Specs are set up before the tables are built and only read afterwards.
+class table_spec{
+private:
+	std::string profile;
+	double grid_scale, epsrel_scale, calls_scale;
+	std::map<std::string, double> values;
+	std::map<std::string, std::string> choices;
+public:
+	table_spec(void);
+	void set_profile(std::string name);
+	void set(std::string key, double value);
+	void set_choice(std::string key, std::string value) {choices[key] = value;};
+	void read(std::string filename);
+	std::string profile_name(void) const {return profile;};
+	// a range or other parameter of a table
+	double value(std::string key, double compiled) const;
+	// number of grid points along an axis, both ends are kept; an explicit
+	// value must be an integer of at least minimum
+	size_t points(std::string key, size_t compiled, size_t minimum = 2) const;
+	// a named setting such as "<class>.integrator"
+	std::string choice(std::string key, std::string compiled) const;
+	// the axis "<class>.<name>" from low to high with N points, spaced by the
+	// choice "<class>.<name>_spacing": "uniform" (the default), "log" or
+	// "power:<exponent>", see grid_axis
+	grid_axis axis(std::string key, double low, double high, size_t N) const;
+	// integrator settings of the call sites
+	double epsrel(double compiled) const {return compiled*epsrel_scale;};
+	size_t calls(size_t compiled) const;
+	double get_epsrel_scale(void) const {return epsrel_scale;};
+	double get_calls_scale(void) const {return calls_scale;};
+};
+table_spec & table_specs(void);
+
+#endif
@@ -0,0 +1,968 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+#include <gsl/gsl_errno.h>
+#include "H5Cpp.h"
+
+#include "tabulation.h"
+#include "scheduler.h"
+#include "utility.h"
+#include "integration.h"
+#include "adaptive_grid.h"
+#include "table_spec.h"
+
+tabulation_options & table_options(void){
+	static tabulation_options options = {600., 3, 0., 4, false, "", 0., false};
+	return options;
+}
+
+//=============tabulation driver===============================================
+tabulation_driver::tabulation_driver(std::string name_, std::vector<size_t> shape_, size_t Ncomponents_)
+:	name(name_), shape(shape_), Ncells(1), Ncomponents(Ncomponents_), Nretried(0), fill_neighbours(true)
+{
+	for (auto&& n : shape) Ncells *= n;
+	first_cell = 0;
+	last_cell = Ncells;
+	Ngroup = 1;
+	Dgroup = 0;
+	completed.assign(Ncells, 0);
+	cell_relerr.assign(Ncells, std::nan(""));
+	cell_iterations.assign(Ncells, 0);
+}
+
+void tabulation_driver::restrict_to(size_t first, size_t last){
+	if (first >= last || last > Ncells)
+		throw std::out_of_range(name + ": cell range outside of the table");
+	first_cell = first;
+	last_cell = last;
+}
+
+void tabulation_driver::group_cells(size_t Ngroup_, std::function<void(size_t, double *)> compute_group_){
+	size_t D = 0, N = 1;
+	while (N < Ngroup_ && D < shape.size()) N *= shape[shape.size() - ++D];
+	if (N != Ngroup_)
+		throw std::invalid_argument(name + ": cell groups are not made of the innermost axes");
+	Ngroup = Ngroup_;
+	Dgroup = D;
+	compute_group = compute_group_;
+}
+
+void tabulation_driver::unravel(size_t cell, size_t * index) const{
+	for (size_t d=shape.size(); d-- > 0; ){
+		index[d] = cell%shape[d];
+		cell /= shape[d];
+	}
+}
+
+size_t tabulation_driver::walk_position(size_t cell) const{
+	// a reflected mixed-radix Gray code: the walk through the inner axes is
+	// reversed whenever the index of the enclosing axis is odd
+	std::vector<size_t> index(shape.size());
+	unravel(cell, index.data());
+	size_t position = 0, span = 1;
+	for (size_t d=shape.size()-Dgroup; d-- > 0; ){
+		if (index[d]%2) position = span - 1 - position;
+		position += index[d]*span;
+		span *= shape[d];
+	}
+	return position;
+}
+
+bool tabulation_driver::neighbours(size_t cell1, size_t cell2) const{
+	std::vector<size_t> index1(shape.size()), index2(shape.size());
+	unravel(cell1, index1.data());
+	unravel(cell2, index2.data());
+	size_t distance = 0;
+	for (size_t d=0; d+Dgroup<shape.size(); d++)
+		distance += (index1[d] > index2[d]) ? index1[d]-index2[d] : index2[d]-index1[d];
+	return distance == 1;
+}
+
+size_t tabulation_driver::Ncompleted(void) const{
+	size_t N = 0;
+	for (auto&& c : completed) N += c;
+	return N;
+}
+
+void tabulation_driver::checkpoint_to(std::string filename_, std::string datasetname_, std::function<void(std::string)> save_){
+	filename = filename_;
+	datasetname = datasetname_;
+	save = save_;
+}
+
+bool tabulation_driver::is_checkpoint(std::string filename_, std::string datasetname_){
+	if (!boost::filesystem::exists(filename_)) return false;
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
+	H5::H5File file(filename_, H5F_ACC_RDONLY);
+	std::string bitmap = datasetname_ + "-completed";
+	return H5Lexists(file.getId(), bitmap.c_str(), H5P_DEFAULT) > 0;
+}
+
+std::vector<unsigned char> tabulation_driver::read_completed(std::string filename_, std::string datasetname_,
+															const std::vector<size_t> & shape_){
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
+	H5::H5File file(filename_, H5F_ACC_RDONLY);
+	H5::DataSet dataset = file.openDataSet(datasetname_ + "-completed");
+	H5::DataSpace dataspace = dataset.getSpace();
+	std::vector<hsize_t> dims(size_t(dataspace.getSimpleExtentNdims()));
+	dataspace.getSimpleExtentDims(dims.data(), NULL);
+	bool match = (dims.size() == shape_.size());
+	for (size_t d=0; match && d<dims.size(); d++) match = (dims[d] == shape_[d]);
+	if (!match)
+		throw std::runtime_error(filename_ + ": checkpoint grid does not match the table grid");
+	std::vector<unsigned char> completed_(size_t(dataspace.getSimpleExtentNpoints()));
+	dataset.read(completed_.data(), H5::PredType::NATIVE_UINT8);
+	return completed_;
+}
+
+void tabulation_driver::write_completed(std::string filename_, std::string datasetname_,
+										const std::vector<size_t> & shape_, const unsigned char * completed_){
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
+	H5::H5File file(filename_, H5F_ACC_RDWR);
+	std::vector<hsize_t> dims(shape_.begin(), shape_.end());
+	H5::DataSpace dataspace(dims.size(), dims.data());
+	H5::DataSet dataset = file.createDataSet(datasetname_ + "-completed",
+								H5::PredType::NATIVE_UINT8, dataspace);
+	dataset.write(completed_, H5::PredType::NATIVE_UINT8);
+}
+
+void tabulation_driver::write_accuracy(std::string filename_, std::string datasetname_,
+									   const std::vector<size_t> & shape_, const double * relerr_,
+									   const size_t * iterations_){
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
+	H5::H5File file(filename_, H5F_ACC_RDWR);
+	std::vector<hsize_t> dims(shape_.begin(), shape_.end());
+	H5::DataSpace dataspace(dims.size(), dims.data());
+	for (std::string name : {datasetname_ + "-relerr", datasetname_ + "-iterations"}){
+		if (H5Lexists(file.getId(), name.c_str(), H5P_DEFAULT) > 0) file.unlink(name);
+	}
+	file.createDataSet(datasetname_ + "-relerr", type<double>(), dataspace).write(relerr_, type<double>());
+	file.createDataSet(datasetname_ + "-iterations", type<size_t>(), dataspace).write(iterations_, type<size_t>());
+}
+
+void tabulation_driver::load_completed(std::string filename_, std::string datasetname_){
+	completed = read_completed(filename_, datasetname_, shape);
+	{
+		// the accuracy of the cells done so far, if the checkpoint has it
+		std::lock_guard<std::mutex> lock(hdf5_mutex());
+		H5::H5File file(filename_, H5F_ACC_RDONLY);
+		std::string relerr = datasetname_ + "-relerr", iterations = datasetname_ + "-iterations";
+		if (H5Lexists(file.getId(), relerr.c_str(), H5P_DEFAULT) > 0
+			&& H5Lexists(file.getId(), iterations.c_str(), H5P_DEFAULT) > 0){
+			file.openDataSet(relerr).read(cell_relerr.data(), type<double>());
+			file.openDataSet(iterations).read(cell_iterations.data(), type<size_t>());
+		}
+	}
+	std::cout << "# resuming " << name << ": " << Ncompleted() << " of "
+			  << Ncells << " cells already done" << std::endl;
+}
+
+bool tabulation_driver::checkpoint_due(void) const{
+	double interval = table_options().checkpoint_interval;
+	if (!save || interval <= 0.) return false;
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - last_flush;
+	return elapsed.count() > interval;
+}
+
+void tabulation_driver::flush(void){
+	// the table itself goes through the owner's save_to_file(), which
+	// truncates the file; the bitmap is appended afterwards, and only the
+	// complete checkpoint replaces the previous one
+	std::string tmpname = filename + ".tmp";
+	save(tmpname);
+	write_completed(tmpname, datasetname, shape, completed.data());
+	write_accuracy(tmpname, datasetname, shape, cell_relerr.data(), cell_iterations.data());
+	boost::filesystem::rename(tmpname, filename);
+	last_flush = std::chrono::steady_clock::now();
+	std::cout << "# checkpoint " << name << ": " << Ncompleted() << " of "
+			  << Ncells << " cells" << std::endl;
+}
+
+void tabulation_driver::run(double * table, std::function<void(size_t, double *)> compute){
+	thread_pool & pool = thread_pool::instance();
+	size_t Nworkers = pool.size()+1; // the last slot counts non-pool threads
+	std::unique_ptr<std::atomic<size_t>[]> counts(new std::atomic<size_t>[Nworkers]);
+	for (size_t i=0; i<Nworkers; i++) counts[i] = 0;
+	// the first cells of the groups with missing cells
+	size_t G = compute_group ? Ngroup : 1;
+	std::function<void(size_t, double *)> & compute_task = compute_group ? compute_group : compute;
+	std::vector<size_t> missing;
+	for (size_t n=first_cell; n<last_cell; n++){
+		if (!completed[n] && (missing.empty() || missing.back() != n/G*G)) missing.push_back(n/G*G);
+	}
+	std::vector< std::pair<size_t, size_t> > walk;
+	for (auto&& n : missing) walk.push_back(std::make_pair(walk_position(n), n));
+	std::sort(walk.begin(), walk.end());
+	for (size_t k=0; k<walk.size(); k++) missing[k] = walk[k].second;
+	// the previous task of every thread, tasks of other runs never match
+	static std::atomic<size_t> Nruns(0);
+	size_t run_id = ++Nruns;
+	struct previous_task{ size_t run, cell; };
+	static thread_local previous_task previous = {0, 0};
+#ifndef NDEBUG
+	std::unique_ptr<std::atomic<unsigned int>[]> writes(new std::atomic<unsigned int>[Ncells]);
+	for (size_t n=0; n<Ncells; n++) writes[n] = completed[n];
+#endif
+	last_flush = std::chrono::steady_clock::now();
+
+	// each task owns exactly the missing cells of [first, first+G) and writes
+	// only there; the table lock keeps the scatter apart from a concurrent checkpoint
+	pool.parallel_for(missing.size(), [&](size_t k){
+		size_t first = missing[k];
+		if (first >= Ncells) throw std::logic_error(name + ": cell index out of range");
+		if (previous.run != run_id || !neighbours(previous.cell, first)) forget_warm_start();
+		previous.run = run_id;
+		previous.cell = first;
+		std::vector<double> value(G*Ncomponents);
+		bool retried = false;
+		bool success = attempt(name, first, G*Ncomponents, value.data(), compute_task, &retried);
+		double relerr = current_integration().relerr;
+		size_t Niterations = current_integration().Niterations;
+		if (retried) Nretried++;
+		std::vector<size_t> cells;
+		for (size_t n=std::max(first, first_cell); n<std::min(first+G, last_cell); n++){
+			if (!completed[n]) cells.push_back(n);
+		}
+#ifndef NDEBUG
+		for (auto&& n : cells){
+			if (writes[n].fetch_add(1) != 0)
+				throw std::logic_error(name + ": overlapping write to cell " + std::to_string(n));
+		}
+#endif
+		{
+			std::lock_guard<std::mutex> lock(m_table);
+			for (auto&& n : cells){
+				for (size_t c=0; c<Ncomponents; c++) table[c*Ncells + n] = value[(n-first)*Ncomponents + c];
+				cell_relerr[n] = relerr;
+				cell_iterations[n] = Niterations;
+				// a failed cell stays incomplete, a resumed build retries it
+				if (success) completed[n] = 1;
+				else failed_cells.push_back(n);
+			}
+			if (checkpoint_due()) flush();
+		}
+		counts[pool.worker_index()] += cells.size();
+	});
+
+#ifndef NDEBUG
+	for (size_t n=first_cell; n<last_cell; n++){
+		if (writes[n] != 1)
+			throw std::logic_error(name + ": cell " + std::to_string(n) + " was not computed");
+	}
+#endif
+	if (fill_neighbours && !failed_cells.empty()) fill_failed(table);
+	cells_per_worker.resize(Nworkers);
+	for (size_t i=0; i<Nworkers; i++) cells_per_worker[i] = counts[i];
+	report();
+}
+
+void tabulation_driver::report(void) const{
+	std::cout << "# " << Ncells << " cells, per worker:";
+	for (size_t i=0; i+1<cells_per_worker.size(); i++) std::cout << " " << cells_per_worker[i];
+	if (cells_per_worker.back() > 0)
+		std::cout << " (+" << cells_per_worker.back() << " on calling threads)";
+	std::cout << std::endl;
+	if (Nretried > 0 || !failed_cells.empty())
+		std::cout << "# " << Nretried << " cells retried, " << failed_cells.size()
+				  << (fill_neighbours ? " failed and filled from neighbours" : " failed") << std::endl;
+	double max_relerr = 0.;
+	size_t Nknown = 0, Niterations = 0;
+	for (size_t n=first_cell; n<last_cell; n++){
+		if (std::isnan(cell_relerr[n])) continue;
+		max_relerr = std::max(max_relerr, cell_relerr[n]);
+		Niterations += cell_iterations[n];
+		Nknown++;
+	}
+	if (Nknown > 0)
+		std::cout << "# largest relative error " << max_relerr << ", "
+				  << double(Niterations)/Nknown << " iterations per cell" << std::endl;
+}
+
+bool tabulation_driver::attempt(const std::string & name, size_t cell, size_t Ncomponents, double * value,
+								std::function<void(size_t, double *)> & compute, bool * retried){
+	integration_status & status = current_integration();
+	size_t max_level = table_options().max_retries;
+	std::string reason;
+	for (size_t level=0; level<=max_level; level++){
+		status.level = level;
+		status.Nfailures = 0;
+		status.relerr = 0.;
+		status.Niterations = 0;
+		bool success = true;
+		try{
+			compute(cell, value);
+			if (status.Nfailures > 0){
+				success = false;
+				reason = gsl_strerror(status.last_error);
+			}
+			for (size_t c=0; c<Ncomponents; c++){
+				if (!std::isfinite(value[c])){
+					success = false;
+					reason = "non-finite value";
+				}
+			}
+		}
+		catch (std::exception & e){
+			success = false;
+			reason = e.what();
+		}
+		if (level == 1 && retried) *retried = true;
+		if (success){
+			status.level = 0;
+			return true;
+		}
+	}
+	status.level = 0;
+	std::cerr << "# " << name << ": cell " << cell << " failed after "
+			  << max_level << " retries (" << reason << ")" << std::endl;
+	for (size_t c=0; c<Ncomponents; c++) value[c] = std::nan("");
+	return false;
+}
+
+void tabulation_driver::fill_failed(double * table){
+	// every pass replaces a failed value by the mean of its valid neighbours
+	// along all axes, so larger holes are closed from their rims inwards;
+	// cells outside of a shard are not valid either
+	std::vector<unsigned char> valid(completed);
+	std::vector<size_t> holes = failed_cells, index(shape.size());
+	while (!holes.empty()){
+		std::vector<size_t> remaining, filled;
+		for (auto&& n : holes){
+			unravel(n, index.data());
+			std::vector<double> sum(Ncomponents, 0.);
+			size_t Nneighbours = 0, stride = 1;
+			for (size_t d=shape.size(); d-- > 0; ){
+				if (index[d] > 0 && valid[n-stride]){
+					for (size_t c=0; c<Ncomponents; c++) sum[c] += table[c*Ncells + n-stride];
+					Nneighbours++;
+				}
+				if (index[d]+1 < shape[d] && valid[n+stride]){
+					for (size_t c=0; c<Ncomponents; c++) sum[c] += table[c*Ncells + n+stride];
+					Nneighbours++;
+				}
+				stride *= shape[d];
+			}
+			if (Nneighbours == 0){
+				remaining.push_back(n);
+				continue;
+			}
+			for (size_t c=0; c<Ncomponents; c++) table[c*Ncells + n] = sum[c]/Nneighbours;
+			filled.push_back(n);
+		}
+		// nothing valid to fill from: the values stay NaN
+		if (filled.empty()) break;
+		for (auto&& n : filled) valid[n] = 1;
+		holes = remaining;
+	}
+}
+
+void tabulation_driver::write_summary(void){
+	if (filename.empty()) return;
+	write_accuracy(filename, datasetname, shape, cell_relerr.data(), cell_iterations.data());
+	size_t Nfailed = failed_cells.size(), Nretried_ = Nretried, Nlisted = max_failed_listed;
+	std::vector<size_t> listed(failed_cells);
+	listed.resize(std::min(Nfailed, Nlisted));
+	std::sort(listed.begin(), listed.end());
+
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
+	H5::H5File file(filename, H5F_ACC_RDWR);
+	H5::DataSet dataset = file.openDataSet(datasetname);
+	hdf5_add_scalar_attr(dataset, "N_retried_cells", Nretried_);
+	hdf5_add_scalar_attr(dataset, "N_failed_cells", Nfailed);
+	if (!listed.empty()){
+		hsize_t dims[1] = {listed.size()};
+		H5::DataSpace dataspace(1, dims);
+		H5::Attribute attr = dataset.createAttribute("failed_cells", type<size_t>(), dataspace);
+		attr.write(type<size_t>(), listed.data());
+	}
+}
+
+//=============lazy table cells================================================
+lazy_cells::lazy_cells(std::string name_, std::vector<size_t> shape_, size_t Ncomponents_,
+					   double * table_, std::function<void(size_t, double *)> compute_,
+					   const std::vector<unsigned char> & completed)
+:	name(name_), shape(shape_), Ncells(1), Ncomponents(Ncomponents_),
+	table(table_), compute(compute_), Nnew(0)
+{
+	for (auto&& n : shape) Ncells *= n;
+	state.reset(new std::atomic<unsigned char>[Ncells]);
+	for (size_t n=0; n<Ncells; n++)
+		state[n] = (n < completed.size() && completed[n]) ? ready : empty;
+}
+
+void lazy_cells::require(size_t cell){
+	if (state[cell].load(std::memory_order_acquire) == ready) return;
+	unsigned char expected = empty;
+	if (state[cell].compare_exchange_strong(expected, computing)){
+		std::vector<double> value(Ncomponents);
+		if (!tabulation_driver::attempt(name, cell, Ncomponents, value.data(), compute))
+			fill_from_neighbours(cell, value.data());
+		for (size_t c=0; c<Ncomponents; c++) table[c*Ncells + cell] = value[c];
+		Nnew++;
+		{
+			std::lock_guard<std::mutex> lock(m_ready);
+			state[cell].store(ready, std::memory_order_release);
+		}
+		cv_ready.notify_all();
+		return;
+	}
+	std::unique_lock<std::mutex> lock(m_ready);
+	cv_ready.wait(lock, [this, cell]{ return state[cell].load(std::memory_order_acquire) == ready; });
+}
+
+void lazy_cells::fill_from_neighbours(size_t cell, double * value){
+	// only neighbours that are ready already: computing empty ones could walk
+	// a whole failing region recursively, and neighbours being computed right
+	// now (possibly by this very thread, further up the stack) are not waited for
+	std::vector<double> sum(Ncomponents, 0.);
+	size_t Nneighbours = 0, stride = 1;
+	for (size_t d=shape.size(); d-- > 0; ){
+		size_t i = (cell/stride)%shape[d];
+		size_t neighbours[2] = {cell-stride, cell+stride};
+		bool inside[2] = {i > 0, i+1 < shape[d]};
+		for (size_t k=0; k<2; k++){
+			if (!inside[k] || state[neighbours[k]].load(std::memory_order_acquire) != ready) continue;
+			bool finite = true;
+			for (size_t c=0; c<Ncomponents; c++) finite = finite && std::isfinite(table[c*Ncells + neighbours[k]]);
+			if (!finite) continue;
+			for (size_t c=0; c<Ncomponents; c++) sum[c] += table[c*Ncells + neighbours[k]];
+			Nneighbours++;
+		}
+		stride *= shape[d];
+	}
+	if (Nneighbours == 0) return; // stays NaN
+	for (size_t c=0; c<Ncomponents; c++) value[c] = sum[c]/Nneighbours;
+}
+
+void lazy_cells::require_box(const size_t * lower, const size_t * count, size_t D){
+	size_t Npoints = 1;
+	for (size_t d=0; d<D; d++) Npoints *= count ? count[d] : 2;
+	for (size_t p=0; p<Npoints; p++){
+		size_t cell = 0, r = p;
+		for (size_t d=0; d<D; d++){
+			size_t Nd = count ? count[d] : 2;
+			size_t i = std::min(lower[d] + r%Nd, shape[d]-1);
+			r /= Nd;
+			cell = cell*shape[d] + i;
+		}
+		require(cell);
+	}
+}
+
+std::vector<unsigned char> lazy_cells::completed(void) const{
+	std::vector<unsigned char> bitmap(Ncells);
+	for (size_t n=0; n<Ncells; n++) bitmap[n] = (state[n] == ready);
+	return bitmap;
+}
+
+//=============fused channels==================================================
+bool fused_cells::taken_by_all(const entry & e) const{
+	for (size_t c=0; c<Nchannels; c++)
+		if (active[c] && !e.taken[c]) return false;
+	return true;
+}
+
+bool fused_cells::get(const std::vector<double> & key, size_t channel, size_t Nvalues, double * result,
+					  std::function<void(double *)> compute_all){
+	std::unique_lock<std::mutex> lock(m);
+	auto found = groups.find(key);
+	while (found != groups.end() && !found->second.ready){
+		cv_ready.wait(lock);
+		found = groups.find(key);
+	}
+	if (found != groups.end() && !found->second.taken[channel]){
+		entry & e = found->second;
+		std::copy_n(e.values.data() + channel*Nvalues, Nvalues, result);
+		integration_status & status = current_integration();
+		status.Nfailures += e.Nfailures;
+		if (e.Nfailures > 0) status.last_error = e.last_error;
+		status.relerr = std::max(status.relerr, e.relerr);
+		status.Niterations += e.Niterations;
+		e.taken[channel] = true;
+		if (taken_by_all(e)) groups.erase(found);
+		return true;
+	}
+	size_t Nactive = size_t(std::count(active.begin(), active.end(), true));
+	if (Nactive < 2 || !active[channel]){
+		if (found != groups.end()) groups.erase(found);
+		return false;
+	}
+
+	// a new group, or a retry of this channel: compute for everyone
+	entry & e = groups[key];
+	e.values.assign(Nchannels*Nvalues, 0.);
+	e.taken.assign(Nchannels, false);
+	e.ready = false;
+	lock.unlock();
+	try{
+		compute_all(e.values.data());
+	}
+	catch (...){
+		lock.lock();
+		groups.erase(key);
+		cv_ready.notify_all();
+		throw;
+	}
+	lock.lock();
+	const integration_status & status = current_integration();
+	e.Nfailures = status.Nfailures;
+	e.last_error = status.last_error;
+	e.relerr = status.relerr;
+	e.Niterations = status.Niterations;
+	e.ready = true;
+	e.taken[channel] = true;
+	std::copy_n(e.values.data() + channel*Nvalues, Nvalues, result);
+	if (taken_by_all(e)) groups.erase(key);
+	cv_ready.notify_all();
+	return true;
+}
+
+void fused_cells::leave(size_t channel){
+	std::lock_guard<std::mutex> lock(m);
+	active[channel] = false;
+	for (auto it = groups.begin(); it != groups.end(); ){
+		if (it->second.ready && taken_by_all(it->second)) it = groups.erase(it);
+		else ++it;
+	}
+}
+
+//=============table inputs====================================================
+namespace {
+	// bump whenever integrands, tolerances or the table layout change,
+	// it invalidates all existing tables
+	const char * table_code_version = "1";
+
+	// 64-bit FNV-1a
+	size_t fnv1a(const std::string & text){
+		uint64_t h = 14695981039346656037ULL;
+		for (char c : text){ h ^= static_cast<unsigned char>(c); h *= 1099511628211ULL; }
+		return size_t(h);
+	}
+}
+
+std::map<std::string, std::string> & table_inputs::globals(void){
+	static std::map<std::string, std::string> values;
+	return values;
+}
+
+size_t table_inputs::physics_hash(void) const{
+	std::string text;
+	for (auto&& g : globals()) text += g.second;
+	return fnv1a(text + physics);
+}
+
+size_t table_inputs::hash(void) const{
+	std::ostringstream s;
+	s << physics_hash() << "\n" << grid;
+	return fnv1a(s.str());
+}
+
+void tabulated_table::collect_inputs(void){
+	table_inputs inputs;
+	inputs.add("table", boost::filesystem::path(table_filename).stem().string());
+	inputs.add("code_version", table_code_version);
+	// the grids enter through describe_inputs()
+	inputs.add("epsrel_scale", table_specs().get_epsrel_scale());
+	inputs.add("calls_scale", table_specs().get_calls_scale());
+	if (table_options().refine_tolerance > 0.){
+		inputs.add("refine_tolerance", table_options().refine_tolerance);
+		inputs.add("refine_max_level", table_options().refine_max_level);
+	}
+	describe_inputs(inputs);
+	physics_key = inputs.physics_hash();
+	input_key = inputs.hash();
+}
+
+bool tabulated_table::inputs_match(std::string filename, std::string datasetname){
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
+	H5::H5File file(filename, H5F_ACC_RDONLY);
+	H5::DataSet dataset = file.openDataSet(datasetname);
+	// files written before the hashes existed are trusted as before
+	if (!dataset.attrExists("physics_hash")) return true;
+	size_t key;
+	hdf5_read_scalar_attr(dataset, "physics_hash", key);
+	return key == physics_key;
+}
+
+void tabulated_table::stamp_inputs(std::string filename, std::string datasetname){
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
+	H5::H5File file(filename, H5F_ACC_RDWR);
+	H5::DataSet dataset = file.openDataSet(datasetname);
+	for (auto&& name : {"physics_hash", "input_hash"})
+		if (dataset.attrExists(name)) dataset.removeAttr(name);
+	hdf5_add_scalar_attr(dataset, "physics_hash", physics_key);
+	hdf5_add_scalar_attr(dataset, "input_hash", input_key);
+}
+
+std::string tabulated_table::cache_path(void){
+	std::ostringstream s;
+	s << table_options().cache_dir << "/" << boost::filesystem::path(table_filename).stem().string()
+	  << "-" << std::hex << std::setw(16) << std::setfill('0') << input_key << ".hdf5";
+	return s.str();
+}
+
+bool tabulated_table::fetch_from_cache(std::string filename){
+	if (table_options().cache_dir.empty()) return false;
+	std::string cached = cache_path();
+	if (!boost::filesystem::exists(cached)) return false;
+	boost::filesystem::copy_file(cached, filename, boost::filesystem::copy_option::overwrite_if_exists);
+	std::cout << "# " << filename << " served from " << cached << std::endl;
+	return true;
+}
+
+void tabulated_table::store_in_cache(std::string filename){
+	if (table_options().cache_dir.empty()) return;
+	try{
+		// copy under a private name first, concurrent workers may store
+		// the same table and readers must never see a partial file
+		std::string cached = cache_path();
+		boost::filesystem::path tmp = cached + "." + boost::filesystem::unique_path().string();
+		boost::filesystem::create_directories(table_options().cache_dir);
+		boost::filesystem::copy_file(filename, tmp);
+		boost::filesystem::rename(tmp, cached);
+	}
+	catch (std::exception & e){
+		std::cerr << "# " << filename << ": not stored in the cache (" << e.what() << ")" << std::endl;
+	}
+}
+
+//=============table life cycle================================================
+void tabulated_table::load_or_tabulate(std::string filename, std::string datasetname, bool refresh){
+	table_filename = filename;
+	table_datasetname = datasetname;
+	collect_inputs();
+	bool fileexist = boost::filesystem::exists(filename), stale = false;
+	if (fileexist && (!refresh) && (!inputs_match(filename, datasetname))){
+		std::cout << "# " << filename << " was computed from different inputs, recomputing" << std::endl;
+		refresh = stale = true;
+	}
+	// an explicit refresh always recomputes
+	if (((!fileexist && !refresh) || stale) && fetch_from_cache(filename)){
+		fileexist = true;
+		refresh = false;
+	}
+	bool resume = fileexist && (!refresh) && tabulation_driver::is_checkpoint(filename, datasetname);
+	if (fileexist && (!refresh) && (!resume)){
+		std::cout << "# loading existing table" << std::endl;
+		read_from_file(filename, datasetname);
+		return;
+	}
+	if (resume){
+		// grid and partial values come from the checkpoint
+		read_from_file(filename, datasetname);
+		collect_inputs();
+	}
+	if (table_options().lazy){
+		std::vector<unsigned char> completed;
+		if (resume) completed = tabulation_driver::read_completed(filename, datasetname, table_shape());
+		else std::cout << "# table cells are computed at their first lookup" << std::endl;
+		lazy.reset(new lazy_cells(filename, table_shape(), table_components(), table_data(),
+			[this](size_t cell, double * result){ this->tabulate_cell(cell, result); }, completed));
+		return;
+	}
+	if (!resume){
+		std::cout << "# Populating table with new calculation" << std::endl;
+		if (table_options().refine_tolerance > 0. && tabulate_adaptive(filename, datasetname)){
+			stamp_inputs(filename, datasetname);
+			store_in_cache(filename);
+			return;
+		}
+	}
+
+	tabulation_driver driver(filename, table_shape(), table_components());
+	if (resume) driver.load_completed(filename, datasetname);
+	driver.checkpoint_to(filename, datasetname, [this, datasetname](std::string file){
+			this->save_to_file(file, datasetname);
+			this->stamp_inputs(file, datasetname);
+		});
+	if (table_group() > 1)
+		driver.group_cells(table_group(),
+			[this](size_t first, double * result){ this->tabulate_group(first, result); });
+	driver.run(table_data(),
+		[this](size_t cell, double * result){ this->tabulate_cell(cell, result); });
+	// a regular save truncates the file, which also drops the bitmap
+	save_to_file(filename, datasetname);
+	stamp_inputs(filename, datasetname);
+	driver.write_summary();
+	store_in_cache(filename);
+}
+
+void tabulated_table::tabulate_group(size_t first, double * result){
+	size_t Ncomponents = table_components();
+	for (size_t k=0; k<table_group(); k++) tabulate_cell(first+k, result + k*Ncomponents);
+}
+
+size_t tabulated_table::table_size(void){
+	size_t N = 1;
+	for (auto&& n : table_shape()) N *= n;
+	return N;
+}
+
+void tabulated_table::tabulate_shard(size_t first, size_t last, std::string filename, std::string datasetname){
+	// a shard computes its cells explicitly, never on lookup
+	lazy.reset();
+	tabulation_driver driver(filename, table_shape(), table_components());
+	driver.restrict_to(first, last);
+	if (tabulation_driver::is_checkpoint(filename, datasetname)){
+		read_from_file(filename, datasetname);
+		driver.load_completed(filename, datasetname);
+	}
+	driver.checkpoint_to(filename, datasetname, [this, datasetname](std::string file){
+			this->save_to_file(file, datasetname);
+			this->stamp_inputs(file, datasetname);
+		});
+	if (table_group() > 1)
+		driver.group_cells(table_group(),
+			[this](size_t first, double * result){ this->tabulate_group(first, result); });
+	driver.run(table_data(),
+		[this](size_t cell, double * result){ this->tabulate_cell(cell, result); });
+	save_to_file(filename, datasetname);
+	stamp_inputs(filename, datasetname);
+	tabulation_driver::write_completed(filename, datasetname, table_shape(),
+									   driver.completed_cells().data());
+	driver.write_summary();
+}
+
+void tabulated_table::persist_lazy_cells(void){
+	if (!lazy || lazy->Nnew_cells() == 0) return;
+	try{
+		std::vector<unsigned char> completed = lazy->completed();
+		save_to_file(table_filename, table_datasetname);
+		stamp_inputs(table_filename, table_datasetname);
+		// a partial table is stored in the checkpoint format
+		if (std::find(completed.begin(), completed.end(), 0) != completed.end())
+			tabulation_driver::write_completed(table_filename, table_datasetname,
+											   table_shape(), completed.data());
+		std::cout << "# " << table_filename << ": " << lazy->Nnew_cells()
+				  << " new cells saved" << std::endl;
+	}
+	catch (std::exception & e){
+		std::cerr << "# " << table_filename << ": new cells not saved (" << e.what() << ")" << std::endl;
+	}
+}
+
+//=============sharded tabulation==============================================
+namespace {
+	// attributes describing how a build went, accumulated instead of copied
+	bool is_summary_attr(const std::string & name){
+		return name == "N_retried_cells" || name == "N_failed_cells" || name == "failed_cells";
+	}
+
+	std::vector<char> raw_attr(const H5::Attribute & attr){
+		std::vector<char> buffer(attr.getStorageSize());
+		attr.read(attr.getDataType(), buffer.data());
+		return buffer;
+	}
+}
+
+void merge_table_shards(const std::vector<std::string> & shards,
+						std::string output, std::string datasetname){
+	if (shards.empty()) throw std::invalid_argument("merge: no shards given");
+	std::lock_guard<std::mutex> lock(hdf5_mutex());
+	H5::H5File reference_file(shards[0], H5F_ACC_RDONLY);
+	H5::DataSet reference = reference_file.openDataSet(datasetname);
+	H5::DataSpace space = reference.getSpace();
+	std::vector<hsize_t> dims(size_t(space.getSimpleExtentNdims())), grid;
+	space.getSimpleExtentDims(dims.data(), NULL);
+	size_t Nvalues = size_t(space.getSimpleExtentNpoints());
+	{
+		H5::DataSpace bitmap_space = reference_file.openDataSet(datasetname + "-completed").getSpace();
+		grid.resize(size_t(bitmap_space.getSimpleExtentNdims()));
+		bitmap_space.getSimpleExtentDims(grid.data(), NULL);
+	}
+	size_t Ncells = 1;
+	for (auto&& n : grid) Ncells *= n;
+	// Qhat-like tables keep their components as consecutive blocks of Ncells
+	size_t Nblocks = Nvalues/Ncells;
+
+	std::vector<double> values(Nvalues, 0.), buffer(Nvalues);
+	std::vector<unsigned char> completed(Ncells, 0), bitmap(Ncells);
+	std::vector<double> relerr(Ncells, std::nan("")), relerr_buffer(Ncells);
+	std::vector<size_t> iterations(Ncells, 0), iterations_buffer(Ncells);
+	size_t Nretried = 0, Nfailed = 0, Noverlap = 0;
+	// cell indices are global, the lists of the shards are simply joined
+	std::vector<size_t> failed_cells;
+	for (auto&& shard : shards){
+		H5::H5File file(shard, H5F_ACC_RDONLY);
+		H5::DataSet dataset = file.openDataSet(datasetname);
+		if (size_t(dataset.getSpace().getSimpleExtentNpoints()) != Nvalues)
+			throw std::runtime_error(shard + ": table shape differs from " + shards[0]);
+		// every shard must describe the same grid
+		for (int i=0; i<reference.getNumAttrs(); i++){
+			H5::Attribute attr = reference.openAttribute(unsigned(i));
+			std::string name = attr.getName();
+			if (is_summary_attr(name)) continue;
+			if (!dataset.attrExists(name) || raw_attr(dataset.openAttribute(name)) != raw_attr(attr))
+				throw std::runtime_error(shard + ": attribute " + name + " differs from " + shards[0]);
+		}
+		dataset.read(buffer.data(), H5::PredType::NATIVE_DOUBLE);
+		H5::DataSet bitmap_set = file.openDataSet(datasetname + "-completed");
+		if (size_t(bitmap_set.getSpace().getSimpleExtentNpoints()) != Ncells)
+			throw std::runtime_error(shard + ": grid differs from " + shards[0]);
+		bitmap_set.read(bitmap.data(), H5::PredType::NATIVE_UINT8);
+		bool accuracy = H5Lexists(file.getId(), (datasetname + "-relerr").c_str(), H5P_DEFAULT) > 0
+					 && H5Lexists(file.getId(), (datasetname + "-iterations").c_str(), H5P_DEFAULT) > 0;
+		if (accuracy){
+			file.openDataSet(datasetname + "-relerr").read(relerr_buffer.data(), type<double>());
+			file.openDataSet(datasetname + "-iterations").read(iterations_buffer.data(), type<size_t>());
+		}
+		for (size_t n=0; n<Ncells; n++){
+			if (!bitmap[n]) continue;
+			if (completed[n]) Noverlap++;
+			completed[n] = 1;
+			for (size_t c=0; c<Nblocks; c++) values[c*Ncells + n] = buffer[c*Ncells + n];
+			relerr[n] = accuracy ? relerr_buffer[n] : std::nan("");
+			iterations[n] = accuracy ? iterations_buffer[n] : 0;
+		}
+		if (dataset.attrExists("N_retried_cells")){
+			size_t N;
+			hdf5_read_scalar_attr(dataset, "N_retried_cells", N);
+			Nretried += N;
+		}
+		if (dataset.attrExists("N_failed_cells")){
+			size_t N;
+			hdf5_read_scalar_attr(dataset, "N_failed_cells", N);
+			Nfailed += N;
+		}
+		if (dataset.attrExists("failed_cells")){
+			H5::Attribute attr = dataset.openAttribute("failed_cells");
+			std::vector<size_t> listed(size_t(attr.getSpace().getSimpleExtentNpoints()));
+			attr.read(type<size_t>(), listed.data());
+			failed_cells.insert(failed_cells.end(), listed.begin(), listed.end());
+		}
+		std::cout << "# merged " << shard << std::endl;
+	}
+	size_t Nmissing = size_t(std::count(completed.begin(), completed.end(), 0));
+
+	H5::H5File file(output, H5F_ACC_TRUNC);
+	H5::DataSet dataset = file.createDataSet(datasetname, H5::PredType::NATIVE_DOUBLE,
+								H5::DataSpace(dims.size(), dims.data()), reference.getCreatePlist());
+	dataset.write(values.data(), H5::PredType::NATIVE_DOUBLE);
+	for (int i=0; i<reference.getNumAttrs(); i++){
+		H5::Attribute attr = reference.openAttribute(unsigned(i));
+		if (is_summary_attr(attr.getName())) continue;
+		std::vector<char> raw = raw_attr(attr);
+		dataset.createAttribute(attr.getName(), attr.getDataType(), attr.getSpace())
+			   .write(attr.getDataType(), raw.data());
+	}
+	hdf5_add_scalar_attr(dataset, "N_retried_cells", Nretried);
+	hdf5_add_scalar_attr(dataset, "N_failed_cells", Nfailed);
+	size_t Nlisted = tabulation_driver::max_failed_listed;
+	std::sort(failed_cells.begin(), failed_cells.end());
+	failed_cells.resize(std::min(failed_cells.size(), Nlisted));
+	if (!failed_cells.empty()){
+		hsize_t failed_dims[1] = {failed_cells.size()};
+		dataset.createAttribute("failed_cells", type<size_t>(), H5::DataSpace(1, failed_dims))
+			   .write(type<size_t>(), failed_cells.data());
+	}
+	{
+		H5::DataSpace grid_space(grid.size(), grid.data());
+		file.createDataSet(datasetname + "-relerr", type<double>(), grid_space).write(relerr.data(), type<double>());
+		file.createDataSet(datasetname + "-iterations", type<size_t>(), grid_space)
+			.write(iterations.data(), type<size_t>());
+	}
+	if (Nmissing > 0){
+		H5::DataSet bitmap_set = file.createDataSet(datasetname + "-completed",
+									H5::PredType::NATIVE_UINT8, H5::DataSpace(grid.size(), grid.data()));
+		bitmap_set.write(completed.data(), H5::PredType::NATIVE_UINT8);
+	}
+	std::cout << "# " << output << ": " << Ncells-Nmissing << " of " << Ncells << " cells";
+	if (Noverlap > 0) std::cout << ", " << Noverlap << " cells found in several shards";
+	if (Nmissing > 0) std::cout << ", the missing ones are computed when the table is loaded";
+	std::cout << std::endl;
+}
+
+//=============extension of tables=============================================
+void tabulated_table::extend(std::string axis, double low, double high){
+	std::vector<table_axis> axes = table_axes();
+	auto a = std::find_if(axes.begin(), axes.end(),
+						  [&axis](const table_axis & x){ return x.name == axis; });
+	if (a == axes.end())
+		throw std::invalid_argument(table_filename + ": axis " + axis + " cannot be extended");
+	std::string filename = table_filename, datasetname = table_datasetname;
+	double L, H;
+	size_t N;
+	{
+		std::lock_guard<std::mutex> lock(hdf5_mutex());
+		H5::H5File file(filename, H5F_ACC_RDONLY);
+		if (adaptive_grid::is_adaptive(file, datasetname))
+			throw std::runtime_error(filename + ": adaptive tables cannot be extended");
+		H5::DataSet dataset = file.openDataSet(datasetname);
+		hdf5_read_scalar_attr(dataset, a->low, L);
+		hdf5_read_scalar_attr(dataset, a->high, H);
+		hdf5_read_scalar_attr(dataset, a->N, N);
+	}
+	// keep the spacing, round the new range outwards to whole steps
+	double step = (H-L)/(N-1.);
+	size_t Nbelow = (low < L) ? size_t(std::ceil((L-low)/step - 1e-6)) : 0,
+		   Nabove = (high > H) ? size_t(std::ceil((high-H)/step - 1e-6)) : 0;
+	if (Nbelow + Nabove == 0){
+		std::cout << "# " << filename << ": " << axis << " already covers the range" << std::endl;
+		return;
+	}
+
+	// start from everything computed so far
+	persist_lazy_cells();
+	lazy.reset();
+	std::vector<size_t> grid = table_shape();
+	std::vector<unsigned char> completed(table_size(), 1);
+	if (tabulation_driver::is_checkpoint(filename, datasetname))
+		completed = tabulation_driver::read_completed(filename, datasetname, grid);
+	{
+		std::lock_guard<std::mutex> lock(hdf5_mutex());
+		std::string tmpname = filename + ".extending";
+		{
+			H5::H5File file(filename, H5F_ACC_RDONLY);
+			H5::DataSet dataset = file.openDataSet(datasetname);
+			H5::DataSpace space = dataset.getSpace();
+			std::vector<hsize_t> dims(size_t(space.getSimpleExtentNdims()));
+			space.getSimpleExtentDims(dims.data(), NULL);
+			// Qhat_2to2 stores its components along an extra leading dimension
+			size_t offset = dims.size() - grid.size(), Ncells = completed.size();
+			size_t Nblocks = size_t(space.getSimpleExtentNpoints())/Ncells;
+			size_t stride = 1;
+			for (size_t d=a->dim+1; d<grid.size(); d++) stride *= grid[d];
+			size_t Nnew = N + Nbelow + Nabove, Nnew_cells = Ncells/N*Nnew;
+			std::vector<double> values(Nblocks*Ncells), new_values(Nblocks*Nnew_cells, 0.);
+			std::vector<unsigned char> new_completed(Nnew_cells, 0);
+			dataset.read(values.data(), H5::PredType::NATIVE_DOUBLE);
+			for (size_t n=0; n<Ncells; n++){
+				size_t i = (n/stride)%N, outer = n/(stride*N), inner = n%stride;
+				size_t m = (outer*Nnew + i + Nbelow)*stride + inner;
+				new_completed[m] = completed[n];
+				for (size_t c=0; c<Nblocks; c++) new_values[c*Nnew_cells + m] = values[c*Ncells + n];
+			}
+
+			dims[offset + a->dim] = Nnew;
+			grid[a->dim] = Nnew;
+			std::vector<hsize_t> bitmap_dims(grid.begin(), grid.end());
+			H5::H5File output(tmpname, H5F_ACC_TRUNC);
+			H5::DataSet extended = output.createDataSet(datasetname, H5::PredType::NATIVE_DOUBLE,
+										H5::DataSpace(dims.size(), dims.data()), dataset.getCreatePlist());
+			extended.write(new_values.data(), H5::PredType::NATIVE_DOUBLE);
+			for (int k=0; k<dataset.getNumAttrs(); k++){
+				H5::Attribute attr = dataset.openAttribute(unsigned(k));
+				std::string name = attr.getName();
+				if (is_summary_attr(name) || name == a->low || name == a->high || name == a->N) continue;
+				std::vector<char> raw = raw_attr(attr);
+				extended.createAttribute(name, attr.getDataType(), attr.getSpace())
+						.write(attr.getDataType(), raw.data());
+			}
+			hdf5_add_scalar_attr(extended, a->low, L - Nbelow*step);
+			hdf5_add_scalar_attr(extended, a->high, H + Nabove*step);
+			hdf5_add_scalar_attr(extended, a->N, Nnew);
+			output.createDataSet(datasetname + "-completed", H5::PredType::NATIVE_UINT8,
+								 H5::DataSpace(bitmap_dims.size(), bitmap_dims.data()))
+				  .write(new_completed.data(), H5::PredType::NATIVE_UINT8);
+			std::cout << "# " << filename << ": " << axis << " extended to ["
+					  << L - Nbelow*step << ", " << H + Nabove*step << "], "
+					  << N << " -> " << Nnew << " points" << std::endl;
+		}
+		boost::filesystem::rename(tmpname, filename);
+	}
+	// resuming the checkpoint computes the new slab only
+	load_or_tabulate(filename, datasetname, false);
+}
@@ -0,0 +1,338 @@
+#ifndef TABULATION_H
+#define TABULATION_H
+
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <initializer_list>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//=============global tabulation settings=======================================
+struct tabulation_options{
+	// [s] wall time between two checkpoints of a running table build,
+	// a value <= 0 disables checkpointing
+	double checkpoint_interval;
+	// number of escalated retries of a failing cell before it is given up
+	size_t max_retries;
+	// tables that support it are built on an adaptive grid refined to this
+	// relative interpolation error, a value <= 0 keeps the uniform grids
+	double refine_tolerance;
+	// maximum number of bisections of an adaptive base cell
+	size_t refine_max_level;
+	// missing table cells are computed at their first lookup instead of
+	// before the run, see lazy_cells
+	bool lazy;
+	// directory of complete tables named by the hash of their inputs, shared
+	// between runs and workers; empty disables the cache
+	std::string cache_dir;
+	// [s] wall time budget of the Monte Carlo integration of a cell, raised
+	// with the escalation level like the evaluation budget; <= 0 for none
+	double cell_time_limit;
+	// tables of channels that share their kinematics are built from common
+	// integrations, see fused_cells
+	bool fuse_channels;
+};
+tabulation_options & table_options(void);
+
+//=============partitioned tabulation driver===================================
+// All table classes are filled through this driver.
+// A table of shape (N0, N1, ...) holding Ncomponents values per grid point is
+// stored as Ncomponents consecutive row-major blocks, i.e. component c of the
+// cell with flat index n lives at table[c*Ncells + n]
+// (Qhat_2to2 stores drag, kperp and kpara this way).
+// The driver splits the missing cells of [0, Ncells) into disjoint single-cell
+// ranges, hands them to the thread pool and is the only one to write into the
+// table: compute() receives a cell index and fills a private buffer of
+// Ncomponents values.
+// Debug builds additionally count the writes to every cell and throw on
+// overlapping or missing writes.
+// With group_cells(), aligned groups of Ngroup consecutive cells (the
+// innermost axes of the table) are computed by a single task that fills
+// Ngroup*Ncomponents values, cell by cell; only the missing cells of a group
+// are written.
+// Tasks are dealt out in boustrophedon order (every axis runs back and forth),
+// so the consecutive tasks of a worker are neighbouring cells whose Vegas
+// integrations start from the grid of the previous one; a worker that jumps
+// elsewhere, e.g. after stealing, starts from a uniform grid (see
+// forget_warm_start).
+// With a checkpoint target, the table and a bitmap of the completed cells
+// (dataset "<datasetname>-completed") are flushed to the file periodically;
+// load_completed() restores the bitmap so that only missing cells are computed.
+// A checkpoint is written to "<file>.tmp" and renamed over the file, so an
+// interrupted flush leaves the previous checkpoint intact.
+// A cell whose integrators report an error (see integration.h), whose value is
+// not finite, or whose computation throws is retried with escalated integrator
+// limits up to max_retries times. Cells that still fail are filled from their
+// valid neighbours, and write_summary() records them as attributes of the
+// dataset.
+// The largest relative error estimate of the integrations of every cell and
+// their iterations (see integration_status) are saved next to the table as
+// datasets "<datasetname>-relerr" and "<datasetname>-iterations", the cells
+// of a group share the values of the group. Cells computed at their first
+// lookup, and the cells a table had before extend(), have an unknown error
+// (NaN) and 0 iterations.
+class tabulation_driver{
+private:
+	std::string name;
+	std::vector<size_t> shape;
+	size_t Ncells, Ncomponents;
+	size_t first_cell, last_cell;
+	size_t Ngroup, Dgroup;
+	std::function<void(size_t, double *)> compute_group;
+	std::vector<size_t> cells_per_worker;
+	std::vector<unsigned char> completed;
+	std::vector<size_t> failed_cells;
+	std::vector<double> cell_relerr;
+	std::vector<size_t> cell_iterations;
+	std::atomic<size_t> Nretried;
+	bool fill_neighbours;
+	std::mutex m_table;
+	std::function<void(std::string)> save;
+	std::string filename, datasetname;
+	std::chrono::steady_clock::time_point last_flush;
+	void fill_failed(double * table);
+	// position of a cell (group) along the boustrophedon walk of the grid
+	size_t walk_position(size_t cell) const;
+	bool neighbours(size_t cell1, size_t cell2) const;
+	bool checkpoint_due(void) const;
+	void flush(void);
+	void report(void) const;
+public:
+	// write_summary() lists at most this many failed cells, a longer list
+	// would exceed the HDF5 attribute size limit
+	static const size_t max_failed_listed = 4096;
+	tabulation_driver(std::string name_, std::vector<size_t> shape_, size_t Ncomponents_ = 1);
+	size_t size(void) const {return Ncells;};
+	size_t Ncompleted(void) const;
+	// decompose a flat cell index into one index per axis
+	void unravel(size_t cell, size_t * index) const;
+	// only compute the cells [first, last), e.g. one shard of a table
+	void restrict_to(size_t first, size_t last);
+	// compute groups of Ngroup_ cells, the product of the innermost axes, at
+	// once; compute_group_ receives the first cell of a group
+	void group_cells(size_t Ngroup_, std::function<void(size_t, double *)> compute_group_);
+	const std::vector<unsigned char> & completed_cells(void) const {return completed;};
+	// leave failed cells NaN instead of filling them from their neighbours,
+	// for cells whose flat index is no grid; failed() lists them after run()
+	void keep_failed(void) {fill_neighbours = false;};
+	const std::vector<size_t> & failed(void) const {return failed_cells;};
+	// save_(file) writes the table to file
+	void checkpoint_to(std::string filename_, std::string datasetname_, std::function<void(std::string)> save_);
+	void load_completed(std::string filename_, std::string datasetname_);
+	void run(double * table, std::function<void(size_t, double *)> compute);
+	void write_summary(void);
+	// compute one cell under the failure policy, false if it failed for good
+	static bool attempt(const std::string & name, size_t cell, size_t Ncomponents, double * value,
+						std::function<void(size_t, double *)> & compute, bool * retried = NULL);
+	static bool is_checkpoint(std::string filename_, std::string datasetname_);
+	static std::vector<unsigned char> read_completed(std::string filename_, std::string datasetname_,
+													 const std::vector<size_t> & shape_);
+	static void write_completed(std::string filename_, std::string datasetname_,
+								const std::vector<size_t> & shape_, const unsigned char * completed_);
+	static void write_accuracy(std::string filename_, std::string datasetname_,
+							   const std::vector<size_t> & shape_, const double * relerr_,
+							   const size_t * iterations_);
+};
+
+//=============lazy table cells================================================
+// In lazy mode a table starts with only the cells found in its file, and the
+// interpolation routines call require() for the grid points they are about to
+// read. Each cell carries an atomic state (empty, computing, ready): the first
+// reader of an empty cell computes it in place under the failure policy of the
+// driver, concurrent readers of the same cell wait for it instead of computing
+// it twice, and ready cells cost a single atomic load.
+// A cell that fails for good is filled from its neighbours that are ready
+// already, no neighbour is computed for it.
+class lazy_cells{
+private:
+	enum {empty = 0, computing = 1, ready = 2};
+	std::string name;
+	std::vector<size_t> shape;
+	size_t Ncells, Ncomponents;
+	double * table;
+	std::function<void(size_t, double *)> compute;
+	std::unique_ptr<std::atomic<unsigned char>[]> state;
+	std::atomic<size_t> Nnew;
+	std::mutex m_ready;
+	std::condition_variable cv_ready;
+	void fill_from_neighbours(size_t cell, double * value);
+public:
+	lazy_cells(std::string name_, std::vector<size_t> shape_, size_t Ncomponents_,
+			   double * table_, std::function<void(size_t, double *)> compute_,
+			   const std::vector<unsigned char> & completed);
+	void require(size_t cell);
+	// require every grid point of the D-dimensional box [lower, lower+count),
+	// count = NULL means 2 points per axis
+	void require_box(const size_t * lower, const size_t * count, size_t D);
+	size_t Nnew_cells(void) const {return Nnew;};
+	std::vector<unsigned char> completed(void) const;
+};
+
+//=============fused channels==================================================
+// The tables of several channels whose integrands only differ by a factor,
+// e.g. the elastic matrix element of Q+q->Q+q+g and Q+g->Q+g+g, can be built
+// from common integrations. A channel computing a group of cells calls get():
+// the first channel to reach a group integrates all channels at once and
+// leaves the values of the others here, which take them instead of
+// integrating again; a channel asking for a group that is being computed
+// waits for it. Groups are identified by a key of their physical coordinates,
+// so only tables with identical grids share them. The integrator status of
+// the common integration is added to the status of every channel that takes
+// its values, so the driver retries them alike; a retry of a channel
+// recomputes the group for all channels that have not taken it yet.
+// A channel whose table is complete, computed or loaded, calls leave(), and
+// get() returns false once no other channel is left: the caller then
+// integrates its own channel alone.
+class fused_cells{
+private:
+	struct entry{
+		std::vector<double> values;
+		std::vector<bool> taken;
+		bool ready;
+		size_t Nfailures, Niterations;
+		int last_error;
+		double relerr;
+	};
+	const size_t Nchannels;
+	std::vector<bool> active;
+	std::map<std::vector<double>, entry> groups;
+	std::mutex m;
+	std::condition_variable cv_ready;
+	bool taken_by_all(const entry & e) const;
+public:
+	fused_cells(size_t Nchannels_) : Nchannels(Nchannels_), active(Nchannels_, true) {};
+	size_t size(void) const {return Nchannels;};
+	// the Nvalues values of channel for the group key into result;
+	// compute_all fills the Nchannels*Nvalues values of all channels,
+	// channel by channel
+	bool get(const std::vector<double> & key, size_t channel, size_t Nvalues, double * result,
+			 std::function<void(double *)> compute_all);
+	void leave(size_t channel);
+};
+
+//=============extendable table axes===========================================
+// A uniformly spaced axis of a table and the attributes its range is saved
+// with: points low + i*(high-low)/(N-1), i < N, along dimension dim of
+// table_shape().
+struct table_axis{
+	std::string name;
+	size_t dim;
+	std::string low, high, N;
+};
+
+//=============table inputs====================================================
+// Everything the values of a table depend on, as "key=value" lines: the
+// physics (process, masses, degeneracies, Debye mass, code version, ...) and
+// the grid. Global settings such as the Debye mass prescription are
+// registered once with set_global() and enter every table.
+// physics_hash() decides whether an existing table file may be reused, hash()
+// (physics and grid) names the table in the cache directory.
+class table_inputs{
+private:
+	std::string physics, grid;
+	static std::map<std::string, std::string> & globals(void);
+	template <typename T>
+	static std::string line(std::string key, const T & value){
+		std::ostringstream s;
+		s << std::setprecision(17) << key << "=" << value << "\n";
+		return s.str();
+	}
+public:
+	template <typename T>
+	void add(std::string key, const T & value) {physics += line(key, value);}
+	// spacing is a grid_axis::name(), only non-uniform spacings are recorded
+	void add_axis(std::string name, double low, double high, size_t N, std::string spacing = "uniform"){
+		grid += line(name + "_low", low) + line(name + "_high", high) + line("N_" + name, N);
+		if (spacing != "uniform") grid += line(name + "_spacing", spacing);
+	};
+	template <typename T>
+	static void set_global(std::string key, const T & value) {globals()[key] = line(key, value);}
+	size_t physics_hash(void) const;
+	size_t hash(void) const;
+};
+
+//=============common interface of all tables==================================
+// A table knows its grid shape, its storage and how to compute one cell.
+// load_or_tabulate() implements the life cycle shared by all table classes:
+// load a finished table, resume an interrupted one from its checkpoint, or
+// compute it from scratch, and finally save it. With a refine tolerance set,
+// new builds go through tabulate_adaptive() where available.
+// In lazy mode nothing is computed up front; the interpolation routines call
+// require_cells() and the destructors of the table classes call
+// persist_lazy_cells(), which saves the new cells in the checkpoint format so
+// that the next run, lazy or not, starts from them.
+// It calls virtual functions and must be called from the constructor of the
+// most derived class.
+// extend() widens one of the table_axes() of a loaded table at the same grid
+// spacing: the existing cells are moved into a checkpoint of the larger grid,
+// which is then resumed, so only the new slab of cells is computed.
+// Files are stamped with the physics_hash and input_hash of describe_inputs();
+// a file whose physics hash differs from the current inputs is recomputed
+// instead of being reused, and complete tables are fetched from and stored
+// in the cache directory.
+class tabulated_table{
+protected:
+	virtual std::vector<size_t> table_shape(void) = 0;
+	virtual size_t table_components(void) {return 1;};
+	virtual double * table_data(void) = 0;
+	virtual void tabulate_cell(size_t cell, double * result) = 0;
+	virtual void save_to_file(std::string filename, std::string datasetname) = 0;
+	virtual void read_from_file(std::string filename, std::string datasetname) = 0;
+	// build and save an adaptive version of the table instead of the uniform
+	// one, returns false if the table does not support it
+	virtual bool tabulate_adaptive(std::string, std::string) {return false;};
+	// number of consecutive cells tabulate_group() computes together, e.g. a
+	// whole dt axis sharing one integration; 1 computes cell by cell
+	virtual size_t table_group(void) {return 1;};
+	virtual void tabulate_group(size_t first, double * result);
+	// the axes extend() can widen, none by default
+	virtual std::vector<table_axis> table_axes(void) {return {};};
+	// add the parameters and the grid of the table, see table_inputs
+	virtual void describe_inputs(table_inputs &) {};
+	void load_or_tabulate(std::string filename, std::string datasetname, bool refresh);
+	void persist_lazy_cells(void);
+	void require_cells(std::initializer_list<size_t> lower, std::initializer_list<size_t> count = {}){
+		if (lazy) lazy->require_box(lower.begin(), count.size() ? count.begin() : NULL, lower.size());
+	};
+	// batch lookups of a lazy table have to go through require_cells() point by point
+	bool lazy_mode(void) const {return bool(lazy);};
+private:
+	std::unique_ptr<lazy_cells> lazy;
+	std::string table_filename, table_datasetname;
+	size_t physics_key, input_key;
+	void collect_inputs(void);
+	bool inputs_match(std::string filename, std::string datasetname);
+	void stamp_inputs(std::string filename, std::string datasetname);
+	std::string cache_path(void);
+	bool fetch_from_cache(std::string filename);
+	void store_in_cache(std::string filename);
+public:
+	tabulated_table(void) : physics_key(0), input_key(0) {};
+	virtual ~tabulated_table(){};
+	// tables computed from this one include it in their own inputs
+	size_t input_physics_hash(void) const {return physics_key;};
+	size_t table_size(void);
+	// compute the cells [first, last) into a partial file in the checkpoint
+	// format, resuming that file if it already exists (see merge_table_shards)
+	void tabulate_shard(size_t first, size_t last, std::string filename, std::string datasetname);
+	// widen the axis to cover [low, high], a NaN bound is left unchanged
+	void extend(std::string axis, double low, double high);
+};
+
+//=============sharded tabulation==============================================
+// Assemble partial table files written by tabulate_shard() into the regular
+// dataset with the attributes of the shards, which must share the same grid.
+// Cells missing from all shards stay marked in the bitmap of the output, so
+// the table constructor computes them when the file is first loaded.
+void merge_table_shards(const std::vector<std::string> & shards,
+						std::string output, std::string datasetname);
+
+#endif
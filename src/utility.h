@@ -3,8 +3,9 @@
 
 #include <cmath>
 #include <vector>
-#include <boost/multi_array.hpp>
+#include <mutex>
 #include <H5Cpp.h>
+#include "grid_table.h"
 
 //=============constants=======================================================
 const double c4d9 = 4./9.;
@@ -25,18 +26,9 @@ const double mu2_left = Lambda2*std::exp(1.0),
 // [GeV^2] ranges within which alphas > 1 and will be cut
 
 
-double interpolate2d(	boost::multi_array<double, 2> * A,
-					 	const int& ni, const int& nj,
-					 	const double& ri, const double& rj);
-double interpolate3d(	boost::multi_array<double, 3> * A,
-						const int& ni, const int& nj, const int& nk,
-						const double& ri, const double& rj, const double& rk);
-double interpolate4d(	boost::multi_array<double, 4> * A,
-						const int& ni, const int& nj, const int& nk, const int& nt,
-						const double& ri, const double& rj, const double& rk, const double& rt);
-double interpolate2d_YX(   boost::multi_array<double, 3> * A, const int& index,
-					 	const int& ni, const int& nj,
-					 	const double& ri, const double& rj);
+// The HDF5 C++ library is not thread-safe, tables built concurrently must
+// hold this lock for as long as they touch any HDF5 object.
+std::mutex & hdf5_mutex(void);
 
 template <typename T> inline const H5::PredType& type();
 template <> inline const H5::PredType& type<size_t>() { return H5::PredType::NATIVE_HSIZE; }
@@ -57,4 +49,11 @@ void hdf5_read_scalar_attr(
   auto attr = dataset.openAttribute(name.c_str());
   attr.read(datatype, &value);
 }
+
+// The spacing of a non-uniform axis "<name>" of a table file: the attribute
+// "<name>_spacing" holds grid_axis::spacing, "<name>_exponent" the exponent
+// of a power law. Uniform axes, and the tables of older files, have neither.
+void hdf5_add_axis_attrs(const H5::DataSet& dataset, const std::string& name, const grid_axis& axis);
+grid_axis hdf5_read_axis(const H5::DataSet& dataset, const std::string& name,
+						 double low, double high, size_t N);
 #endif